@@ -0,0 +1,78 @@
+//
+//  AssetLoader.cpp
+//  TestingVulkan
+//
+
+#include "AssetLoader.hpp"
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+AssetLoader::~AssetLoader() {
+    for (auto& mapping : mappings) {
+        munmap(const_cast<uint8_t*>(mapping.second.data), mapping.second.size);
+    }
+}
+
+AssetView AssetLoader::load(const std::string& path, bool prefetch) {
+    auto found = mappings.find(path);
+    if (found != mappings.end()) {
+        return found->second;
+    }
+    
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("failed to open file " + path + "!");
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        throw std::runtime_error("failed to read file " + path + "!");
+    }
+    
+    /*
+     MAP_POPULATE, where there is one, faults every page in before mmap returns. Elsewhere
+     MADV_WILLNEED starts the reads and returns. The descriptor is not needed after mmap.
+     */
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    if (prefetch) {
+        flags |= MAP_POPULATE;
+    }
+#endif
+    void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, flags, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error("failed to map file " + path + "!");
+    }
+#ifndef MAP_POPULATE
+    if (prefetch) {
+        madvise(data, (size_t)info.st_size, MADV_WILLNEED);
+    }
+#endif
+    
+    AssetView view;
+    view.data = static_cast<const uint8_t*>(data);
+    view.size = (size_t)info.st_size;
+    mappings[path] = view;
+    return view;
+}
+
+AssetView AssetLoader::loadSpirv(const std::string& path) {
+    AssetView view = load(path, true);
+    if (view.size % sizeof(uint32_t) != 0) {
+        throw std::runtime_error("SPIR-V file " + path + " is not a whole number of words!");
+    }
+    return view;
+}
+
+void AssetLoader::release(const std::string& path) {
+    auto found = mappings.find(path);
+    if (found == mappings.end()) {
+        return;
+    }
+    munmap(const_cast<uint8_t*>(found->second.data), found->second.size);
+    mappings.erase(found);
+}
@@ -0,0 +1,56 @@
+//
+//  AssetLoader.hpp
+//  TestingVulkan
+//
+//  Read-only access to shader and texture files without copying them.
+//
+
+#ifndef AssetLoader_hpp
+#define AssetLoader_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+
+/*
+ A view of a whole file, valid as long as the AssetLoader that returned it.
+ */
+struct AssetView {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    
+    // The file as SPIR-V words. Mappings start on a page boundary, so the cast is aligned.
+    const uint32_t* words() const { return reinterpret_cast<const uint32_t*>(data); }
+};
+
+/*
+ Maps asset files read-only into the address space and hands out views of the mappings,
+ so vkCreateShaderModule and staging uploads read straight from the page cache instead of
+ a heap copy. Every file is mapped once; the mappings are released with the loader.
+ */
+class AssetLoader {
+public:
+    AssetLoader() = default;
+    AssetLoader(const AssetLoader&) = delete;
+    AssetLoader& operator=(const AssetLoader&) = delete;
+    ~AssetLoader();
+    
+    /*
+     Maps `path`, or returns the mapping made before. With prefetch the kernel reads the
+     whole file in right away, which pays off for files that are read front to back anyway.
+     Throws when the file cannot be opened or is empty.
+     */
+    AssetView load(const std::string& path, bool prefetch = false);
+    
+    // load() for a SPIR-V file, which also has to be a whole number of 32-bit words.
+    AssetView loadSpirv(const std::string& path);
+    
+    // Unmaps `path`. Views of it must not be used afterwards.
+    void release(const std::string& path);
+    
+private:
+    std::map<std::string, AssetView> mappings;
+};
+
+#endif /* AssetLoader_hpp */
@@ -7,9 +7,25 @@
 //
 
 #include "BaseApp.hpp"
+#include "ge25519_ref.hpp"
+#include "ed25519_ref.hpp"
+#include "CpuEngine.hpp"
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <set>
 
+/*
+ Serials of the engines between init() and cleanup(). streamIndex() drops what a thread kept of
+ the others, so a thread that outlives many engines does not hold an entry for each of them.
+ */
+static std::mutex liveEnginesMutex;
+static std::set<uint64_t> liveEngines;
 
 VkResult CreateDebugUtilsMessengerEXT(VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDebugUtilsMessengerEXT* pDebugMessenger) {
     auto func = (PFN_vkCreateDebugUtilsMessengerEXT) vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
@@ -28,29 +44,963 @@ void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT
 }
 
 
+void BaseApp::init(uint32_t maxElementCount, uint32_t slotCount, uint32_t workgroupSize) {
+    if (maxElementCount == 0 || slotCount == 0 || workgroupSize == 0) {
+        throw std::runtime_error("element count, slot count and workgroup size must be positive!");
+    }
+    this->maxElementCount = maxElementCount;
+    this->slotCount = slotCount;
+    this->workgroupSize = workgroupSize;
+    // Large enough for an element of any kernel.
+    inBufferSize = (VkDeviceSize)std::max(sizeof(duble_fe25519), sizeof(ed25519_verify_input)) * maxElementCount;
+    // The transpose writes a whole duble_fe25519 per element.
+    outBufferSize = (VkDeviceSize)std::max(sizeof(duble_fe25519), sizeof(uint32_t)) * maxElementCount;
+    
+    initVulkan();
+}
+
 void BaseApp::initVulkan() {
     std::cout << "INFO: Vulkan initilization." << std::endl;
-    createInstance();
-    setupDebugMessenger();
-    pickPhysicalDevice();
-    createLogicalDevice();
-    createBuffer();
+    // A new serial on every init(), so the threads are handed streams of this engine afresh.
+    static std::atomic<uint64_t> engineCount{0};
+    {
+        std::lock_guard<std::mutex> lock(liveEnginesMutex);
+        liveEngines.erase(engineSerial);
+        engineSerial = ++engineCount;
+        liveEngines.insert(engineSerial);
+    }
+    nextStream = 0;
+    /*
+     Machines without a GPU, without a Vulkan driver for it, or whose GPU fails to come up stop here.
+     With cpuFallbackEnabled they still serve every batch, on the CPU. Only a NoDeviceError falls back,
+     missing validation layers or a batch too large for the device are errors on any machine.
+     */
+    if (deviceIndex == CPU_DEVICE) {
+        initCpuOnly("The CPU engine was asked for.");
+        return;
+    }
+    try {
+        createInstance();
+        setupDebugMessenger();
+        pickPhysicalDevice();
+        checkBufferLimits();
+        createLogicalDevice();
+    } catch (const NoDeviceError& e) {
+        if (!cpuFallbackEnabled || deviceIndex >= 0) {
+            throw;
+        }
+        destroyInstance();
+        physicalDevice = VK_NULL_HANDLE;
+        initCpuOnly(e.what());
+        return;
+    }
+    chooseWorkgroupSize();
     /*
     createInDescriptorSetLayout();
     createOutDescriptorSetLayout();*/
     
     createDescriptorSetLayout();
-    createDescriptorSet();
+    createDescriptorPool();
     
+    pipelineCache.create(physicalDevice, device, pipelineCacheFile);
     createComputePipeline();
-    createCommandBuffer();
-    setupInputBuffer();
-    // Finally, run the recorded command buffer.
-    runCommandBuffer();
     
-    reportResult();
+    /*
+     Two values per workgroup of the batch inversion, see fe25519_batch_invert.comp. The buffers
+     are sized for the smallest workgroup autotune() may pick, so they never have to grow.
+     */
+    uint32_t smallestGroup = std::min(workgroupSizes[KERNEL_BATCH_INVERT], MIN_TUNED_WORKGROUP_SIZE);
+    scratchBufferSize = 2 * (VkDeviceSize)sizeof(fe25519) * ((maxElementCount + smallestGroup - 1) / smallestGroup);
+    
+    if (timestampsEnabled) {
+        computeTimestampMask = getTimestampMask(queueFamilyIndex);
+        transferTimestampMask = getTimestampMask(transferQueueFamilyIndex);
+        bool uploadResettable = transferQueueFamilyIndex == queueFamilyIndex || hostQueryResetSupported;
+        uploadTimestampMask = uploadResettable ? transferTimestampMask : 0;
+        if (transferTimestampMask != 0 && uploadTimestampMask == 0) {
+            std::cout << "INFO: the transfer queue cannot reset its queries, uploads are not timed" << std::endl;
+        }
+    }
+    
+    /*
+     One stream per compute queue. Only the first is created now, it uploads the base table;
+     the others wait for a thread to submit to them.
+     */
+    streams.clear();
+    for (uint32_t i = 0; i < queueCount; ++i) {
+        streams.emplace_back(new Stream());
+        streams.back()->index = i;
+    }
+    Stream& first = *streams[0];
+    std::call_once(first.created, [this, &first]() { createStream(first); });
+    createBaseTable();
+    
+    if (splitBatches) {
+        cpuEngine = sharedCpuEngine != NULL ? sharedCpuEngine : std::make_shared<CpuEngine>(cpuThreadCount);
+        std::cout << "INFO: batches are split between the GPU and " << cpuEngine->threadCount()
+                  << " CPU threads." << std::endl;
+    }
+}
+
+void BaseApp::initCpuOnly(const std::string& reason) {
+    // No device to tune for. Batch inversion keeps the workgroups it would have on the GPU, and so its limbs.
+    for (uint32_t kernel = 0; kernel < KERNEL_COUNT; ++kernel) {
+        workgroupSizes[kernel] = workgroupSize;
+        subgroupSizes[kernel] = 0;
+    }
+    elementLimit = UINT32_MAX;
+    startCpuEngine(reason);
+    // Without queues the streams only keep the threads' batches apart, one per worker is plenty.
+    streams.clear();
+    for (uint32_t i = 0; i < cpuEngine->threadCount(); ++i) {
+        streams.emplace_back(new Stream());
+        streams.back()->index = i;
+        streams.back()->cpuOnly = true;
+        streams.back()->firstCpuValue = 1;
+    }
+}
+
+const char* BaseApp::fieldOpName(FieldOp op) {
+    static const char* names[FE_OP_COUNT] = {
+        "add", "sub", "neg", "mul", "sq", "sq2", "carry", "invert", "pow22523", "cmov", "frombytes", "tobytes",
+        "batch_invert"
+    };
+    return op < FE_OP_COUNT ? names[op] : "unknown";
+}
+
+/*
+ Row r, column i of the SoA block is word r of record i. Every element is a record of
+ `width` ints, fe25519 and duble_fe25519 have no padding.
+ */
+static void transposeWords(const int* records, int* rows, uint32_t count, uint32_t width) {
+    for (uint32_t i = 0; i < count; ++i) {
+        for (uint32_t r = 0; r < width; ++r) {
+            rows[r * count + i] = records[i * width + r];
+        }
+    }
+}
+
+static void untransposeWords(const int* rows, int* records, uint32_t count, uint32_t width) {
+    for (uint32_t r = 0; r < width; ++r) {
+        for (uint32_t i = 0; i < count; ++i) {
+            records[i * width + r] = rows[r * count + i];
+        }
+    }
+}
+
+void BaseApp::packSoA(const fe25519* elements, int* rows, uint32_t count) {
+    transposeWords(elements[0].value, rows, count, FE25519_WIDTH);
+}
+
+void BaseApp::packSoA(const duble_fe25519* elements, int* rows, uint32_t count) {
+    transposeWords(elements[0].value[0].value, rows, count, DUBLE_FE25519_WIDTH);
+}
+
+void BaseApp::unpackSoA(const int* rows, fe25519* elements, uint32_t count) {
+    untransposeWords(rows, elements[0].value, count, FE25519_WIDTH);
+}
+
+void BaseApp::unpackSoA(const int* rows, duble_fe25519* elements, uint32_t count) {
+    untransposeWords(rows, elements[0].value[0].value, count, DUBLE_FE25519_WIDTH);
+}
+
+void BaseApp::submit(FieldOp op, const duble_fe25519* input, fe25519* output, uint32_t count, uint32_t selector) {
+    submitAsync(op, input, output, count, NULL, selector).wait();
+}
+
+BaseApp::BatchHandle BaseApp::submitAsync(FieldOp op, const duble_fe25519* input, fe25519* output, uint32_t count,
+                                          const BatchHandle* after, uint32_t selector) {
+    if (count == 0 || count > maxElementCount) {
+        throw std::runtime_error("batch size does not fit the buffers created in init()!");
+    }
+    if (op >= FE_OP_COUNT) {
+        throw std::runtime_error("unknown field operation!");
+    }
+    
+    PushConstants pushConstants = {};
+    pushConstants.elementCount = count;
+    pushConstants.op = op;
+    pushConstants.selector = selector;
+    // Batch inversion is a kernel of its own, it works across the elements of a batch.
+    Kernel kernel = op == FE_BATCH_INVERT ? KERNEL_BATCH_INVERT : KERNEL_FIELD;
+    return submitKernel(kernel, pushConstants, input, sizeof(duble_fe25519), output, sizeof(fe25519), after);
+}
+
+void BaseApp::submitSoA(FieldOp op, const int* input, int* output, uint32_t count, uint32_t selector) {
+    submitSoAAsync(op, input, output, count, NULL, selector).wait();
+}
+
+BaseApp::BatchHandle BaseApp::submitSoAAsync(FieldOp op, const int* input, int* output, uint32_t count,
+                                             const BatchHandle* after, uint32_t selector) {
+    if (count == 0 || count > maxElementCount) {
+        throw std::runtime_error("batch size does not fit the buffers created in init()!");
+    }
+    if (op >= FE_OP_COUNT) {
+        throw std::runtime_error("unknown field operation!");
+    }
+    if (op == FE_BATCH_INVERT) {
+        throw std::runtime_error("batch inversion only takes LAYOUT_AOS batches!");
+    }
+    
+    PushConstants pushConstants = {};
+    pushConstants.elementCount = count;
+    pushConstants.op = op;
+    pushConstants.selector = selector;
+    return submitKernel(KERNEL_FIELD_SOA, pushConstants, input, sizeof(duble_fe25519), output, sizeof(fe25519), after);
+}
+
+void BaseApp::submitBytes(FieldOp op, const uint8_t* input, uint8_t* output, uint32_t count, uint32_t selector) {
+    submitBytesAsync(op, input, output, count, NULL, selector).wait();
+}
+
+BaseApp::BatchHandle BaseApp::submitBytesAsync(FieldOp op, const uint8_t* input, uint8_t* output, uint32_t count,
+                                               const BatchHandle* after, uint32_t selector) {
+    if (count == 0 || count > maxElementCount) {
+        throw std::runtime_error("batch size does not fit the buffers created in init()!");
+    }
+    if (op >= FE_OP_COUNT) {
+        throw std::runtime_error("unknown field operation!");
+    }
+    if (op == FE_FROMBYTES || op == FE_TOBYTES || op == FE_BATCH_INVERT) {
+        throw std::runtime_error("this field operation only takes FORMAT_LIMBS batches!");
+    }
+    
+    PushConstants pushConstants = {};
+    pushConstants.elementCount = count;
+    pushConstants.op = op;
+    pushConstants.selector = selector;
+    return submitKernel(KERNEL_FIELD_BYTES, pushConstants, input, 2 * FE25519_BYTES, output, FE25519_BYTES, after);
+}
+
+void BaseApp::transpose(Layout to, const int* input, int* output, uint32_t count, uint32_t width) {
+    transposeAsync(to, input, output, count, width).wait();
+}
+
+BaseApp::BatchHandle BaseApp::transposeAsync(Layout to, const int* input, int* output, uint32_t count, uint32_t width,
+                                             const BatchHandle* after) {
+    if (count == 0 || count > maxElementCount) {
+        throw std::runtime_error("batch size does not fit the buffers created in init()!");
+    }
+    if (width != FE25519_WIDTH && width != DUBLE_FE25519_WIDTH) {
+        throw std::runtime_error("only fe25519 and duble_fe25519 batches can be transposed!");
+    }
+    
+    // op is the layout to produce, selector the number of ints per element.
+    PushConstants pushConstants = {};
+    pushConstants.elementCount = count;
+    pushConstants.op = to;
+    pushConstants.selector = width;
+    uint32_t size = width * sizeof(int);
+    return submitKernel(KERNEL_TRANSPOSE, pushConstants, input, size, output, size, after);
+}
+
+void BaseApp::verify(const ed25519_verify_input* input, uint32_t* verdicts, uint32_t count) {
+    verifyAsync(input, verdicts, count).wait();
+}
+
+BaseApp::BatchHandle BaseApp::verifyAsync(const ed25519_verify_input* input, uint32_t* verdicts, uint32_t count,
+                                          const BatchHandle* after) {
+    if (count == 0 || count > maxElementCount) {
+        throw std::runtime_error("batch size does not fit the buffers created in init()!");
+    }
+    
+    PushConstants pushConstants = {};
+    pushConstants.elementCount = count;
+    return submitKernel(KERNEL_ED25519_VERIFY, pushConstants, input, sizeof(ed25519_verify_input), verdicts, sizeof(uint32_t), after);
+}
+
+void BaseApp::x25519(const duble_fe25519* input, fe25519* output, uint32_t count) {
+    x25519Async(input, output, count).wait();
+}
+
+BaseApp::BatchHandle BaseApp::x25519Async(const duble_fe25519* input, fe25519* output, uint32_t count,
+                                          const BatchHandle* after) {
+    if (count == 0 || count > maxElementCount) {
+        throw std::runtime_error("batch size does not fit the buffers created in init()!");
+    }
+    
+    PushConstants pushConstants = {};
+    pushConstants.elementCount = count;
+    return submitKernel(KERNEL_X25519, pushConstants, input, sizeof(duble_fe25519), output, sizeof(fe25519), after);
+}
+
+void BaseApp::scalarmultBase(const fe25519* scalars, fe25519* points, uint32_t count) {
+    scalarmultBaseAsync(scalars, points, count).wait();
+}
+
+BaseApp::BatchHandle BaseApp::scalarmultBaseAsync(const fe25519* scalars, fe25519* points, uint32_t count,
+                                                  const BatchHandle* after) {
+    if (count == 0 || count > maxElementCount) {
+        throw std::runtime_error("batch size does not fit the buffers created in init()!");
+    }
+    
+    PushConstants pushConstants = {};
+    pushConstants.elementCount = count;
+    return submitKernel(KERNEL_SCALARMULT_BASE, pushConstants, scalars, sizeof(fe25519), points, sizeof(fe25519), after);
+}
+
+BaseApp::BatchHandle BaseApp::submitKernel(Kernel kernel, const PushConstants& pushConstants, const void* input, uint32_t inputSize,
+                                           void* output, uint32_t outputSize, const BatchHandle* after) {
+    Stream& stream = currentStream();
+    /*
+     A batch of another stream shares no semaphore with ours, so it is waited for on the host, and
+     before taking our stream: its thread may be waiting for one of ours in turn.
+     */
+    if (after != NULL && after->valid() && after->stream != stream.index) {
+        after->wait();
+        after = NULL;
+    }
+    std::lock_guard<std::recursive_mutex> lock(stream.mutex);
+    if (onCpu) {
+        moveToCpu(stream);
+        return submitCpu(stream, kernel, pushConstants, input, inputSize, output, after);
+    }
+    uint32_t count = pushConstants.elementCount;
+    BatchSlot& slot = stream.slots[stream.nextSlot];
+    stream.nextSlot = (stream.nextSlot + 1) % slotCount;
+    
+    // The slot still holds the batch from slotCount submissions ago, finish that one first.
+    retireSlot(slot);
+    
+    /*
+     A dependency on an earlier batch. With timeline semaphores the dispatch waits for its value on
+     the GPU, its readback only has to be submitted so that the value will be signalled eventually.
+     Without them all we can do is wait on the host.
+     */
+    uint64_t waitValue = 0;
+    if (after != NULL && after->valid()) {
+        BatchSlot* afterSlot = findPendingSlot(stream, after->value);
+        // A share on the CPU, or a batch that never went to the GPU, can only be waited for on the host.
+        if (afterSlot != NULL) {
+            if (timelineSemaphoreSupported && afterSlot->onGpu && afterSlot->cpuJob == NULL) {
+                if (stream.deferredReadback == afterSlot) {
+                    submitReadback(*afterSlot);
+                }
+                waitValue = after->value;
+            } else {
+                retireSlot(*afterSlot);
+            }
+        }
+    }
+    // Either of the waits above may have found the device lost, or another thread may have.
+    if (onCpu) {
+        moveToCpu(stream);
+        return submitCpu(stream, kernel, pushConstants, input, inputSize, output, after);
+    }
+    
+    // With splitBatches the GPU takes the first gpuCount elements and the CPU engine the rest.
+    uint32_t gpuCount = count;
+    if (splitBatches && isSplittable(kernel)) {
+        gpuCount = gpuShare(stream, kernel, count);
+    }
+    slot.timelineValue = ++stream.submittedValue;
+    slot.pendingOutput = output;
+    slot.onGpu = gpuCount != 0;
+    slot.cpuElementCount = count - gpuCount;
+    slot.batchKernel = kernel;
+    slot.submitTime = std::chrono::steady_clock::now();
+    if (gpuCount < count) {
+        PushConstants cpuPushConstants = pushConstants;
+        cpuPushConstants.elementCount = count - gpuCount;
+        slot.cpuJob = cpuEngine->start(kernel, cpuPushConstants, (const uint8_t*)input + (size_t)gpuCount * inputSize, inputSize,
+                                       (uint8_t*)output + (size_t)gpuCount * outputSize, workgroupSizes[kernel]);
+    }
+    
+    BatchHandle handle;
+    handle.app = this;
+    handle.value = slot.timelineValue;
+    handle.stream = stream.index;
+    if (!slot.onGpu) {
+        // Nothing to submit. The deferred readback goes out now, so the batches still complete in order.
+        if (stream.deferredReadback != NULL) {
+            submitReadback(*stream.deferredReadback);
+        }
+        return handle;
+    }
+    
+    /*
+     The pipeline, the dispatch size and the push constants are baked into the command buffers,
+     so only a new kernel, size or operation needs re-recording.
+     */
+    PushConstants gpuPushConstants = pushConstants;
+    gpuPushConstants.elementCount = gpuCount;
+    if (kernel != slot.kernel || memcmp(&gpuPushConstants, &slot.pushConstants, sizeof(PushConstants)) != 0) {
+        recordCommandBuffer(slot, kernel, gpuPushConstants, (VkDeviceSize)inputSize * gpuCount,
+                            (VkDeviceSize)outputSize * gpuCount);
+    }
+    
+    memcpy(slot.inMappedMemory, input, slot.inSize);
+    runCommandBuffer(slot, waitValue);
+    
+    if (stream.cpuOnly) {
+        // The submission found the device lost, the batch was finished on the CPU instead.
+        return handle;
+    }
+    
+    /*
+     The readback of the previous batch goes to the transfer queue only now, behind this upload.
+     Its semaphore wait would otherwise hold the upload back until the previous dispatch is done.
+     */
+    if (stream.deferredReadback != NULL) {
+        submitReadback(*stream.deferredReadback);
+    }
+    stream.deferredReadback = &slot;
+    return handle;
+}
+
+BaseApp::BatchHandle BaseApp::submitCpu(Stream& stream, Kernel kernel, const PushConstants& pushConstants, const void* input,
+                                        uint32_t inputSize, void* output, const BatchHandle* after) {
+    // As many batches in flight as there would be slots, the oldest one is finished first.
+    if (stream.cpuBatches.size() >= slotCount) {
+        retireCpuBatch(stream, 0);
+    }
+    // Batches run side by side on the workers, a dependency is waited for on the host.
+    if (after != NULL && after->valid()) {
+        waitFor(*after, UINT64_MAX);
+    }
+    
+    CpuBatch batch;
+    batch.job = cpuEngine->start(kernel, pushConstants, input, inputSize, output, workgroupSizes[kernel]);
+    batch.value = ++stream.submittedValue;
+    stream.cpuBatches.push_back(batch);
+    
+    BatchHandle handle;
+    handle.app = this;
+    handle.value = batch.value;
+    handle.stream = stream.index;
+    return handle;
+}
+
+int BaseApp::findCpuBatch(Stream& stream, uint64_t value) {
+    if (value == 0 || value > stream.submittedValue) {
+        throw std::runtime_error("batch handle does not belong to this engine!");
+    }
+    for (size_t i = 0; i < stream.cpuBatches.size(); ++i) {
+        if (stream.cpuBatches[i].value == value) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+void BaseApp::retireCpuBatch(Stream& stream, size_t index) {
+    // Taken out of the queue before the callback, which may submit further batches itself.
+    CpuBatch batch = stream.cpuBatches[index];
+    stream.cpuBatches.erase(stream.cpuBatches.begin() + index);
+    batch.job->wait(UINT64_MAX);
+    // The batch is retired either way, its error goes to the thread retiring it.
+    if (batch.job->error()) {
+        std::rethrow_exception(batch.job->error());
+    }
+    if (timestampsEnabled) {
+        stream.lastBatchTimings = BatchTimings();
+        stream.lastBatchTimings.compute = batch.job->seconds();
+        stream.totalBatchTimings.compute += stream.lastBatchTimings.compute;
+        stream.timedBatchCount += 1;
+    }
+    if (batch.callback) {
+        batch.callback();
+    }
+}
+
+void BaseApp::startCpuEngine(const std::string& reason) {
+    // Every stream that finds the device lost ends up here, the first one starts the engine.
+    std::lock_guard<std::mutex> lock(cpuEngineMutex);
+    if (onCpu) {
+        return;
+    }
+    // With splitBatches the engine is already running.
+    if (cpuEngine == NULL) {
+        cpuEngine = sharedCpuEngine != NULL ? sharedCpuEngine : std::make_shared<CpuEngine>(cpuThreadCount);
+    }
+    onCpu = true;
+    std::cout << "INFO: " << reason << " Running the batches on " << cpuEngine->threadCount()
+              << " CPU threads instead." << std::endl;
+}
+
+bool BaseApp::checkDeviceLost(VkResult result, Stream& stream) {
+    if (result != VK_ERROR_DEVICE_LOST || !cpuFallbackEnabled) {
+        return false;
+    }
+    startCpuEngine("the device was lost!");
+    moveToCpu(stream);
+    return true;
+}
+
+void BaseApp::moveToCpu(Stream& stream) {
+    if (stream.cpuOnly) {
+        return;
+    }
+    stream.cpuOnly = true;
+    stream.deferredReadback = NULL;
+    stream.firstCpuValue = stream.submittedValue + 1;
+    /*
+     The inputs of the batches in flight are still in their staging buffers, and host mappings stay
+     valid after a device loss. Each batch is run again on the CPU into the staging buffer of its
+     results, where retireSlot() finds them as if the readback had finished.
+     */
+    for (BatchSlot& slot : stream.slots) {
+        if (slot.pendingOutput == NULL || !slot.onGpu) {
+            continue;
+        }
+        uint32_t inputSize = (uint32_t)(slot.inSize / slot.pushConstants.elementCount);
+        std::shared_ptr<CpuJob> job = cpuEngine->start(slot.kernel, slot.pushConstants, slot.inMappedMemory, inputSize,
+                                                       slot.outMappedMemory, workgroupSizes[slot.kernel]);
+        job->wait(UINT64_MAX);
+        if (job->error()) {
+            std::rethrow_exception(job->error());
+        }
+    }
+}
+
+uint32_t BaseApp::pollCompletions() {
+    uint32_t retired = 0;
+    for (std::unique_ptr<Stream>& each : streams) {
+        Stream& stream = *each;
+        // A stream another thread is in the middle of is left to it, polling must not block.
+        std::unique_lock<std::recursive_mutex> lock(stream.mutex, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            continue;
+        }
+        /*
+         The newest batch is left alone while its readback is still deferred: it completes once the
+         next batch is submitted, or when its own handle is polled or waited on.
+         */
+        uint32_t slotsInUse = (uint32_t)stream.slots.size();
+        for (uint32_t i = 0; i < slotsInUse; ++i) {
+            BatchSlot& slot = stream.slots[(stream.nextSlot + i) % slotsInUse];
+            if (slot.pendingOutput == NULL || stream.deferredReadback == &slot) {
+                continue;
+            }
+            if (!waitSlot(slot, 0)) {
+                // Batches complete in submission order, the newer ones cannot be done either.
+                break;
+            }
+            retireSlot(slot);
+            retired += 1;
+        }
+        // The CPU batches are retired in the same order, though a later one may well be done first.
+        while (!stream.cpuBatches.empty() && stream.cpuBatches.front().job->done()) {
+            retireCpuBatch(stream, 0);
+            retired += 1;
+        }
+    }
+    return retired;
+}
+
+void BaseApp::flush() {
+    for (std::unique_ptr<Stream>& each : streams) {
+        Stream& stream = *each;
+        std::lock_guard<std::recursive_mutex> lock(stream.mutex);
+        if (stream.deferredReadback != NULL) {
+            submitReadback(*stream.deferredReadback);
+        }
+        // Starting at nextSlot visits the slots from the oldest submission to the newest.
+        uint32_t slotsInUse = (uint32_t)stream.slots.size();
+        for (uint32_t i = 0; i < slotsInUse; ++i) {
+            retireSlot(stream.slots[(stream.nextSlot + i) % slotsInUse]);
+        }
+        // The CPU batches are all newer than those of the slots.
+        while (!stream.cpuBatches.empty()) {
+            retireCpuBatch(stream, 0);
+        }
+    }
+}
 
+BaseApp::BatchSlot* BaseApp::findPendingSlot(Stream& stream, uint64_t value) {
+    if (value == 0 || value > stream.submittedValue) {
+        throw std::runtime_error("batch handle does not belong to this engine!");
+    }
+    // Values are handed out in the same round-robin order as the slots.
+    BatchSlot& slot = stream.slots[(value - 1) % slotCount];
+    if (slot.pendingOutput == NULL || slot.timelineValue != value) {
+        return NULL;
+    }
+    return &slot;
+}
+
+BaseApp::Stream& BaseApp::streamOf(const BatchHandle& handle) {
+    if (handle.app != this || handle.stream >= streams.size()) {
+        throw std::runtime_error("batch handle does not belong to this engine!");
+    }
+    return *streams[handle.stream];
+}
+
+bool BaseApp::isComplete(const BatchHandle& handle) {
+    return waitFor(handle, 0);
+}
+
+bool BaseApp::waitFor(const BatchHandle& handle, uint64_t timeout) {
+    Stream& stream = streamOf(handle);
+    std::lock_guard<std::recursive_mutex> lock(stream.mutex);
+    uint64_t value = handle.value;
+    if (stream.cpuOnly && value >= stream.firstCpuValue) {
+        int index = findCpuBatch(stream, value);
+        if (index < 0) {
+            return true;
+        }
+        if (!stream.cpuBatches[index].job->wait(timeout)) {
+            return false;
+        }
+        retireCpuBatch(stream, index);
+        return true;
+    }
+    BatchSlot* slot = findPendingSlot(stream, value);
+    if (slot == NULL) {
+        return true;
+    }
+    if (stream.deferredReadback == slot) {
+        submitReadback(*slot);
+    }
+    if (!waitSlot(*slot, timeout)) {
+        return false;
+    }
+    retireSlot(*slot);
+    return true;
+}
+
+void BaseApp::setCallback(const BatchHandle& handle, std::function<void()> callback) {
+    Stream& stream = streamOf(handle);
+    std::lock_guard<std::recursive_mutex> lock(stream.mutex);
+    uint64_t value = handle.value;
+    std::function<void()>* pending = NULL;
+    if (stream.cpuOnly && value >= stream.firstCpuValue) {
+        int index = findCpuBatch(stream, value);
+        if (index >= 0) {
+            pending = &stream.cpuBatches[index].callback;
+        }
+    } else {
+        BatchSlot* slot = findPendingSlot(stream, value);
+        if (slot != NULL) {
+            pending = &slot->callback;
+        }
+    }
+    if (pending == NULL) {
+        callback();
+        return;
+    }
+    if (*pending) {
+        std::function<void()> previous = *pending;
+        *pending = [previous, callback]() { previous(); callback(); };
+    } else {
+        *pending = callback;
+    }
+}
+
+bool BaseApp::waitSlot(BatchSlot& slot, uint64_t timeout) {
+    if (slot.onGpu && !waitGpu(slot, timeout)) {
+        return false;
+    }
+    return slot.cpuJob == NULL || slot.cpuJob->wait(timeout);
+}
+
+bool BaseApp::waitGpu(BatchSlot& slot, uint64_t timeout) {
+    Stream& stream = *slot.stream;
+    if (onCpu) {
+        // The device was lost. moveToCpu() puts the results in the staging buffer, if it has not yet.
+        moveToCpu(stream);
+        return true;
+    }
+    VkResult result;
+    if (timelineSemaphoreSupported && timeout == 0) {
+        // Polling only needs the counter, no need to go through a wait.
+        uint64_t counterValue = 0;
+        result = pfnGetSemaphoreCounterValue(device, stream.timelineSemaphore, &counterValue);
+        if (checkDeviceLost(result, stream)) {
+            return true;
+        }
+        VK_CHECK_RESULT(result);
+        return counterValue >= slot.timelineValue;
+    } else if (timelineSemaphoreSupported) {
+        VkSemaphoreWaitInfoKHR waitInfo = {};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &stream.timelineSemaphore;
+        waitInfo.pValues = &slot.timelineValue;
+        result = pfnWaitSemaphores(device, &waitInfo, timeout);
+    } else {
+        result = vkWaitForFences(device, 1, &slot.fence, VK_TRUE, timeout);
+    }
+    if (result == VK_TIMEOUT) {
+        return false;
+    }
+    if (checkDeviceLost(result, stream)) {
+        return true;
+    }
+    VK_CHECK_RESULT(result);
+    return true;
+}
+
+void BaseApp::retireSlot(BatchSlot& slot) {
+    if (slot.pendingOutput == NULL) {
+        return;
+    }
+    if (slot.stream->deferredReadback == &slot) {
+        submitReadback(slot);
+    }
+    /*
+     The readback will not have finished executing until its timeline value (or the fence) is signalled.
+     So we wait here, and only then read the staging buffer. Whether the host had to wait at all
+     tells if the time since submission is that of the GPU or of the host coming back late.
+     */
+    double gpuSeconds = 0;
+    if (slot.onGpu) {
+        bool finishedBefore = !splitBatches || waitGpu(slot, 0);
+        if (!waitGpu(slot, 100000000000)) {
+            throw std::runtime_error("timed out waiting for a batch!");
+        }
+        if (!finishedBefore) {
+            gpuSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - slot.submitTime).count();
+        }
+        memcpy(slot.pendingOutput, slot.outMappedMemory, slot.outSize);
+        readQueries(slot);
+    }
+    std::exception_ptr cpuError;
+    if (slot.cpuJob != NULL) {
+        slot.cpuJob->wait(UINT64_MAX);
+        cpuError = slot.cpuJob->error();
+    }
+    slot.pendingOutput = NULL;
+    if (splitBatches && !cpuError) {
+        measureThroughput(slot, gpuSeconds);
+    }
+    slot.cpuJob.reset();
+    slot.onGpu = true;
+    /*
+     Cleared before the call, the callback may submit further batches itself. Taken off the slot
+     even when the batch failed, it must not run for the next batch the slot takes.
+     */
+    std::function<void()> callback;
+    callback.swap(slot.callback);
+    // The slot is free again, a failed CPU share is reported to the thread retiring the batch.
+    if (cpuError) {
+        std::rethrow_exception(cpuError);
+    }
+    if (callback) {
+        callback();
+    }
 }
+
+bool BaseApp::isSplittable(Kernel kernel) {
+    // Element i of the output only depends on element i of the input, and both are contiguous.
+    return kernel == KERNEL_FIELD || kernel == KERNEL_FIELD_BYTES || kernel == KERNEL_ED25519_VERIFY ||
+           kernel == KERNEL_X25519 || kernel == KERNEL_SCALARMULT_BASE;
+}
+
+uint32_t BaseApp::gpuShare(Stream& stream, Kernel kernel, uint32_t count) {
+    const Throughput& t = stream.throughput[kernel];
+    // Until both sides have been measured the batch is shared evenly.
+    if (t.gpuElementsPerSecond == 0 || t.cpuElementsPerSecond == 0) {
+        return count / 2;
+    }
+    /*
+     Both shares should be done at the same time, gpuLatency + n / g = (count - n) / c. When n comes
+     out below a workgroup, the CPU finishes the whole batch before the GPU would have answered.
+     */
+    double g = t.gpuElementsPerSecond;
+    double c = t.cpuElementsPerSecond;
+    double n = (count / c - t.gpuLatency) / (1 / g + 1 / c);
+    uint32_t groupSize = workgroupSizes[kernel];
+    if (n < groupSize) {
+        return 0;
+    }
+    if (n >= count) {
+        return count;
+    }
+    // Whole workgroups, so the GPU's share pads no invocations.
+    return (uint32_t)n / groupSize * groupSize;
+}
+
+void BaseApp::measureThroughput(BatchSlot& slot, double gpuSeconds) {
+    // Each batch moves the averages a fifth of the way, so they follow the load without jumping around.
+    auto blend = [](double& average, double sample) {
+        average = average == 0 ? sample : average + 0.2 * (sample - average);
+    };
+    Stream& stream = *slot.stream;
+    Throughput& t = stream.throughput[slot.batchKernel];
+    if (slot.cpuJob != NULL && slot.cpuJob->seconds() > 0) {
+        blend(t.cpuElementsPerSecond, slot.cpuElementCount / slot.cpuJob->seconds());
+    }
+    if (!slot.onGpu || stream.cpuOnly) {
+        return;
+    }
+    /*
+     The device time of the GPU's share comes from its timestamps when there are any, readQueries()
+     has just put them in the stream's lastBatchTimings. What the host waited beyond that is latency.
+     */
+    uint32_t gpuCount = slot.pushConstants.elementCount;
+    const BatchTimings& timings = stream.lastBatchTimings;
+    double deviceSeconds = timings.upload + timings.compute + timings.readback;
+    if (slot.queryPool != VK_NULL_HANDLE && deviceSeconds > 0) {
+        blend(t.gpuElementsPerSecond, gpuCount / deviceSeconds);
+        if (gpuSeconds > 0) {
+            blend(t.gpuLatency, std::max(0.0, gpuSeconds - deviceSeconds));
+        }
+    } else if (gpuSeconds > 0) {
+        blend(t.gpuElementsPerSecond, gpuCount / gpuSeconds);
+    }
+}
+
+uint64_t BaseApp::getTimestampMask(uint32_t family) {
+    uint32_t queueFamilyCount;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, NULL);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+    // Timestamps are optional per queue family, timestampValidBits tells.
+    uint32_t validBits = queueFamilies[family].timestampValidBits;
+    return validBits >= 64 ? ~0ULL : (1ULL << validBits) - 1;
+}
+
+double BaseApp::timestampSeconds(const uint64_t* timestamps, TimestampQuery begin, uint64_t mask) {
+    uint64_t ticks = (timestamps[begin + 1] - timestamps[begin]) & mask;
+    return ticks * (double)deviceProperties.limits.timestampPeriod * 1e-9;
+}
+
+void BaseApp::readQueries(BatchSlot& slot) {
+    // A lost device answers no queries, the batch was finished on the CPU anyway.
+    Stream& stream = *slot.stream;
+    if (stream.cpuOnly) {
+        return;
+    }
+    /*
+     The batch has completed, so the queries are available. Queries of a queue family without
+     timestamps were never written and are not asked for, they would never become available.
+     */
+    if (slot.queryPool != VK_NULL_HANDLE) {
+        uint64_t timestamps[QUERY_COUNT] = {};
+        BatchTimings timings;
+        if (uploadTimestampMask != 0) {
+            VK_CHECK_RESULT(vkGetQueryPoolResults(device, slot.queryPool, QUERY_UPLOAD_BEGIN, 2, 2 * sizeof(uint64_t),
+                                                  &timestamps[QUERY_UPLOAD_BEGIN], sizeof(uint64_t),
+                                                  VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+            timings.upload = timestampSeconds(timestamps, QUERY_UPLOAD_BEGIN, uploadTimestampMask);
+        }
+        if (transferTimestampMask != 0) {
+            VK_CHECK_RESULT(vkGetQueryPoolResults(device, slot.queryPool, QUERY_READBACK_BEGIN, 2, 2 * sizeof(uint64_t),
+                                                  &timestamps[QUERY_READBACK_BEGIN], sizeof(uint64_t),
+                                                  VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+            timings.readback = timestampSeconds(timestamps, QUERY_READBACK_BEGIN, transferTimestampMask);
+        }
+        if (computeTimestampMask != 0) {
+            VK_CHECK_RESULT(vkGetQueryPoolResults(device, slot.queryPool, QUERY_COMPUTE_BEGIN, 2, 2 * sizeof(uint64_t),
+                                                  &timestamps[QUERY_COMPUTE_BEGIN], sizeof(uint64_t),
+                                                  VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+            timings.compute = timestampSeconds(timestamps, QUERY_COMPUTE_BEGIN, computeTimestampMask);
+        }
+        
+        stream.lastBatchTimings = timings;
+        stream.totalBatchTimings.upload += timings.upload;
+        stream.totalBatchTimings.compute += timings.compute;
+        stream.totalBatchTimings.readback += timings.readback;
+        stream.timedBatchCount += 1;
+    }
+    
+    if (slot.statisticsQueryPool != VK_NULL_HANDLE) {
+        BatchStatistics statistics;
+        statistics.elements = slot.pushConstants.elementCount;
+        VK_CHECK_RESULT(vkGetQueryPoolResults(device, slot.statisticsQueryPool, 0, 1, sizeof(uint64_t),
+                                              &statistics.invocations, sizeof(uint64_t),
+                                              VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+        stream.lastBatchStatistics = statistics;
+        stream.totalBatchStatistics.elements += statistics.elements;
+        stream.totalBatchStatistics.invocations += statistics.invocations;
+    }
+    
+    if (logTimings && (slot.queryPool != VK_NULL_HANDLE || slot.statisticsQueryPool != VK_NULL_HANDLE)) {
+        std::cout << "INFO: batch " << slot.timelineValue << " of stream " << stream.index << ", " << slot.pushConstants.elementCount
+                  << " elements: upload " << stream.lastBatchTimings.upload * 1e6 << " us, compute " << stream.lastBatchTimings.compute * 1e6
+                  << " us, readback " << stream.lastBatchTimings.readback * 1e6 << " us";
+        if (slot.statisticsQueryPool != VK_NULL_HANDLE) {
+            std::cout << ", " << stream.lastBatchStatistics.invocations << " invocations";
+        }
+        std::cout << std::endl;
+    }
+}
+
+void BaseApp::resetTimings() {
+    for (std::unique_ptr<Stream>& stream : streams) {
+        stream->lastBatchTimings = BatchTimings();
+        stream->totalBatchTimings = BatchTimings();
+        stream->timedBatchCount = 0;
+        stream->lastBatchStatistics = BatchStatistics();
+        stream->totalBatchStatistics = BatchStatistics();
+    }
+}
+
+BaseApp::BatchTimings BaseApp::totalTimings() const {
+    BatchTimings total;
+    for (const std::unique_ptr<Stream>& stream : streams) {
+        total.upload += stream->totalBatchTimings.upload;
+        total.compute += stream->totalBatchTimings.compute;
+        total.readback += stream->totalBatchTimings.readback;
+    }
+    return total;
+}
+
+uint64_t BaseApp::timedBatches() const {
+    uint64_t total = 0;
+    for (const std::unique_ptr<Stream>& stream : streams) {
+        total += stream->timedBatchCount;
+    }
+    return total;
+}
+
+BaseApp::BatchStatistics BaseApp::totalStatistics() const {
+    BatchStatistics total;
+    for (const std::unique_ptr<Stream>& stream : streams) {
+        total.elements += stream->totalBatchStatistics.elements;
+        total.invocations += stream->totalBatchStatistics.invocations;
+    }
+    return total;
+}
+
+uint32_t BaseApp::streamIndex() const {
+    if (streams.empty()) {
+        throw std::runtime_error("the engine has not been initialized!");
+    }
+    /*
+     Every thread keeps the streams the engines gave it. The list is the thread's own, so finding
+     ours takes no lock; only a thread's first call touches the shared counter, and then drops the
+     streams of engines that have been cleaned up or initialized again since.
+     */
+    static thread_local std::vector<std::pair<uint64_t, uint32_t>> assigned;
+    for (const std::pair<uint64_t, uint32_t>& entry : assigned) {
+        if (entry.first == engineSerial) {
+            return entry.second;
+        }
+    }
+    uint32_t index = nextStream++ % (uint32_t)streams.size();
+    {
+        std::lock_guard<std::mutex> lock(liveEnginesMutex);
+        assigned.erase(std::remove_if(assigned.begin(), assigned.end(), [](const std::pair<uint64_t, uint32_t>& entry) {
+            return liveEngines.count(entry.first) == 0;
+        }), assigned.end());
+    }
+    assigned.push_back(std::make_pair(engineSerial, index));
+    return index;
+}
+
+BaseApp::Stream& BaseApp::currentStream() {
+    Stream& stream = *streams[streamIndex()];
+    // A lost device gets no new objects, the stream goes straight to the CPU.
+    if (device != VK_NULL_HANDLE && !onCpu) {
+        std::call_once(stream.created, [this, &stream]() { createStream(stream); });
+    }
+    return stream;
+}
+
+bool BaseApp::BatchHandle::poll() const {
+    return app->isComplete(*this);
+}
+
+bool BaseApp::BatchHandle::wait(uint64_t timeout) const {
+    return app->waitFor(*this, timeout);
+}
+
+void BaseApp::BatchHandle::then(std::function<void()> callback) const {
+    app->setCallback(*this, callback);
+}
+
 std::vector<const char*> BaseApp::getRequiredExtensions() {
     /*
     uint32_t glfwExtensionCount = 0;
@@ -103,7 +1053,17 @@ void BaseApp::createInstance() {
     appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
     appInfo.pEngineName = "No Engine";
     appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-    appInfo.apiVersion = VK_API_VERSION_1_0;
+    /*
+     Vulkan 1.1 is asked for when the loader knows it, vkGetPhysicalDeviceFeatures2 is needed to
+     query timeline semaphore support. A 1.0 loader has no vkEnumerateInstanceVersion at all.
+     */
+    uint32_t apiVersion = VK_API_VERSION_1_0;
+    PFN_vkEnumerateInstanceVersion enumerateInstanceVersion = (PFN_vkEnumerateInstanceVersion) vkGetInstanceProcAddr(VK_NULL_HANDLE, "vkEnumerateInstanceVersion");
+    if (enumerateInstanceVersion != nullptr) {
+        VK_CHECK_RESULT(enumerateInstanceVersion(&apiVersion));
+    }
+    appInfo.apiVersion = apiVersion >= VK_API_VERSION_1_1 ? VK_API_VERSION_1_1 : VK_API_VERSION_1_0;
+    instanceApiVersion = appInfo.apiVersion;
     
     VkInstanceCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -126,11 +1086,28 @@ void BaseApp::createInstance() {
         createInfo.pNext = nullptr;
     }
     
-    if (vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS) {
+    VkResult result = vkCreateInstance(&createInfo, nullptr, &instance);
+    // The loader found no driver at all.
+    if (result == VK_ERROR_INCOMPATIBLE_DRIVER) {
+        throw NoDeviceError("failed to create instance, there is no Vulkan driver!");
+    }
+    if (result != VK_SUCCESS) {
         throw std::runtime_error("failed to create instance!");
     }
 
 }
+void BaseApp::destroyInstance() {
+    if (instance == VK_NULL_HANDLE) {
+        return;
+    }
+    if (enableValidationLayers && debugMessenger != VK_NULL_HANDLE) {
+        DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+    }
+    debugMessenger = VK_NULL_HANDLE;
+    vkDestroyInstance(instance, nullptr);
+    instance = VK_NULL_HANDLE;
+}
+
 void BaseApp::populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo) {
     createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
@@ -154,48 +1131,181 @@ void BaseApp::pickPhysicalDevice() {
     vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
     
     if (deviceCount == 0) {
-        throw std::runtime_error("failed to find GPUs with Vulkan support!");
+        throw NoDeviceError("failed to find GPUs with Vulkan support!");
     }
     
     std::vector<VkPhysicalDevice> devices(deviceCount);
     vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
     
+    if (deviceIndex >= 0) {
+        if ((uint32_t)deviceIndex >= deviceCount || !isDeviceSuitable(devices[deviceIndex])) {
+            throw std::runtime_error("the requested device cannot run compute work!");
+        }
+        physicalDevice = devices[deviceIndex];
+        return;
+    }
+    
+    /*
+     Every suitable device can run the kernels, but one with shaderInt64 runs them at full speed,
+     so it is preferred over the ones that need the 32-bit variant.
+     */
     for (const auto& device : devices) {
-        if (isDeviceSuitable(device)) {
+        if (!isDeviceSuitable(device)) {
+            continue;
+        }
+        VkPhysicalDeviceFeatures features;
+        vkGetPhysicalDeviceFeatures(device, &features);
+        if (physicalDevice == VK_NULL_HANDLE || features.shaderInt64 == VK_TRUE) {
             physicalDevice = device;
+        }
+        if (features.shaderInt64 == VK_TRUE) {
             break;
         }
     }
     
     if (physicalDevice == VK_NULL_HANDLE) {
-        throw std::runtime_error("failed to find a suitable GPU!");
+        throw NoDeviceError("failed to find a suitable GPU!");
     }
 }
 
 void BaseApp::createLogicalDevice() {
 
-    VkDeviceQueueCreateInfo queueCreateInfo = {};
-    queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    
     queueFamilyIndex = getComputeQueueFamilyIndex(); // find queue family with compute capability.
-    queueCreateInfo.queueFamilyIndex = queueFamilyIndex;
+    transferQueueFamilyIndex = getTransferQueueFamilyIndex();
     
-    queueCreateInfo.queueCount = 1;
+    /*
+     Every queue of both families, so each submitting thread can have its own, see Stream.
+     They all get the same priority, no thread's batches are more urgent than another's.
+     */
+    uint32_t queueFamilyCount;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, NULL);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+    queueCount = queueFamilies[queueFamilyIndex].queueCount;
+    transferQueueCount = queueFamilies[transferQueueFamilyIndex].queueCount;
     
-    float queuePriority = 1.0f;
-    queueCreateInfo.pQueuePriorities = &queuePriority;
+    std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+    std::vector<uint32_t> uniqueQueueFamilies = {queueFamilyIndex};
+    if (transferQueueFamilyIndex != queueFamilyIndex) {
+        uniqueQueueFamilies.push_back(transferQueueFamilyIndex);
+    }
+    std::vector<float> queuePriorities(std::max(queueCount, transferQueueCount), 1.0f);
+    for (uint32_t queueFamily : uniqueQueueFamilies) {
+        VkDeviceQueueCreateInfo queueCreateInfo = {};
+        queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queueCreateInfo.queueFamilyIndex = queueFamily;
+        queueCreateInfo.queueCount = queueFamilies[queueFamily].queueCount;
+        queueCreateInfo.pQueuePriorities = queuePriorities.data();
+        queueCreateInfos.push_back(queueCreateInfo);
+    }
     
+    /*
+     The field multiplication in the shader forms 64-bit partial products. shaderInt64 is enabled
+     when the device has it, otherwise createComputePipeline() loads the 32-bit variant.
+     */
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+    shaderInt64Supported = supportedFeatures.shaderInt64 == VK_TRUE;
     VkPhysicalDeviceFeatures deviceFeatures = {};
+    deviceFeatures.shaderInt64 = shaderInt64Supported ? VK_TRUE : VK_FALSE;
+    pipelineStatisticsSupported = pipelineStatisticsEnabled && supportedFeatures.pipelineStatisticsQuery == VK_TRUE;
+    deviceFeatures.pipelineStatisticsQuery = pipelineStatisticsSupported ? VK_TRUE : VK_FALSE;
+    
+    // The limits are kept around, getDispatchSize() needs maxComputeWorkGroupCount.
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    
+    /*
+     Timeline semaphores are optional. Both the extension and the feature have to be there,
+     and the feature query needs Vulkan 1.1 on the instance and on the device.
+     */
+    std::vector<const char*> deviceExtensions;
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures = {};
+    timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+    timelineSemaphoreSupported = false;
+    if (instanceApiVersion >= VK_API_VERSION_1_1 && deviceProperties.apiVersion >= VK_API_VERSION_1_1
+        && isDeviceExtensionSupported(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME)) {
+        VkPhysicalDeviceFeatures2 features2 = {};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &timelineFeatures;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+        if (timelineFeatures.timelineSemaphore == VK_TRUE) {
+            timelineSemaphoreSupported = true;
+            deviceExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+        }
+    }
+    
+    /*
+     VK_EXT_subgroup_size_control lets autotune() try every subgroup size the device can run
+     compute shaders with. Its queries need Vulkan 1.1 as well.
+     */
+    VkPhysicalDeviceSubgroupSizeControlFeaturesEXT subgroupSizeControlFeatures = {};
+    subgroupSizeControlFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_SIZE_CONTROL_FEATURES_EXT;
+    subgroupSizeControlSupported = false;
+    if (instanceApiVersion >= VK_API_VERSION_1_1 && deviceProperties.apiVersion >= VK_API_VERSION_1_1
+        && isDeviceExtensionSupported(VK_EXT_SUBGROUP_SIZE_CONTROL_EXTENSION_NAME)) {
+        VkPhysicalDeviceFeatures2 features2 = {};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &subgroupSizeControlFeatures;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+        
+        subgroupSizeControlProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_SIZE_CONTROL_PROPERTIES_EXT;
+        VkPhysicalDeviceProperties2 properties2 = {};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties2.pNext = &subgroupSizeControlProperties;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+        
+        if (subgroupSizeControlFeatures.subgroupSizeControl == VK_TRUE
+            && (subgroupSizeControlProperties.requiredSubgroupSizeStages & VK_SHADER_STAGE_COMPUTE_BIT) != 0) {
+            subgroupSizeControlSupported = true;
+            deviceExtensions.push_back(VK_EXT_SUBGROUP_SIZE_CONTROL_EXTENSION_NAME);
+        }
+    }
+    
+    /*
+     vkCmdResetQueryPool is only valid on graphics and compute queues, so a transfer-only family
+     has the upload's timestamps reset from the host, which VK_EXT_host_query_reset allows.
+     */
+    VkPhysicalDeviceHostQueryResetFeaturesEXT hostQueryResetFeatures = {};
+    hostQueryResetFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_QUERY_RESET_FEATURES_EXT;
+    hostQueryResetSupported = false;
+    if (timestampsEnabled && transferQueueFamilyIndex != queueFamilyIndex
+        && instanceApiVersion >= VK_API_VERSION_1_1 && deviceProperties.apiVersion >= VK_API_VERSION_1_1
+        && isDeviceExtensionSupported(VK_EXT_HOST_QUERY_RESET_EXTENSION_NAME)) {
+        VkPhysicalDeviceFeatures2 features2 = {};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &hostQueryResetFeatures;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+        if (hostQueryResetFeatures.hostQueryReset == VK_TRUE) {
+            hostQueryResetSupported = true;
+            deviceExtensions.push_back(VK_EXT_HOST_QUERY_RESET_EXTENSION_NAME);
+        }
+    }
     
     VkDeviceCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    // Only the feature structs of what we enable go in the chain.
+    void* featureChain = nullptr;
+    if (hostQueryResetSupported) {
+        hostQueryResetFeatures.pNext = featureChain;
+        featureChain = &hostQueryResetFeatures;
+    }
+    if (subgroupSizeControlSupported) {
+        subgroupSizeControlFeatures.pNext = featureChain;
+        featureChain = &subgroupSizeControlFeatures;
+    }
+    if (timelineSemaphoreSupported) {
+        timelineFeatures.pNext = featureChain;
+        featureChain = &timelineFeatures;
+    }
+    createInfo.pNext = featureChain;
     
-    createInfo.pQueueCreateInfos = &queueCreateInfo;
-    createInfo.queueCreateInfoCount = 1;
+    createInfo.pQueueCreateInfos = queueCreateInfos.data();
+    createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
     
     createInfo.pEnabledFeatures = &deviceFeatures;
     
-    createInfo.enabledExtensionCount = 0;
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
+    createInfo.ppEnabledExtensionNames = deviceExtensions.data();
     
     if (enableValidationLayers) {
         createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
@@ -204,91 +1314,261 @@ void BaseApp::createLogicalDevice() {
         createInfo.enabledLayerCount = 0;
     }
     
-    if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device) != VK_SUCCESS) {
+    /*
+     A device the driver lists but cannot bring up is as good as none. Other results mean
+     we asked for something the device does not have.
+     */
+    VkResult result = vkCreateDevice(physicalDevice, &createInfo, nullptr, &device);
+    if (result == VK_ERROR_INITIALIZATION_FAILED || result == VK_ERROR_DEVICE_LOST) {
+        device = VK_NULL_HANDLE;
+        throw NoDeviceError("failed to create logical device!");
+    }
+    if (result != VK_SUCCESS) {
         throw std::runtime_error("failed to create logical device!");
     }
     
-    vkGetDeviceQueue(device, queueFamilyIndex, 0, &queue);
+    /*
+     The extension entry points are not exported by the loader, so we look them up on the device.
+     Once, here: streams are created later, by whichever thread first submits to them.
+     */
+    if (timelineSemaphoreSupported) {
+        pfnGetSemaphoreCounterValue = (PFN_vkGetSemaphoreCounterValueKHR) vkGetDeviceProcAddr(device, "vkGetSemaphoreCounterValueKHR");
+        pfnWaitSemaphores = (PFN_vkWaitSemaphoresKHR) vkGetDeviceProcAddr(device, "vkWaitSemaphoresKHR");
+        if (pfnGetSemaphoreCounterValue == nullptr || pfnWaitSemaphores == nullptr) {
+            throw std::runtime_error("failed to load VK_KHR_timeline_semaphore functions!");
+        }
+    }
+    if (hostQueryResetSupported) {
+        pfnResetQueryPool = (PFN_vkResetQueryPoolEXT) vkGetDeviceProcAddr(device, "vkResetQueryPoolEXT");
+        if (pfnResetQueryPool == nullptr) {
+            throw std::runtime_error("failed to load VK_EXT_host_query_reset functions!");
+        }
+    }
+    
+    // The queues themselves are fetched by createStream().
+    transferQueueMutexes.clear();
+    for (uint32_t i = 0; i < transferQueueCount; ++i) {
+        transferQueueMutexes.emplace_back(new std::mutex());
+    }
     
-    VkPhysicalDeviceProperties pProperties;
-    vkGetPhysicalDeviceProperties(physicalDevice, &pProperties);
+    const VkPhysicalDeviceLimits& limits = deviceProperties.limits;
     
-    std::cout << "INFO: working with: " << pProperties.deviceName << std::endl;
-    std::cout << "INFO: maxComputeWorkGroupCount is: " << pProperties.limits.maxComputeWorkGroupCount << std::endl;
-    std::cout << "INFO: maxComputeWorkGroupSize is: " << pProperties.limits.maxComputeWorkGroupSize << std::endl;
-    std::cout << "INFO: maxComputeWorkGroupInvocations is: " << pProperties.limits.maxComputeWorkGroupInvocations << std::endl;
+    std::cout << "INFO: working with: " << deviceProperties.deviceName << std::endl;
+    std::cout << "INFO: maxComputeWorkGroupCount is: " << limits.maxComputeWorkGroupCount[0] << " x " << limits.maxComputeWorkGroupCount[1] << " x " << limits.maxComputeWorkGroupCount[2] << std::endl;
+    std::cout << "INFO: maxComputeWorkGroupSize is: " << limits.maxComputeWorkGroupSize[0] << " x " << limits.maxComputeWorkGroupSize[1] << " x " << limits.maxComputeWorkGroupSize[2] << std::endl;
+    std::cout << "INFO: maxComputeWorkGroupInvocations is: " << limits.maxComputeWorkGroupInvocations << std::endl;
+    if (transferQueueFamilyIndex != queueFamilyIndex) {
+        std::cout << "INFO: using dedicated transfer queue family " << transferQueueFamilyIndex
+                  << " with " << transferQueueCount << " queues" << std::endl;
+    } else {
+        std::cout << "INFO: no dedicated transfer queue family, copies run on the compute queue" << std::endl;
+    }
+    std::cout << "INFO: " << queueCount << " compute queues, one for each thread that submits" << std::endl;
+    if (timelineSemaphoreSupported) {
+        std::cout << "INFO: tracking batches with a timeline semaphore" << std::endl;
+    } else {
+        std::cout << "INFO: no timeline semaphore support, tracking batches with fences" << std::endl;
+    }
+    if (subgroupSizeControlSupported) {
+        std::cout << "INFO: subgroup sizes " << subgroupSizeControlProperties.minSubgroupSize << " to "
+                  << subgroupSizeControlProperties.maxSubgroupSize << " can be required" << std::endl;
+    }
+    if (pipelineStatisticsEnabled && !pipelineStatisticsSupported) {
+        std::cout << "INFO: no pipelineStatisticsQuery, invocations are not counted" << std::endl;
+    }
 }
 
+void BaseApp::checkBufferLimits() {
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    VkDeviceSize largest = deviceProperties.limits.maxStorageBufferRange;
+    /*
+     maxMemoryAllocationSize is a Vulkan 1.1 property. Before that only maxStorageBufferRange
+     is known, and the allocation itself reports a buffer that is too large.
+     */
+    if (instanceApiVersion >= VK_API_VERSION_1_1 && deviceProperties.apiVersion >= VK_API_VERSION_1_1) {
+        VkPhysicalDeviceMaintenance3Properties maintenance3Properties = {};
+        maintenance3Properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MAINTENANCE_3_PROPERTIES;
+        VkPhysicalDeviceProperties2 properties2 = {};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties2.pNext = &maintenance3Properties;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+        largest = std::min(largest, maintenance3Properties.maxMemoryAllocationSize);
+    }
+    
+    // inBufferSize is the largest of the buffers, the other two take fewer bytes per element.
+    VkDeviceSize elementBytes = inBufferSize / maxElementCount;
+    elementLimit = (uint32_t)std::min(largest / elementBytes, (VkDeviceSize)UINT32_MAX);
+    if (maxElementCount > elementLimit) {
+        throw std::runtime_error("a batch of " + std::to_string(maxElementCount) + " elements needs "
+                                 + std::to_string(inBufferSize) + " byte buffers, " + deviceProperties.deviceName
+                                 + " binds at most " + std::to_string(largest) + " bytes, "
+                                 + std::to_string(elementLimit) + " elements!");
+    }
+}
 
+void BaseApp::chooseWorkgroupSize() {
+    /*
+     The requested size, within what the device allows for a 1D workgroup. The transpose keeps
+     a duble_fe25519 per invocation in shared memory, the largest of all kernels.
+     */
+    const VkPhysicalDeviceLimits& limits = deviceProperties.limits;
+    maxWorkgroupSize = std::min(limits.maxComputeWorkGroupSize[0], limits.maxComputeWorkGroupInvocations);
+    maxWorkgroupSize = std::min(maxWorkgroupSize, (uint32_t)(limits.maxComputeSharedMemorySize / sizeof(duble_fe25519)));
+    if (workgroupSize > maxWorkgroupSize) {
+        std::cout << "INFO: workgroup size " << workgroupSize << " is above the device limit, using " << maxWorkgroupSize << std::endl;
+        workgroupSize = maxWorkgroupSize;
+    }
+    std::cout << "INFO: workgroup size is: " << workgroupSize << std::endl;
+    
+    // Until loadTuning() knows better.
+    for (uint32_t kernel = 0; kernel < KERNEL_COUNT; ++kernel) {
+        workgroupSizes[kernel] = workgroupSize;
+        subgroupSizes[kernel] = 0;
+    }
+}
 
+bool BaseApp::isDeviceExtensionSupported(const char* extensionName) {
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+    
+    std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, availableExtensions.data());
+    
+    for (const auto& extension : availableExtensions) {
+        if (strcmp(extension.extensionName, extensionName) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
 
-bool BaseApp::isDeviceSuitable(VkPhysicalDevice device) {
-   // Some check should be done to check if device is sutable for the task.
-    // vkGetPhysicalDeviceQueueFamilyProperties
-    return true;
+void BaseApp::createTimelineSemaphore(Stream& stream) {
+    if (!timelineSemaphoreSupported) {
+        return;
+    }
+    
+    VkSemaphoreTypeCreateInfoKHR semaphoreTypeCreateInfo = {};
+    semaphoreTypeCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+    semaphoreTypeCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+    semaphoreTypeCreateInfo.initialValue = 0;
+    
+    VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+    semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreCreateInfo.pNext = &semaphoreTypeCreateInfo;
+    VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, NULL, &stream.timelineSemaphore));
 }
 
 
 
-void BaseApp::createBuffer() {
-    /*
-     We will now create a buffer. We will render the mandelbrot set into this buffer
-     in a computer shade later.
-     */
+
+std::vector<std::string> BaseApp::listDevices() {
+    // A bare instance, without layers or extensions, only to enumerate the devices.
+    VkApplicationInfo appInfo = {};
+    appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    appInfo.apiVersion = VK_API_VERSION_1_0;
+    VkInstanceCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    createInfo.pApplicationInfo = &appInfo;
     
+    VkInstance instance;
+    if (vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create instance!");
+    }
+    uint32_t deviceCount = 0;
+    vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+    std::vector<VkPhysicalDevice> devices(deviceCount);
+    vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+    
+    std::vector<std::string> names;
+    for (VkPhysicalDevice device : devices) {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(device, &properties);
+        names.push_back(properties.deviceName);
+    }
+    vkDestroyInstance(instance, nullptr);
+    return names;
+}
+
+bool BaseApp::isDeviceSuitable(VkPhysicalDevice device) {
+    // All we need is a queue family that can run compute work.
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, NULL);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+    
+    for (const auto& props : queueFamilies) {
+        if (props.queueCount > 0 && (props.queueFlags & VK_QUEUE_COMPUTE_BIT)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+
+void BaseApp::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
     VkBufferCreateInfo bufferCreateInfo = {};
     bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferCreateInfo.size = inBufferSize; // buffer size in bytes.
-    bufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT; // buffer is used as a storage buffer.
-    bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE; // buffer is exclusive to a single queue family at a time.
-    
-    VK_CHECK_RESULT(vkCreateBuffer(device, &bufferCreateInfo, NULL, &inBuffer)); // create buffer.
+    bufferCreateInfo.size = size; // buffer size in bytes.
+    bufferCreateInfo.usage = usage;
+    // buffer is exclusive to a single queue family at a time, ownership is handed over with barriers.
+    bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     
-    bufferCreateInfo.size = outBufferSize; // buffer size in bytes.
-    VK_CHECK_RESULT(vkCreateBuffer(device, &bufferCreateInfo, NULL, &outBuffer)); // create buffer.
+    VK_CHECK_RESULT(vkCreateBuffer(device, &bufferCreateInfo, NULL, &buffer)); // create buffer.
     
     /*
      But the buffer doesn't allocate memory for itself, so we must do that manually.
-     */
-    
-    /*
      First, we find the memory requirements for the buffer.
      */
-    VkMemoryRequirements inMemoryRequirements;
-    vkGetBufferMemoryRequirements(device, inBuffer, &inMemoryRequirements);
+    VkMemoryRequirements memoryRequirements;
+    vkGetBufferMemoryRequirements(device, buffer, &memoryRequirements);
     
-    VkMemoryRequirements outMemoryRequirements;
-    vkGetBufferMemoryRequirements(device, outBuffer, &outMemoryRequirements);
     /*
      Now use obtained memory requirements info to allocate the memory for the buffer.
      */
     VkMemoryAllocateInfo allocateInfo = {};
     allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocateInfo.allocationSize = inMemoryRequirements.size; // specify required memory.
-    /*
-     There are several types of memory that can be allocated, and we must choose a memory type that:
-     1) Satisfies the memory requirements(memoryRequirements.memoryTypeBits).
-     2) Satifies our own usage requirements. We want to be able to read the buffer memory from the GPU to the CPU
-     with vkMapMemory, so we set VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT.
-     Also, by setting VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, memory written by the device(GPU) will be easily
-     visible to the host(CPU), without having to call any extra flushing commands. So mainly for convenience, we set
-     this flag.
-     */
-    allocateInfo.memoryTypeIndex = findMemoryType(
-                                                  outMemoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+    allocateInfo.allocationSize = memoryRequirements.size; // specify required memory.
+    allocateInfo.memoryTypeIndex = findMemoryType(memoryRequirements.memoryTypeBits, properties);
+    if (allocateInfo.memoryTypeIndex == (uint32_t)-1) {
+        throw std::runtime_error("failed to find suitable memory type!");
+    }
     
-    VK_CHECK_RESULT(vkAllocateMemory(device, &allocateInfo, NULL, &inBufferMemory)); // allocate memory on device.
+    VK_CHECK_RESULT(vkAllocateMemory(device, &allocateInfo, NULL, &bufferMemory)); // allocate memory on device.
     
     // Now associate that allocated memory with the buffer. With that, the buffer is backed by actual memory.
-    VK_CHECK_RESULT(vkBindBufferMemory(device, inBuffer, inBufferMemory, 0));
-    
-    allocateInfo.allocationSize = outMemoryRequirements.size; // specify required memory.
+    VK_CHECK_RESULT(vkBindBufferMemory(device, buffer, bufferMemory, 0));
+}
 
-    VK_CHECK_RESULT(vkAllocateMemory(device, &allocateInfo, NULL, &outBufferMemory)); // allocate memory on device.
+void BaseApp::createBuffers(BatchSlot& slot) {
+    /*
+     The storage buffers only need to be reachable by the GPU, so they go into DEVICE_LOCAL memory.
+     On a discrete GPU that is VRAM, and the shader no longer reads every limb across PCIe.
+     */
+    createBuffer(inBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, slot.inBuffer, slot.inBufferMemory);
+    createBuffer(outBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, slot.outBuffer, slot.outBufferMemory);
+    createBuffer(scratchBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, slot.scratchBuffer, slot.scratchBufferMemory);
     
-    // Now associate that allocated memory with the buffer. With that, the buffer is backed by actual memory.
-    VK_CHECK_RESULT(vkBindBufferMemory(device, outBuffer, outBufferMemory, 0));
+    /*
+     The staging buffers must be mappable. By setting VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, memory written
+     by the device(GPU) will be easily visible to the host(CPU), without having to call any extra flushing commands.
+     The readback side prefers HOST_CACHED memory, the host reads it back element by element.
+     */
+    createBuffer(inBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, slot.inStagingBuffer, slot.inStagingBufferMemory);
+    
+    VkMemoryPropertyFlags readbackProperties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    if (findMemoryType(~0u, readbackProperties) == (uint32_t)-1) {
+        readbackProperties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    }
+    createBuffer(outBufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, readbackProperties, slot.outStagingBuffer, slot.outStagingBufferMemory);
     
+    // Map the staging memory once, so that every batch can be written and read on the CPU.
+    VK_CHECK_RESULT(vkMapMemory(device, slot.inStagingBufferMemory, 0, inBufferSize, 0, &slot.inMappedMemory));
+    VK_CHECK_RESULT(vkMapMemory(device, slot.outStagingBufferMemory, 0, outBufferSize, 0, &slot.outMappedMemory));
 }
 
 // find memory type with desired properties.
@@ -335,6 +1615,10 @@ void BaseApp::createDescriptorSetLayout() {
     descriptorSetLayoutBinding[1].descriptorCount = 1;
     descriptorSetLayoutBinding[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
     
+    // The output set also holds the scratch buffer, at binding 1.
+    VkDescriptorSetLayoutBinding outBindings[2] = {descriptorSetLayoutBinding[1], descriptorSetLayoutBinding[1]};
+    outBindings[1].binding = 1;
+    
     
     VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo[SET_LAYOUT_COUNT] = {};
     descriptorSetLayoutCreateInfo[0].sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -342,8 +1626,8 @@ void BaseApp::createDescriptorSetLayout() {
     descriptorSetLayoutCreateInfo[0].pBindings = &descriptorSetLayoutBinding[0];
     
     descriptorSetLayoutCreateInfo[1].sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    descriptorSetLayoutCreateInfo[1].bindingCount = 1;
-    descriptorSetLayoutCreateInfo[1].pBindings = &descriptorSetLayoutBinding[1];
+    descriptorSetLayoutCreateInfo[1].bindingCount = 2;
+    descriptorSetLayoutCreateInfo[1].pBindings = outBindings;
     
     
     // Create the descriptor set layout.
@@ -351,46 +1635,49 @@ void BaseApp::createDescriptorSetLayout() {
 
     VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCreateInfo[0], nullptr, &descriptorSetLayouts[0]));
     VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCreateInfo[1], nullptr, &descriptorSetLayouts[1]));
+    
+    // Set 2 holds the table of base point multiples, a single storage buffer as well.
+    VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCreateInfo[0], nullptr, &tableDescriptorSetLayout));
 
 }
 
 
-void BaseApp::createDescriptorSet() {
+void BaseApp::createDescriptorPool() {
     /*
-     So we will allocate a descriptor set here.
-     But we need to first create a descriptor pool to do that.
-     */
-    
-    /*
-     Our descriptor pool can only allocate a single storage buffer.
+     We will allocate the descriptor sets of every slot, of every stream, from one pool.
+     Each slot needs one set per layout, with three storage buffers between them.
+     The table set is allocated from it as well.
      */
+    uint32_t totalSlots = slotCount * queueCount;
     VkDescriptorPoolSize DescriptorPoolSize = {};
     DescriptorPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    DescriptorPoolSize.descriptorCount = 2;
+    DescriptorPoolSize.descriptorCount = (SET_LAYOUT_COUNT + 1) * totalSlots + 1;
     
     
     //VkDescriptorPoolSize pPoolSizes[2] = {inDescriptorPoolSize, outDescriptorPoolSize};
     
     VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {};
     descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    descriptorPoolCreateInfo.maxSets = 2; // we only need to allocate one descriptor set from the pool.
+    descriptorPoolCreateInfo.maxSets = SET_LAYOUT_COUNT * totalSlots + 1;
     descriptorPoolCreateInfo.poolSizeCount = 1;
     descriptorPoolCreateInfo.pPoolSizes = &DescriptorPoolSize;
     
     // create descriptor pool.
     VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolCreateInfo, NULL, &descriptorPool));
-    
+}
+
+void BaseApp::createDescriptorSet(BatchSlot& slot) {
     /*
      With the pool allocated, we can now allocate the descriptor set.
      */
     VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {};
     descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     descriptorSetAllocateInfo.descriptorPool = descriptorPool; // pool to allocate from.
-    descriptorSetAllocateInfo.descriptorSetCount = 2; // allocate a single descriptor set.
+    descriptorSetAllocateInfo.descriptorSetCount = SET_LAYOUT_COUNT; // one set for the input, one for the output.
     descriptorSetAllocateInfo.pSetLayouts = descriptorSetLayouts;
     
     // allocate descriptor set.
-    VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorSetAllocateInfo, descriptorSets));
+    VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorSetAllocateInfo, slot.descriptorSets));
 
 
     /*
@@ -400,12 +1687,12 @@ void BaseApp::createDescriptorSet() {
     
     // Specify the buffer to bind to the descriptor.
     VkDescriptorBufferInfo descriptorBufferInfo[SET_LAYOUT_COUNT] = {};
-    descriptorBufferInfo[0].buffer = inBuffer;
+    descriptorBufferInfo[0].buffer = slot.inBuffer;
     descriptorBufferInfo[0].offset = 0;
     descriptorBufferInfo[0].range = inBufferSize;
     
     // Specify the buffer to bind to the descriptor.
-    descriptorBufferInfo[1].buffer = outBuffer;
+    descriptorBufferInfo[1].buffer = slot.outBuffer;
     descriptorBufferInfo[1].offset = 0;
     descriptorBufferInfo[1].range = outBufferSize;
     
@@ -413,14 +1700,14 @@ void BaseApp::createDescriptorSet() {
     
     VkWriteDescriptorSet writeDescriptorSet[SET_LAYOUT_COUNT] = {};
     writeDescriptorSet[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    writeDescriptorSet[0].dstSet = descriptorSets[0]; // write to this descriptor set.
+    writeDescriptorSet[0].dstSet = slot.descriptorSets[0]; // write to this descriptor set.
     writeDescriptorSet[0].dstBinding = 0; // write to the first, and only binding.
     writeDescriptorSet[0].descriptorCount = 1; // update a single descriptor.
     writeDescriptorSet[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; // storage buffer.
     writeDescriptorSet[0].pBufferInfo = &descriptorBufferInfo[0];
     
     writeDescriptorSet[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    writeDescriptorSet[1].dstSet = descriptorSets[1]; // write to this descriptor set.
+    writeDescriptorSet[1].dstSet = slot.descriptorSets[1]; // write to this descriptor set.
     writeDescriptorSet[1].dstBinding = 0; // write to the first, and only binding.
     writeDescriptorSet[1].descriptorCount = 1; // update a single descriptor.
     writeDescriptorSet[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; // storage buffer.
@@ -430,100 +1717,419 @@ void BaseApp::createDescriptorSet() {
     vkUpdateDescriptorSets(device, 1, &writeDescriptorSet[0], 0, NULL);
     // perform the update of the descriptor set.
     vkUpdateDescriptorSets(device, 1, &writeDescriptorSet[1], 0, NULL);
-
     
-}
+    VkDescriptorBufferInfo scratchBufferInfo = {};
+    scratchBufferInfo.buffer = slot.scratchBuffer;
+    scratchBufferInfo.offset = 0;
+    scratchBufferInfo.range = scratchBufferSize;
+    VkWriteDescriptorSet scratchWrite = writeDescriptorSet[1];
+    scratchWrite.dstBinding = 1;
+    scratchWrite.pBufferInfo = &scratchBufferInfo;
+    vkUpdateDescriptorSets(device, 1, &scratchWrite, 0, NULL);
 
-// Read file into array of bytes, and cast to uint32_t*, then return.
-// The data has been padded, so that it fits into an array uint32_t.
-uint32_t* BaseApp::readFile(uint32_t& length, const char* filename) {
-    
-    FILE* fp = fopen(filename, "rb");
-    if (fp == NULL) {
-        printf("Could not find or open file: %s\n", filename);
-    }
-    
-    // get file size.
-    fseek(fp, 0, SEEK_END);
-    long filesize = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
     
-    long filesizepadded = long(ceil(filesize / 4.0)) * 4;
-    
-    // read file contents.
-    char *str = new char[filesizepadded];
-    fread(str, filesize, sizeof(char), fp);
-    fclose(fp);
-    
-    // data padding.
-    for (int i = filesize; i < filesizepadded; i++) {
-        str[i] = 0;
-    }
-    
-    length = filesizepadded;
-    return (uint32_t *)str;
 }
 
-
-
 void BaseApp::createComputePipeline() {
     /*
      We create a compute pipeline here.
      */
     
+    if (shaderInt64Supported) {
+        std::cout << "INFO: field multiplication uses native 64-bit integers" << std::endl;
+    } else {
+        std::cout << "INFO: no shaderInt64, field multiplication uses 32-bit imulExtended" << std::endl;
+    }
+    
+    /*
+     The pipeline layout allows the pipeline to access descriptor sets.
+     So we just specify the descriptor set layout we created earlier.
+     */
     /*
-     Create a shader module. A shader module basically just encapsulates some shader code.
+     The element count reaches the shader through a push constant, so the pipeline
+     layout has to declare that range as well.
      */
-    uint32_t filelength;
-    // the code in comp.spv was created by running the command:
-    // glslangValidator.exe -V shader.comp
-    uint32_t* code = readFile(filelength, shaderName);
-    VkShaderModuleCreateInfo createInfo = {};
-    createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    createInfo.pCode = code;
-    createInfo.codeSize = filelength;
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(PushConstants);
+    
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    VkDescriptorSetLayout setLayouts[SET_LAYOUT_COUNT + 1] = {descriptorSetLayouts[0], descriptorSetLayouts[1], tableDescriptorSetLayout};
+    pipelineLayoutCreateInfo.setLayoutCount = SET_LAYOUT_COUNT + 1;
+    pipelineLayoutCreateInfo.pSetLayouts = setLayouts;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+    
+    VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, NULL, &pipelineLayout));
     
-    VK_CHECK_RESULT(vkCreateShaderModule(device, &createInfo, NULL, &computeShaderModule));
-    delete[] code;
+    /*
+     Every kernel gets its own pipeline on the shared layout, so switching kernels between
+     batches only takes a different vkCmdBindPipeline. The code is compiled into the binary,
+     and the modules and pipelines are only created the first time a kernel is dispatched,
+     see getPipeline.
+     */
+    for (uint32_t kernel = 0; kernel < KERNEL_COUNT; ++kernel) {
+        const EmbeddedShader* shader = findEmbeddedShader(shaderNames[kernel][shaderInt64Supported ? 0 : 1]);
+        if (shader == NULL) {
+            throw std::runtime_error("no embedded SPIR-V for a compute kernel, run shaders/embed.sh!");
+        }
+        
+        /*
+         FNV-1a of the code and the kernel, whose specialization tells apart the pipelines
+         that share a module. A tuned entry is only used for the code it was measured with.
+         */
+        uint64_t hash = 14695981039346656037ULL;
+        const uint8_t* bytes = (const uint8_t*)shader->code;
+        for (size_t i = 0; i < shader->size; ++i) {
+            hash = (hash ^ bytes[i]) * 1099511628211ULL;
+        }
+        kernelHashes[kernel] = (hash ^ kernel) * 1099511628211ULL;
+    }
     
+    loadTuning();
+}
+
+VkPipeline BaseApp::getPipeline(Kernel kernel) {
+    // Threads recording the same kernel for the first time create it once between them.
+    if (!pipelineReady[kernel]) {
+        std::lock_guard<std::mutex> lock(pipelineMutex);
+        if (pipelines[kernel] == VK_NULL_HANDLE) {
+            createKernelPipeline(kernel);
+        }
+        pipelineReady[kernel] = true;
+    }
+    return pipelines[kernel];
+}
+
+void BaseApp::createKernelPipeline(Kernel kernel) {
     /*
      Now let us actually create the compute pipeline.
      A compute pipeline is very simple compared to a graphics pipeline.
      It only consists of a single stage with a compute shader.
      So first we specify the compute shader stage, and it's entry point(main).
      */
+    if (computeShaderModules[kernel] == VK_NULL_HANDLE) {
+        /*
+         Create a shader module. A shader module basically just encapsulates some shader code.
+         */
+        const char* variantName = shaderNames[kernel][shaderInt64Supported ? 0 : 1];
+        const EmbeddedShader* shader = findEmbeddedShader(variantName);
+        VkShaderModuleCreateInfo createInfo = {};
+        createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        createInfo.pCode = shader->code;
+        createInfo.codeSize = shader->size;
+        
+        VK_CHECK_RESULT(vkCreateShaderModule(device, &createInfo, NULL, &computeShaderModules[kernel]));
+        std::cout << "INFO: created " << variantName << (kernel == KERNEL_FIELD_SOA ? " (SoA)" : "")
+                  << (kernel == KERNEL_FIELD_BYTES ? " (32-byte encodings)" : "") << std::endl;
+    }
+    
     VkPipelineShaderStageCreateInfo shaderStageCreateInfo = {};
     shaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     shaderStageCreateInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-    shaderStageCreateInfo.module = computeShaderModule;
+    shaderStageCreateInfo.module = computeShaderModules[kernel];
     shaderStageCreateInfo.pName = "main";
     
-    
     /*
-     The pipeline layout allows the pipeline to access descriptor sets.
-     So we just specify the descriptor set layout we created earlier.
+     The buffer layout and the format are specialization constants 0 and 1, so the compiler
+     folds away the index arithmetic and conversions the pipeline does not use.
+     Kernels that do not declare them ignore them. Constant 2 is local_size_x of every kernel.
      */
-    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
-    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutCreateInfo.setLayoutCount = SET_LAYOUT_COUNT;
-    //VkDescriptorSetLayout   pSetLayouts[2] = {inDescriptorSetLayout, outDescriptorSetLayout};
-    pipelineLayoutCreateInfo.pSetLayouts = descriptorSetLayouts;
-    
-    VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, NULL, &pipelineLayout));
+    uint32_t specializationData[3] = {
+        kernel == KERNEL_FIELD_SOA ? (uint32_t)LAYOUT_SOA : (uint32_t)LAYOUT_AOS,
+        kernel == KERNEL_FIELD_BYTES ? (uint32_t)FORMAT_BYTES : (uint32_t)FORMAT_LIMBS,
+        workgroupSizes[kernel]
+    };
+    VkSpecializationMapEntry specializationMapEntries[3] = {};
+    for (uint32_t i = 0; i < 3; ++i) {
+        specializationMapEntries[i].constantID = i;
+        specializationMapEntries[i].offset = i * sizeof(uint32_t);
+        specializationMapEntries[i].size = sizeof(uint32_t);
+    }
+    VkSpecializationInfo specializationInfo = {};
+    specializationInfo.mapEntryCount = 3;
+    specializationInfo.pMapEntries = specializationMapEntries;
+    specializationInfo.dataSize = sizeof(specializationData);
+    specializationInfo.pData = specializationData;
+    shaderStageCreateInfo.pSpecializationInfo = &specializationInfo;
+    
+    // A tuned subgroup size, otherwise the driver picks one.
+    VkPipelineShaderStageRequiredSubgroupSizeCreateInfoEXT requiredSubgroupSize = {};
+    if (subgroupSizes[kernel] != 0) {
+        requiredSubgroupSize.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_REQUIRED_SUBGROUP_SIZE_CREATE_INFO_EXT;
+        requiredSubgroupSize.requiredSubgroupSize = subgroupSizes[kernel];
+        shaderStageCreateInfo.pNext = &requiredSubgroupSize;
+    }
     
     VkComputePipelineCreateInfo pipelineCreateInfo = {};
     pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
     pipelineCreateInfo.stage = shaderStageCreateInfo;
     pipelineCreateInfo.layout = pipelineLayout;
     
-    
     /*
      Now, we finally create the compute pipeline.
      */
     VK_CHECK_RESULT(vkCreateComputePipelines(
-                                             device, VK_NULL_HANDLE,
+                                             device, pipelineCache.handle(),
                                              1, &pipelineCreateInfo,
-                                             NULL, &pipeline));
+                                             NULL, &pipelines[kernel]));
+}
+
+/*
+ tuningFile has one line per device, driver version and kernel, separated by tabs:
+ deviceName, driverVersion, kernel hash in hex, workgroup size, subgroup size (0 for any).
+ */
+void BaseApp::loadTuning() {
+    std::ifstream file(tuningFile);
+    if (!file) {
+        return;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string name, driver, hash, groupSize, subgroupSize;
+        if (!std::getline(fields, name, '\t') || !std::getline(fields, driver, '\t') || !std::getline(fields, hash, '\t')
+            || !std::getline(fields, groupSize, '\t') || !std::getline(fields, subgroupSize, '\t')) {
+            continue;
+        }
+        if (name != deviceProperties.deviceName || driver != std::to_string(deviceProperties.driverVersion)) {
+            continue;
+        }
+        for (uint32_t kernel = 0; kernel < KERNEL_COUNT; ++kernel) {
+            if (strtoull(hash.c_str(), NULL, 16) != kernelHashes[kernel]) {
+                continue;
+            }
+            uint32_t tunedGroupSize = (uint32_t)strtoul(groupSize.c_str(), NULL, 10);
+            uint32_t tunedSubgroupSize = (uint32_t)strtoul(subgroupSize.c_str(), NULL, 10);
+            // The limits are checked again, the file may come from an older run.
+            if (tunedGroupSize == 0 || tunedGroupSize > maxWorkgroupSize) {
+                continue;
+            }
+            if (tunedSubgroupSize != 0 && (!subgroupSizeControlSupported
+                                           || tunedSubgroupSize < subgroupSizeControlProperties.minSubgroupSize
+                                           || tunedSubgroupSize > subgroupSizeControlProperties.maxSubgroupSize)) {
+                continue;
+            }
+            workgroupSizes[kernel] = tunedGroupSize;
+            subgroupSizes[kernel] = tunedSubgroupSize;
+            std::cout << "INFO: " << shaderNames[kernel][shaderInt64Supported ? 0 : 1] << " (kernel " << kernel
+                      << ") uses the tuned workgroup size " << tunedGroupSize << std::endl;
+        }
+    }
+}
+
+void BaseApp::saveTuning() {
+    // The entries of other devices, drivers and shaders are kept.
+    std::vector<std::string> lines;
+    std::ifstream oldFile(tuningFile);
+    std::string line;
+    std::string prefix = std::string(deviceProperties.deviceName) + "\t" + std::to_string(deviceProperties.driverVersion) + "\t";
+    while (std::getline(oldFile, line)) {
+        bool replaced = false;
+        for (uint32_t kernel = 0; kernel < KERNEL_COUNT; ++kernel) {
+            std::ostringstream hash;
+            hash << std::hex << kernelHashes[kernel] << "\t";
+            replaced = replaced || line.compare(0, prefix.size() + hash.str().size(), prefix + hash.str()) == 0;
+        }
+        if (!replaced && !line.empty()) {
+            lines.push_back(line);
+        }
+    }
+    oldFile.close();
+    for (uint32_t kernel = 0; kernel < KERNEL_COUNT; ++kernel) {
+        std::ostringstream entry;
+        entry << prefix << std::hex << kernelHashes[kernel] << std::dec << "\t" << workgroupSizes[kernel] << "\t" << subgroupSizes[kernel];
+        lines.push_back(entry.str());
+    }
+    
+    // Written next to the old file and renamed over it, so a crash never leaves half a file.
+    std::string temporaryFile = tuningFile + ".tmp";
+    std::ofstream file(temporaryFile, std::ios::trunc);
+    for (const std::string& entry : lines) {
+        file << entry << "\n";
+    }
+    file.close();
+    if (!file || std::rename(temporaryFile.c_str(), tuningFile.c_str()) != 0) {
+        std::cout << "ERROR: could not write " << tuningFile << std::endl;
+        return;
+    }
+    std::cout << "INFO: saved the tuned workgroup sizes to " << tuningFile << std::endl;
+}
+
+double BaseApp::timeKernel(Stream& stream, Kernel kernel, VkQueryPool queryPool, uint64_t timestampMask) {
+    // A full batch of the operation each kernel spends most of its time on.
+    PushConstants pushConstants = {};
+    pushConstants.elementCount = maxElementCount;
+    if (kernel == KERNEL_FIELD || kernel == KERNEL_FIELD_SOA || kernel == KERNEL_FIELD_BYTES) {
+        pushConstants.op = FE_MUL;
+    } else if (kernel == KERNEL_TRANSPOSE) {
+        pushConstants.op = LAYOUT_SOA;
+        pushConstants.selector = DUBLE_FE25519_WIDTH;
+    }
+    
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands(stream);
+    if (queryPool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(commandBuffer, queryPool, 0, 2);
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+    }
+    recordDispatch(commandBuffer, stream.slots[0], kernel, pushConstants);
+    if (queryPool != VK_NULL_HANDLE) {
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    endSingleTimeCommands(stream, commandBuffer);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    
+    /*
+     Without timestamps on the compute queue the host clock has to do, submission and
+     the wait included.
+     */
+    if (queryPool == VK_NULL_HANDLE) {
+        return elapsed.count();
+    }
+    uint64_t timestamps[2];
+    VK_CHECK_RESULT(vkGetQueryPoolResults(device, queryPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+                                          VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+    uint64_t ticks = (timestamps[1] - timestamps[0]) & timestampMask;
+    return ticks * (double)deviceProperties.limits.timestampPeriod * 1e-9;
+}
+
+void BaseApp::autotune() {
+    /*
+     The pipelines are destroyed and created again below, under every recorded command buffer.
+     So every stream stays locked until they are all in place, in the order flush() locks them,
+     and nothing may still be in flight: callbacks run by flush() can submit further batches.
+     */
+    std::vector<std::unique_lock<std::recursive_mutex>> locks;
+    for (std::unique_ptr<Stream>& each : streams) {
+        locks.emplace_back(each->mutex);
+    }
+    auto inFlight = [this]() {
+        for (std::unique_ptr<Stream>& each : streams) {
+            if (!each->cpuBatches.empty()) {
+                return true;
+            }
+            for (BatchSlot& slot : each->slots) {
+                if (slot.pendingOutput != NULL) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    };
+    do {
+        flush();
+    } while (inFlight());
+    if (onCpu) {
+        std::cout << "INFO: the batches run on the CPU, there are no workgroups to tune." << std::endl;
+        return;
+    }
+    // The calling thread's stream is the test bed.
+    Stream& stream = currentStream();
+    
+    /*
+     Powers of two up to what every kernel can be created with. Subgroup sizes are only tried
+     with VK_EXT_subgroup_size_control; 0 lets the driver choose, as without tuning.
+     */
+    std::vector<uint32_t> groupSizes;
+    for (uint32_t size = MIN_TUNED_WORKGROUP_SIZE; size <= maxWorkgroupSize; size *= 2) {
+        groupSizes.push_back(size);
+    }
+    std::vector<uint32_t> subgroupSizeCandidates = {0};
+    if (subgroupSizeControlSupported) {
+        for (uint32_t size = subgroupSizeControlProperties.minSubgroupSize; size <= subgroupSizeControlProperties.maxSubgroupSize; size *= 2) {
+            subgroupSizeCandidates.push_back(size);
+        }
+    }
+    
+    uint64_t timestampMask = getTimestampMask(queueFamilyIndex);
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    if (timestampMask != 0) {
+        VkQueryPoolCreateInfo queryPoolCreateInfo = {};
+        queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryPoolCreateInfo.queryCount = 2;
+        VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolCreateInfo, NULL, &queryPool));
+    } else {
+        std::cout << "INFO: no timestamps on the compute queue, timing on the host" << std::endl;
+    }
+    
+    /*
+     Slot 0 of the stream is the test bed. Its input gets the same pseudo-random elements as setupInputBuffer,
+     which the field, curve and layout kernels do the full amount of work on whatever the words are.
+     Signature verification returns early on most random inputs, as they are not canonical scalars or
+     points, so it is timed on valid signatures instead.
+     */
+    BatchSlot& slot = stream.slots[0];
+    bool signaturesLoaded = false;
+    for (uint32_t kernel = 0; kernel < KERNEL_COUNT; ++kernel) {
+        bool signatures = kernel == KERNEL_ED25519_VERIFY;
+        if (kernel == 0 || signatures != signaturesLoaded) {
+            if (signatures) {
+                setupSignatureBuffer((ed25519_verify_input*)slot.inMappedMemory, maxElementCount);
+            } else {
+                setupInputBuffer((duble_fe25519*)slot.inMappedMemory, maxElementCount);
+            }
+            signaturesLoaded = signatures;
+            VkCommandBuffer commandBuffer = beginSingleTimeCommands(stream);
+            VkBufferCopy copyRegion = {};
+            copyRegion.size = inBufferSize;
+            vkCmdCopyBuffer(commandBuffer, slot.inStagingBuffer, slot.inBuffer, 1, &copyRegion);
+            recordOwnershipTransfer(commandBuffer, slot.inBuffer, copyRegion.size,
+                                    VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                                    VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                    queueFamilyIndex, queueFamilyIndex);
+            endSingleTimeCommands(stream, commandBuffer);
+        }
+        
+        double bestTime = 0;
+        uint32_t bestGroupSize = workgroupSizes[kernel];
+        uint32_t bestSubgroupSize = subgroupSizes[kernel];
+        for (uint32_t groupSize : groupSizes) {
+            for (uint32_t subgroupSize : subgroupSizeCandidates) {
+                if (subgroupSize != 0 && groupSize > subgroupSizeControlProperties.maxComputeWorkgroupSubgroups * subgroupSize) {
+                    continue;
+                }
+                workgroupSizes[kernel] = groupSize;
+                subgroupSizes[kernel] = subgroupSize;
+                vkDestroyPipeline(device, pipelines[kernel], NULL);
+                createKernelPipeline((Kernel)kernel);
+                
+                // One run to warm up, then the best of three.
+                timeKernel(stream, (Kernel)kernel, queryPool, timestampMask);
+                double time = timeKernel(stream, (Kernel)kernel, queryPool, timestampMask);
+                for (int run = 1; run < 3; ++run) {
+                    time = std::min(time, timeKernel(stream, (Kernel)kernel, queryPool, timestampMask));
+                }
+                if (bestTime == 0 || time < bestTime) {
+                    bestTime = time;
+                    bestGroupSize = groupSize;
+                    bestSubgroupSize = subgroupSize;
+                }
+            }
+        }
+        
+        workgroupSizes[kernel] = bestGroupSize;
+        subgroupSizes[kernel] = bestSubgroupSize;
+        vkDestroyPipeline(device, pipelines[kernel], NULL);
+        createKernelPipeline((Kernel)kernel);
+        std::cout << "INFO: " << shaderNames[kernel][shaderInt64Supported ? 0 : 1] << " (kernel " << kernel
+                  << "): workgroup size " << bestGroupSize << ", subgroup size " << bestSubgroupSize
+                  << ", " << bestTime * 1e9 / maxElementCount << " ns per element" << std::endl;
+    }
+    
+    if (queryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, queryPool, NULL);
+    }
+    // The recorded command buffers of every stream refer to the old pipelines.
+    for (std::unique_ptr<Stream>& each : streams) {
+        for (BatchSlot& other : each->slots) {
+            other.kernel = KERNEL_COUNT;
+        }
+    }
+    saveTuning();
 }
 
 // Returns the index of a queue family that supports compute operations.
@@ -553,7 +2159,29 @@ uint32_t BaseApp::getComputeQueueFamilyIndex() {
     
     return i;
 }
-void BaseApp::createCommandBuffer() {
+
+// Returns a queue family that supports transfers but neither graphics nor compute.
+// Such families map to the copy engines. Falls back to the compute family.
+uint32_t BaseApp::getTransferQueueFamilyIndex() {
+    uint32_t queueFamilyCount;
+    
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, NULL);
+    
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+    
+    for (uint32_t i = 0; i < queueFamilies.size(); ++i) {
+        VkQueueFamilyProperties props = queueFamilies[i];
+        
+        if (props.queueCount > 0 && (props.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+            !(props.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+            return i;
+        }
+    }
+    
+    return queueFamilyIndex;
+}
+void BaseApp::createCommandPools(Stream& stream) {
     /*
      We are getting closer to the end. In order to send commands to the device(GPU),
      we must first record commands into a command buffer.
@@ -561,178 +2189,636 @@ void BaseApp::createCommandBuffer() {
      */
     VkCommandPoolCreateInfo commandPoolCreateInfo = {};
     commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    commandPoolCreateInfo.flags = 0;
+    // the command buffers are re-recorded in place when the batch size changes.
+    commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
     // the queue family of this command pool. All command buffers allocated from this command pool,
     // must be submitted to queues of this family ONLY.
     commandPoolCreateInfo.queueFamilyIndex = queueFamilyIndex;
-    VK_CHECK_RESULT(vkCreateCommandPool(device, &commandPoolCreateInfo, NULL, &commandPool));
+    VK_CHECK_RESULT(vkCreateCommandPool(device, &commandPoolCreateInfo, NULL, &stream.commandPool));
+    
+    /*
+     The copies are submitted to the transfer queue, so their command buffers come from a pool of that family.
+     A pool may only be used by one thread at a time, so every stream has its own two.
+     */
+    commandPoolCreateInfo.queueFamilyIndex = transferQueueFamilyIndex;
+    VK_CHECK_RESULT(vkCreateCommandPool(device, &commandPoolCreateInfo, NULL, &stream.transferCommandPool));
+}
+
+void BaseApp::createBaseTable() {
+    /*
+     The table is 256 ge25519_precomp, 30 KB. It goes through a temporary staging buffer into
+     DEVICE_LOCAL memory, with a one-off copy on the compute queue of the first stream. Every compute
+     queue reads it, they are all of the same family.
+     */
+    Stream& stream = *streams[0];
+    VkDeviceSize size = sizeof(ge25519_precomp) * 32 * 8;
+    createBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, tableBuffer, tableBufferMemory);
+    
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingBufferMemory;
+    createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+    void* mappedMemory = NULL;
+    VK_CHECK_RESULT(vkMapMemory(device, stagingBufferMemory, 0, size, 0, &mappedMemory));
+    memcpy(mappedMemory, ge25519_ref_base(), size);
+    vkUnmapMemory(device, stagingBufferMemory);
+    
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands(stream);
+    VkBufferCopy copyRegion = {};
+    copyRegion.size = size;
+    vkCmdCopyBuffer(commandBuffer, stagingBuffer, tableBuffer, 1, &copyRegion);
+    recordOwnershipTransfer(commandBuffer, tableBuffer, size,
+                            VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                            queueFamilyIndex, queueFamilyIndex);
+    endSingleTimeCommands(stream, commandBuffer);
+    
+    vkFreeMemory(device, stagingBufferMemory, NULL);
+    vkDestroyBuffer(device, stagingBuffer, NULL);
+    
+    /*
+     One descriptor set for the table, bound next to the sets of whichever slot is dispatched.
+     */
+    VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {};
+    descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptorSetAllocateInfo.descriptorPool = descriptorPool;
+    descriptorSetAllocateInfo.descriptorSetCount = 1;
+    descriptorSetAllocateInfo.pSetLayouts = &tableDescriptorSetLayout;
+    VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorSetAllocateInfo, &tableDescriptorSet));
+    
+    VkDescriptorBufferInfo descriptorBufferInfo = {};
+    descriptorBufferInfo.buffer = tableBuffer;
+    descriptorBufferInfo.offset = 0;
+    descriptorBufferInfo.range = size;
+    
+    VkWriteDescriptorSet writeDescriptorSet = {};
+    writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writeDescriptorSet.dstSet = tableDescriptorSet;
+    writeDescriptorSet.dstBinding = 0;
+    writeDescriptorSet.descriptorCount = 1;
+    writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeDescriptorSet.pBufferInfo = &descriptorBufferInfo;
+    vkUpdateDescriptorSets(device, 1, &writeDescriptorSet, 0, NULL);
+}
+
+/*
+ A command buffer for one-off work on the compute queue. endSingleTimeCommands() submits it,
+ waits for it and frees it.
+ */
+VkCommandBuffer BaseApp::beginSingleTimeCommands(Stream& stream) {
+    VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
+    commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    commandBufferAllocateInfo.commandPool = stream.commandPool;
+    commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    commandBufferAllocateInfo.commandBufferCount = 1;
+    VkCommandBuffer commandBuffer;
+    VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, &commandBuffer));
+    
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+    return commandBuffer;
+}
+
+void BaseApp::endSingleTimeCommands(Stream& stream, VkCommandBuffer commandBuffer) {
+    VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+    
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    VK_CHECK_RESULT(vkQueueSubmit(stream.queue, 1, &submitInfo, VK_NULL_HANDLE));
+    VK_CHECK_RESULT(vkQueueWaitIdle(stream.queue));
     
+    vkFreeCommandBuffers(device, stream.commandPool, 1, &commandBuffer);
+}
+
+void BaseApp::createStream(Stream& stream) {
+    // Streams of different threads may be created at once, their descriptor sets share a pool.
+    std::lock_guard<std::mutex> lock(streamMutex);
+    vkGetDeviceQueue(device, queueFamilyIndex, stream.index, &stream.queue);
+    stream.transferQueueIndex = stream.index % transferQueueCount;
+    vkGetDeviceQueue(device, transferQueueFamilyIndex, stream.transferQueueIndex, &stream.transferQueue);
+    createCommandPools(stream);
+    createTimelineSemaphore(stream);
+    
+    stream.slots.resize(slotCount);
+    for (BatchSlot& slot : stream.slots) {
+        slot.stream = &stream;
+        createBuffers(slot);
+        createDescriptorSet(slot);
+        createCommandBuffer(slot);
+    }
+    stream.nextSlot = 0;
+    stream.deferredReadback = NULL;
+    stream.submittedValue = 0;
+    if (stream.index > 0) {
+        std::cout << "INFO: a thread got compute queue " << stream.index << std::endl;
+    }
+}
+
+void BaseApp::createCommandBuffer(BatchSlot& slot) {
     /*
-     Now allocate a command buffer from the command pool.
+     Now allocate the command buffers of the slot from the command pools.
      */
     VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
     commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    commandBufferAllocateInfo.commandPool = commandPool; // specify the command pool to allocate from.
+    commandBufferAllocateInfo.commandPool = slot.stream->commandPool; // specify the command pool to allocate from.
     // if the command buffer is primary, it can be directly submitted to queues.
     // A secondary buffer has to be called from some primary command buffer, and cannot be directly
     // submitted to a queue. To keep things simple, we use a primary command buffer.
     commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
     commandBufferAllocateInfo.commandBufferCount = 1; // allocate a single command buffer.
-    VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, &commandBuffer)); // allocate command buffer.
+    VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, &slot.commandBuffer)); // allocate command buffer.
+    
+    commandBufferAllocateInfo.commandPool = slot.stream->transferCommandPool;
+    VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, &slot.uploadCommandBuffer));
+    VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, &slot.readbackCommandBuffer));
+    
+    /*
+     We create the fence and the semaphores once as well. The fence is reset before every submit instead of being recreated.
+     */
+    VkFenceCreateInfo fenceCreateInfo = {};
+    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceCreateInfo.flags = 0;
+    VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, NULL, &slot.fence));
+    
+    VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+    semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, NULL, &slot.uploadSemaphore));
+    VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, NULL, &slot.computeSemaphore));
+    
+    if (computeTimestampMask != 0 || transferTimestampMask != 0) {
+        VkQueryPoolCreateInfo queryPoolCreateInfo = {};
+        queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryPoolCreateInfo.queryCount = QUERY_COUNT;
+        VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolCreateInfo, NULL, &slot.queryPool));
+    }
+    if (pipelineStatisticsSupported) {
+        VkQueryPoolCreateInfo queryPoolCreateInfo = {};
+        queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolCreateInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+        queryPoolCreateInfo.queryCount = 1;
+        queryPoolCreateInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+        VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolCreateInfo, NULL, &slot.statisticsQueryPool));
+    }
+}
+
+/*
+ Records a buffer memory barrier. When the two queue family indices differ this is one half of a
+ queue family ownership transfer: the release is recorded on the source queue, the matching acquire
+ on the destination queue, and a semaphore orders the two submissions.
+ */
+void BaseApp::recordOwnershipTransfer(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize size,
+                                      VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask,
+                                      VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask,
+                                      uint32_t srcQueueFamilyIndex, uint32_t dstQueueFamilyIndex) {
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccessMask;
+    barrier.dstAccessMask = dstAccessMask;
+    if (srcQueueFamilyIndex == dstQueueFamilyIndex) {
+        // no ownership transfer, a plain memory barrier.
+        srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    }
+    barrier.srcQueueFamilyIndex = srcQueueFamilyIndex;
+    barrier.dstQueueFamilyIndex = dstQueueFamilyIndex;
+    barrier.buffer = buffer;
+    barrier.offset = 0;
+    barrier.size = size;
+    
+    vkCmdPipelineBarrier(commandBuffer, srcStageMask, dstStageMask, 0, 0, NULL, 1, &barrier, 0, NULL);
+}
+
+void BaseApp::recordTransferCommandBuffers(BatchSlot& slot, VkDeviceSize inSize, VkDeviceSize outSize) {
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = 0;
+    
+    /*
+     Upload: staging -> inBuffer, then release inBuffer to the compute queue family.
+     */
+    VK_CHECK_RESULT(vkBeginCommandBuffer(slot.uploadCommandBuffer, &beginInfo));
+    /*
+     The queries are reset before they are written, so the recordings can be submitted again as they
+     are. vkCmdResetQueryPool needs a graphics or compute queue: the upload resets its own on a shared
+     family and is reset from the host by runCommandBuffer() on a transfer-only one. The readback's
+     are reset by the dispatch's command buffer, which runs before it.
+     */
+    if (uploadTimestampMask != 0) {
+        if (transferQueueFamilyIndex == queueFamilyIndex) {
+            vkCmdResetQueryPool(slot.uploadCommandBuffer, slot.queryPool, QUERY_UPLOAD_BEGIN, 2);
+        }
+        vkCmdWriteTimestamp(slot.uploadCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, slot.queryPool, QUERY_UPLOAD_BEGIN);
+    }
+    VkBufferCopy copyRegion = {};
+    copyRegion.size = inSize;
+    vkCmdCopyBuffer(slot.uploadCommandBuffer, slot.inStagingBuffer, slot.inBuffer, 1, &copyRegion);
+    if (uploadTimestampMask != 0) {
+        vkCmdWriteTimestamp(slot.uploadCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, slot.queryPool, QUERY_UPLOAD_END);
+    }
+    recordOwnershipTransfer(slot.uploadCommandBuffer, slot.inBuffer, inSize,
+                            VK_ACCESS_TRANSFER_WRITE_BIT, transferQueueFamilyIndex == queueFamilyIndex ? VK_ACCESS_SHADER_READ_BIT : 0,
+                            VK_PIPELINE_STAGE_TRANSFER_BIT, transferQueueFamilyIndex == queueFamilyIndex ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                            transferQueueFamilyIndex, queueFamilyIndex);
+    VK_CHECK_RESULT(vkEndCommandBuffer(slot.uploadCommandBuffer));
     
     /*
-     Now we shall start recording commands into the newly allocated command buffer.
+     Readback: acquire outBuffer from the compute queue family, copy it to staging
+     and make the copy visible to the host.
+     */
+    VK_CHECK_RESULT(vkBeginCommandBuffer(slot.readbackCommandBuffer, &beginInfo));
+    if (transferQueueFamilyIndex != queueFamilyIndex) {
+        recordOwnershipTransfer(slot.readbackCommandBuffer, slot.outBuffer, outSize,
+                                0, VK_ACCESS_TRANSFER_READ_BIT,
+                                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                queueFamilyIndex, transferQueueFamilyIndex);
+    }
+    copyRegion.size = outSize;
+    if (transferTimestampMask != 0) {
+        vkCmdWriteTimestamp(slot.readbackCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, slot.queryPool, QUERY_READBACK_BEGIN);
+    }
+    vkCmdCopyBuffer(slot.readbackCommandBuffer, slot.outBuffer, slot.outStagingBuffer, 1, &copyRegion);
+    if (transferTimestampMask != 0) {
+        vkCmdWriteTimestamp(slot.readbackCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, slot.queryPool, QUERY_READBACK_END);
+    }
+    recordOwnershipTransfer(slot.readbackCommandBuffer, slot.outStagingBuffer, outSize,
+                            VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT,
+                            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                            transferQueueFamilyIndex, transferQueueFamilyIndex);
+    VK_CHECK_RESULT(vkEndCommandBuffer(slot.readbackCommandBuffer));
+}
+
+void BaseApp::recordCommandBuffer(BatchSlot& slot, Kernel kernel, const PushConstants& pushConstants,
+                                  VkDeviceSize inSize, VkDeviceSize outSize) {
+    /*
+     Now we shall start recording commands into the command buffer.
+     There is no VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT: the same recording is submitted
+     for every batch of this size. vkBeginCommandBuffer implicitly resets the previous recording.
      */
     VkCommandBufferBeginInfo beginInfo = {};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT; // the buffer is only submitted and used once in this application.
-    VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo)); // start recording commands.
+    beginInfo.flags = 0;
+    VK_CHECK_RESULT(vkBeginCommandBuffer(slot.commandBuffer, &beginInfo)); // start recording commands.
+    
+    /*
+     Acquire inBuffer from the transfer queue family. On a shared family the upload already
+     recorded a full barrier, and the semaphore between the submissions orders the rest.
+     */
+    if (transferQueueFamilyIndex != queueFamilyIndex) {
+        recordOwnershipTransfer(slot.commandBuffer, slot.inBuffer, inSize,
+                                0, VK_ACCESS_SHADER_READ_BIT,
+                                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                transferQueueFamilyIndex, queueFamilyIndex);
+    }
+    
+    // The readback's queries as well, the transfer queue may not be able to reset them.
+    if (transferTimestampMask != 0) {
+        vkCmdResetQueryPool(slot.commandBuffer, slot.queryPool, QUERY_READBACK_BEGIN, 2);
+    }
+    if (computeTimestampMask != 0) {
+        vkCmdResetQueryPool(slot.commandBuffer, slot.queryPool, QUERY_COMPUTE_BEGIN, 2);
+        vkCmdWriteTimestamp(slot.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, slot.queryPool, QUERY_COMPUTE_BEGIN);
+    }
+    if (slot.statisticsQueryPool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(slot.commandBuffer, slot.statisticsQueryPool, 0, 1);
+        vkCmdBeginQuery(slot.commandBuffer, slot.statisticsQueryPool, 0, 0);
+    }
+    recordDispatch(slot.commandBuffer, slot, kernel, pushConstants);
+    if (slot.statisticsQueryPool != VK_NULL_HANDLE) {
+        vkCmdEndQuery(slot.commandBuffer, slot.statisticsQueryPool, 0);
+    }
+    if (computeTimestampMask != 0) {
+        vkCmdWriteTimestamp(slot.commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, slot.queryPool, QUERY_COMPUTE_END);
+    }
+    
+    /*
+     Release outBuffer to the transfer queue family for the readback.
+     */
+    bool sharedFamily = transferQueueFamilyIndex == queueFamilyIndex;
+    recordOwnershipTransfer(slot.commandBuffer, slot.outBuffer, outSize,
+                            VK_ACCESS_SHADER_WRITE_BIT, sharedFamily ? VK_ACCESS_TRANSFER_READ_BIT : 0,
+                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, sharedFamily ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                            queueFamilyIndex, transferQueueFamilyIndex);
+    
+    VK_CHECK_RESULT(vkEndCommandBuffer(slot.commandBuffer)); // end recording commands.
+    
+    // The copies only depend on the sizes.
+    if (inSize != slot.inSize || outSize != slot.outSize) {
+        recordTransferCommandBuffers(slot, inSize, outSize);
+    }
+    slot.kernel = kernel;
+    slot.pushConstants = pushConstants;
+    slot.inSize = inSize;
+    slot.outSize = outSize;
+}
+
+void BaseApp::recordDispatch(VkCommandBuffer commandBuffer, BatchSlot& slot, Kernel kernel, const PushConstants& pushConstants) {
+    uint32_t count = pushConstants.elementCount;
     
     /*
      We need to bind a pipeline, AND a descriptor set before we dispatch.
      The validation layer will NOT give warnings if you forget these, so be very careful not to forget them.
      */
-   
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, SET_LAYOUT_COUNT, descriptorSets, 0, NULL);
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, getPipeline(kernel));
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, SET_LAYOUT_COUNT, slot.descriptorSets, 0, NULL);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, SET_LAYOUT_COUNT, 1, &tableDescriptorSet, 0, NULL);
     
     /*
      Calling vkCmdDispatch basically starts the compute pipeline, and executes the compute shader.
      The number of workgroups is specified in the arguments.
      If you are already familiar with compute shaders from OpenGL, this should be nothing new to you.
+     
+     The batch inversion takes three dispatches over the same buffers, with the pass in op:
+     both scans cover the whole batch, the pass in between is a single workgroup.
+     Each pass reads what the one before wrote, hence the barriers.
      */
-    //vkCmdDispatch(commandBuffer, (uint32_t)ceil(WIDTH / float(WORKGROUP_SIZE)), (uint32_t)ceil(HEIGHT / float(WORKGROUP_SIZE)), 1);
-    vkCmdDispatch(commandBuffer, (uint32_t)ceil(WORK_TOTAL_SIZE / float(WORKGROUP_SIZE)), 1, 1);
-    
-    
-    VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer)); // end recording commands.
+    uint32_t passCount = kernel == KERNEL_BATCH_INVERT ? 3 : 1;
+    for (uint32_t pass = 0; pass < passCount; ++pass) {
+        PushConstants passConstants = pushConstants;
+        uint32_t groupCountX = 1, groupCountY = 1;
+        if (passCount > 1) {
+            passConstants.op = pass;
+        }
+        if (passCount == 1 || pass != 1) {
+            getDispatchSize(count, workgroupSizes[kernel], groupCountX, groupCountY);
+        }
+        if (pass > 0) {
+            VkMemoryBarrier barrier = {};
+            barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 0, 1, &barrier, 0, NULL, 0, NULL);
+        }
+        vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &passConstants);
+        vkCmdDispatch(commandBuffer, groupCountX, groupCountY, 1);
+    }
 }
 
-void BaseApp::runCommandBuffer() {
+/*
+ One invocation handles one element. Large batches need more workgroups than
+ maxComputeWorkGroupCount[0] allows, so the grid is folded into 2D and the shader
+ flattens gl_GlobalInvocationID back into an element index.
+ The rows are balanced so that at most one row of workgroups is partially used.
+ */
+void BaseApp::getDispatchSize(uint32_t count, uint32_t groupSize, uint32_t& groupCountX, uint32_t& groupCountY) {
+    const uint32_t maxGroupCountX = deviceProperties.limits.maxComputeWorkGroupCount[0];
+    const uint32_t maxGroupCountY = deviceProperties.limits.maxComputeWorkGroupCount[1];
+    
+    uint32_t groupCount = (count + groupSize - 1) / groupSize;
+    
+    groupCountY = (groupCount + maxGroupCountX - 1) / maxGroupCountX;
+    if (groupCountY > maxGroupCountY) {
+        throw std::runtime_error("batch is too large for a single dispatch!");
+    }
+    groupCountX = (groupCount + groupCountY - 1) / groupCountY;
+}
+
+void BaseApp::runCommandBuffer(BatchSlot& slot, uint64_t waitValue) {
     /*
-     Now we shall finally submit the recorded command buffer to a queue.
+     Now we shall finally submit the recorded command buffers.
+     The three submissions are chained with semaphores: upload on the transfer queue,
+     the dispatch on the compute queue, and the readback on the transfer queue again.
      */
+    const VkPipelineStageFlags computeWaitStages[] = { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT };
+    Stream& stream = *slot.stream;
+    const VkSemaphore computeWaitSemaphores[] = { slot.uploadSemaphore, stream.timelineSemaphore };
+    // The value of the binary upload semaphore is ignored.
+    const uint64_t computeWaitValues[] = { 0, waitValue };
+    
+    VkSubmitInfo uploadSubmitInfo = {};
+    uploadSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    uploadSubmitInfo.commandBufferCount = 1;
+    uploadSubmitInfo.pCommandBuffers = &slot.uploadCommandBuffer;
+    uploadSubmitInfo.signalSemaphoreCount = 1;
+    uploadSubmitInfo.pSignalSemaphores = &slot.uploadSemaphore;
     
     VkSubmitInfo submitInfo = {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.pWaitSemaphores = computeWaitSemaphores;
+    submitInfo.pWaitDstStageMask = computeWaitStages;
     submitInfo.commandBufferCount = 1; // submit a single command buffer
-    submitInfo.pCommandBuffers = &commandBuffer; // the command buffer to submit.
+    submitInfo.pCommandBuffers = &slot.commandBuffer; // the command buffer to submit.
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &slot.computeSemaphore;
     
     /*
-     We create a fence.
+     A dependency on an earlier batch becomes a second wait, on the timeline semaphore.
      */
-    VkFence fence;
-    VkFenceCreateInfo fenceCreateInfo = {};
-    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fenceCreateInfo.flags = 0;
-    VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, NULL, &fence));
+    VkTimelineSemaphoreSubmitInfoKHR timelineSubmitInfo = {};
+    timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+    if (waitValue != 0) {
+        submitInfo.waitSemaphoreCount = 2;
+        timelineSubmitInfo.waitSemaphoreValueCount = 2;
+        timelineSubmitInfo.pWaitSemaphoreValues = computeWaitValues;
+        submitInfo.pNext = &timelineSubmitInfo;
+    }
     
+    VK_CHECK_RESULT(vkResetFences(device, 1, &slot.fence));
+    // The slot's previous batch has been read, so its upload queries are free to reset.
+    if (uploadTimestampMask != 0 && transferQueueFamilyIndex != queueFamilyIndex) {
+        pfnResetQueryPool(device, slot.queryPool, QUERY_UPLOAD_BEGIN, 2);
+    }
+    VkResult result = submitTransfer(stream, uploadSubmitInfo, VK_NULL_HANDLE);
+    if (result == VK_SUCCESS) {
+        result = vkQueueSubmit(stream.queue, 1, &submitInfo, VK_NULL_HANDLE);
+    }
+    if (checkDeviceLost(result, stream)) {
+        return;
+    }
+    VK_CHECK_RESULT(result);
     /*
-     We submit the command buffer on the queue, at the same time giving a fence.
+     No wait here: the host goes on filling the next slot while this one runs.
+     The readback is submitted later by submitReadback(), and retireSlot() waits for it
+     before the results are read.
      */
-    VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
+}
+
+void BaseApp::submitReadback(BatchSlot& slot) {
+    Stream& stream = *slot.stream;
+    if (stream.cpuOnly) {
+        return;
+    }
+    const VkPipelineStageFlags readbackWaitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    
+    VkSubmitInfo readbackSubmitInfo = {};
+    readbackSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    readbackSubmitInfo.waitSemaphoreCount = 1;
+    readbackSubmitInfo.pWaitSemaphores = &slot.computeSemaphore;
+    readbackSubmitInfo.pWaitDstStageMask = &readbackWaitStage;
+    readbackSubmitInfo.commandBufferCount = 1;
+    readbackSubmitInfo.pCommandBuffers = &slot.readbackCommandBuffer;
+    
     /*
-     The command will not have finished executing until the fence is signalled.
-     So we wait here.
-     We will directly after this read our buffer from the GPU,
-     and we will not be sure that the command has finished executing unless we wait for the fence.
-     Hence, we use a fence here.
+     The readback is submitted with the fence of the slot, it is the last thing to finish.
+     It also moves the timeline semaphore to the value of the batch.
      */
-    VK_CHECK_RESULT(vkWaitForFences(device, 1, &fence, VK_TRUE, 100000000000));
-    
-    vkDestroyFence(device, fence, NULL);
+    VkTimelineSemaphoreSubmitInfoKHR timelineSubmitInfo = {};
+    if (timelineSemaphoreSupported) {
+        timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+        timelineSubmitInfo.signalSemaphoreValueCount = 1;
+        timelineSubmitInfo.pSignalSemaphoreValues = &slot.timelineValue;
+        readbackSubmitInfo.pNext = &timelineSubmitInfo;
+        readbackSubmitInfo.signalSemaphoreCount = 1;
+        readbackSubmitInfo.pSignalSemaphores = &stream.timelineSemaphore;
+    }
+    VkResult result = submitTransfer(stream, readbackSubmitInfo, slot.fence);
+    if (!checkDeviceLost(result, stream)) {
+        VK_CHECK_RESULT(result);
+    }
+    if (stream.deferredReadback == &slot) {
+        stream.deferredReadback = NULL;
+    }
 }
 
-void BaseApp::setupInputBuffer() {
-    void* inMappedMemory = NULL;
-    // Map the buffer memory, so that we can read from it on the CPU.
-    vkMapMemory(device, inBufferMemory, 0, inBufferSize, 0, &inMappedMemory);
-    duble_fe25519* inPmappedMemory = (duble_fe25519 *) inMappedMemory;
-    for (int i = 0; i < WORK_TOTAL_SIZE; i += 1) {
-        inPmappedMemory[i].value[0].value[0] = 10;
-        inPmappedMemory[i].value[0].value[1] = 11;
-        inPmappedMemory[i].value[0].value[2] = 12;
-        inPmappedMemory[i].value[0].value[3] = 13;
-        inPmappedMemory[i].value[0].value[4] = 14;
-        inPmappedMemory[i].value[0].value[5] = 15;
-        inPmappedMemory[i].value[0].value[6] = 16;
-        inPmappedMemory[i].value[0].value[7] = 17;
-        inPmappedMemory[i].value[0].value[8] = 18;
-        inPmappedMemory[i].value[0].value[9] = 19;
-        
-        inPmappedMemory[i].value[1].value[0] = 0;
-        inPmappedMemory[i].value[1].value[1] = 1;
-        inPmappedMemory[i].value[1].value[2] = 2;
-        inPmappedMemory[i].value[1].value[3] = 3;
-        inPmappedMemory[i].value[1].value[4] = 4;
-        inPmappedMemory[i].value[1].value[5] = 5;
-        inPmappedMemory[i].value[1].value[6] = 6;
-        inPmappedMemory[i].value[1].value[7] = 7;
-        inPmappedMemory[i].value[1].value[8] = 8;
-        inPmappedMemory[i].value[1].value[9] = 9;
-        
+VkResult BaseApp::submitTransfer(Stream& stream, const VkSubmitInfo& submitInfo, VkFence fence) {
+    // Uncontended unless the transfer family has fewer queues than there are streams.
+    std::lock_guard<std::mutex> lock(*transferQueueMutexes[stream.transferQueueIndex]);
+    return vkQueueSubmit(stream.transferQueue, 1, &submitInfo, fence);
+}
+
+void BaseApp::setupSignatureBuffer(ed25519_verify_input* input, uint32_t count) {
+    /*
+     Signing on the CPU is slow, so only the first few are signed and the rest repeat them.
+     The kernel does the same work on every valid signature, copies included.
+     */
+    uint32_t distinct = std::min(count, 64u);
+    for (uint32_t i = 0; i < distinct; ++i) {
+        uint8_t seed[32], publicKey[32], secretKey[64], signature[64];
+        for (int j = 0; j < 32; ++j) {
+            seed[j] = (uint8_t)(i * 31 + j);
+        }
+        ed25519_ref_keypair(publicKey, secretKey, seed);
+        std::string message = "message " + std::to_string(i);
+        ed25519_ref_sign(signature, (const uint8_t*)message.data(), message.size(), secretKey);
+        ed25519_ref_prepare(input[i], signature, (const uint8_t*)message.data(), message.size(), publicKey);
     }
-    vkUnmapMemory(device, inBufferMemory);
-}
-
-void BaseApp::reportResult() {
-    /*
-    void* inMappedMemory = NULL;
-    // Map the buffer memory, so that we can read from it on the CPU.
-    vkMapMemory(device, inBufferMemory, 0, inBufferSize, 0, &inMappedMemory);
-    duble_fe25519* inPmappedMemory = (duble_fe25519 *) inMappedMemory;
-    */
-    void* outMappedMemory = NULL;
-    // Map the buffer memory, so that we can read from it on the CPU.
-    vkMapMemory(device, outBufferMemory, 0, outBufferSize, 0, &outMappedMemory);
-    fe25519* outPmappedMemory = (fe25519 *) outMappedMemory;
-    
-    // Get the color data from the buffer, and cast it to bytes.
-    // We save the data to a vector.
-    std::vector<int> image1;
-    image1.reserve(WORK_TOTAL_SIZE * 10);
-    
-    for (int i = 0; i < WORK_TOTAL_SIZE; i += 1) {
-        image1.push_back(((outPmappedMemory[i].value[0])));
-        image1.push_back(((outPmappedMemory[i].value[1])));
-        image1.push_back(((outPmappedMemory[i].value[2])));
-        image1.push_back(((outPmappedMemory[i].value[3])));
-        image1.push_back(((outPmappedMemory[i].value[4])));
-        image1.push_back(((outPmappedMemory[i].value[5])));
-        image1.push_back(((outPmappedMemory[i].value[6])));
-        image1.push_back(((outPmappedMemory[i].value[7])));
-        image1.push_back(((outPmappedMemory[i].value[8])));
-        image1.push_back(((outPmappedMemory[i].value[9])));
-        
+    for (uint32_t i = distinct; i < count; ++i) {
+        input[i] = input[i % distinct];
     }
+}
 
-    // Done reading, so unmap.
-    //vkUnmapMemory(device, inBufferMemory);
-    vkUnmapMemory(device, outBufferMemory);
-    
+void BaseApp::setupInputBuffer(duble_fe25519* input, uint32_t count) {
+    /*
+     A fixed linear congruential generator, so every run and the CPU reference see the same data.
+     Limbs are kept to 26 and 25 bits, the way fe25519_frombytes leaves them.
+     */
+    uint64_t state = 0x2545F4914F6CDD1DULL;
+    for (uint32_t i = 0; i < count; i += 1) {
+        for (int k = 0; k < 2; k += 1) {
+            for (int j = 0; j < 10; j += 1) {
+                state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+                uint32_t bits = (j % 2 == 0) ? 26 : 25;
+                input[i].value[k].value[j] = (int)((state >> 33) & ((1u << bits) - 1u));
+            }
+        }
+    }
+}
+
+void BaseApp::reportResult(const fe25519* output, uint32_t count) {
+    if (count == 0) {
+        return;
+    }
     for (int i = 0; i < 10; i += 1) {
-        std::cout << "INFO: Output was " << outPmappedMemory[0].value[i] << std::endl;
+        std::cout << "INFO: Output was " << output[0].value[i] << std::endl;
+    }
+}
+
+void BaseApp::destroySlot(BatchSlot& slot) {
+    // A slot whose creation failed half way has some of its handles still null, which Vulkan ignores.
+    if (slot.inMappedMemory != NULL) {
+        vkUnmapMemory(device, slot.inStagingBufferMemory);
+    }
+    if (slot.outMappedMemory != NULL) {
+        vkUnmapMemory(device, slot.outStagingBufferMemory);
+    }
+    vkFreeMemory(device, slot.inStagingBufferMemory, NULL);
+    vkDestroyBuffer(device, slot.inStagingBuffer, NULL);
+    vkFreeMemory(device, slot.outStagingBufferMemory, NULL);
+    vkDestroyBuffer(device, slot.outStagingBuffer, NULL);
+    vkFreeMemory(device, slot.inBufferMemory, NULL);
+    vkDestroyBuffer(device, slot.inBuffer, NULL);
+    vkFreeMemory(device, slot.outBufferMemory, NULL);
+    vkDestroyBuffer(device, slot.outBuffer, NULL);
+    vkFreeMemory(device, slot.scratchBufferMemory, NULL);
+    vkDestroyBuffer(device, slot.scratchBuffer, NULL);
+    vkDestroyFence(device, slot.fence, NULL);
+    vkDestroySemaphore(device, slot.uploadSemaphore, NULL);
+    vkDestroySemaphore(device, slot.computeSemaphore, NULL);
+    if (slot.queryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, slot.queryPool, NULL);
+    }
+    if (slot.statisticsQueryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, slot.statisticsQueryPool, NULL);
+    }
+}
+
+void BaseApp::destroyStream(Stream& stream) {
+    for (BatchSlot& slot : stream.slots) {
+        destroySlot(slot);
+    }
+    stream.slots.clear();
+    if (stream.timelineSemaphore != VK_NULL_HANDLE) {
+        vkDestroySemaphore(device, stream.timelineSemaphore, NULL);
+        stream.timelineSemaphore = VK_NULL_HANDLE;
+    }
+    // A stream no thread ever submitted to was never created.
+    if (stream.commandPool != VK_NULL_HANDLE) {
+        vkDestroyCommandPool(device, stream.commandPool, NULL);
+        vkDestroyCommandPool(device, stream.transferCommandPool, NULL);
     }
 }
 
 void BaseApp::cleanup() {
     /*
      Clean up all Vulkan Resources.
+     Batches still in flight are finished first, so their outputs are filled in.
+     Every other thread must be done submitting by now.
+     After a failed init() this releases whatever it had created, every handle it did not get to is null.
      */
-    if (enableValidationLayers) {
-        DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+    flush();
+    {
+        std::lock_guard<std::mutex> lock(liveEnginesMutex);
+        liveEngines.erase(engineSerial);
+    }
+    cpuEngine.reset();
+    onCpu = false;
+    if (device == VK_NULL_HANDLE) {
+        // The CPU engine served every batch, or init() failed before it had a device.
+        streams.clear();
+        destroyInstance();
+        return;
+    }
+    
+    for (std::unique_ptr<Stream>& stream : streams) {
+        destroyStream(*stream);
+    }
+    streams.clear();
+    transferQueueMutexes.clear();
+    for (uint32_t kernel = 0; kernel < KERNEL_COUNT; ++kernel) {
+        vkDestroyShaderModule(device, computeShaderModules[kernel], NULL);
+        computeShaderModules[kernel] = VK_NULL_HANDLE;
+        vkDestroyPipeline(device, pipelines[kernel], NULL);
+        pipelines[kernel] = VK_NULL_HANDLE;
+        pipelineReady[kernel] = false;
     }
-    vkFreeMemory(device, inBufferMemory, NULL);
-    vkDestroyBuffer(device, inBuffer, NULL);
-    vkFreeMemory(device, outBufferMemory, NULL);
-    vkDestroyBuffer(device, outBuffer, NULL);
-    vkDestroyShaderModule(device, computeShaderModule, NULL);
     vkDestroyDescriptorPool(device, descriptorPool, NULL);
-    vkDestroyDescriptorSetLayout(device, descriptorSetLayout, NULL);
+    for (uint32_t i = 0; i < SET_LAYOUT_COUNT; ++i) {
+        vkDestroyDescriptorSetLayout(device, descriptorSetLayouts[i], NULL);
+    }
+    vkDestroyDescriptorSetLayout(device, tableDescriptorSetLayout, NULL);
+    vkFreeMemory(device, tableBufferMemory, NULL);
+    vkDestroyBuffer(device, tableBuffer, NULL);
     vkDestroyPipelineLayout(device, pipelineLayout, NULL);
-    vkDestroyPipeline(device, pipeline, NULL);
-    vkDestroyCommandPool(device, commandPool, NULL);
+    pipelineCache.destroy();
     vkDestroyDevice(device, nullptr);
-    vkDestroyInstance(instance, nullptr);
+    device = VK_NULL_HANDLE;
+    destroyInstance();
     
 }
@@ -12,6 +12,16 @@
 #include <stdio.h>
 #include <vector>
 #include <iostream>
+#include <functional>
+#include <string>
+#include <memory>
+#include <deque>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <stdexcept>
+#include "PipelineCache.hpp"
+#include "ShaderRegistry.hpp"
 
 // Used for validating return values of Vulkan API calls.
 #define VK_CHECK_RESULT(f)                                                                                 \
@@ -24,13 +34,69 @@ assert(res == VK_SUCCESS);
 }                                                                                                    \
 }
 
-const int WORK_TOTAL_SIZE = 256;
-const int WORKGROUP_SIZE = 16; // Workgroup size in compute shader.
+class CpuEngine;
+class CpuJob;
 
 class BaseApp {
 
 public:
-    const char* shaderName = "ed25519.spv";
+    /*
+     Every kernel is a pipeline of its own. The second name is the same kernel with 64-bit
+     products emulated in 32-bit arithmetic, for devices without shaderInt64.
+     KERNEL_FIELD_SOA and KERNEL_FIELD_BYTES are the field kernel again, specialized for
+     LAYOUT_SOA and FORMAT_BYTES.
+     The transpose does not multiply, so it only comes in one variant.
+     */
+    enum Kernel {
+        KERNEL_FIELD = 0,
+        KERNEL_ED25519_VERIFY,
+        KERNEL_X25519,
+        KERNEL_SCALARMULT_BASE,
+        KERNEL_BATCH_INVERT,
+        KERNEL_FIELD_SOA,
+        KERNEL_TRANSPOSE,
+        KERNEL_FIELD_BYTES,
+        KERNEL_COUNT
+    };
+    const char* shaderNames[KERNEL_COUNT][2] = {
+        {"ed25519.spv", "ed25519_int32.spv"},
+        {"ed25519_verify.spv", "ed25519_verify_int32.spv"},
+        {"x25519.spv", "x25519_int32.spv"},
+        {"ge25519_scalarmult_base.spv", "ge25519_scalarmult_base_int32.spv"},
+        {"fe25519_batch_invert.spv", "fe25519_batch_invert_int32.spv"},
+        {"ed25519.spv", "ed25519_int32.spv"},
+        {"fe25519_transpose.spv", "fe25519_transpose.spv"},
+        {"ed25519.spv", "ed25519_int32.spv"}
+    };
+    
+    /*
+     How a batch of field elements is laid out in memory.
+     LAYOUT_AOS is an array of fe25519 or duble_fe25519, so neighbouring invocations read
+     40 or 80 bytes apart. LAYOUT_SOA stores limb j of every element next to each other:
+     a batch of `count` elements of `width` ints is `width` rows of `count` ints, and the
+     int at row r, column i is limb r of element i. For duble_fe25519, rows 0-9 are
+     value[0] and rows 10-19 value[1].
+     Must match FE_LAYOUT_ in ed25519_ref10_fe_25_5.comp and fe25519_transpose.comp.
+     */
+    enum Layout {
+        LAYOUT_AOS = 0,
+        LAYOUT_SOA
+    };
+    
+    /*
+     What a field element is on the bus. FORMAT_LIMBS is the fe25519 the kernel computes on.
+     FORMAT_BYTES is its 32-byte little-endian encoding: the kernel decodes it with fe25519_frombytes
+     on load and stores the canonical encoding from fe25519_tobytes, so an input crosses the bus
+     as 64 bytes instead of 80 and an output as 32 instead of 40.
+     Must match FE_FORMAT_ in ed25519_ref10_fe_25_5.comp.
+     */
+    enum Format {
+        FORMAT_LIMBS = 0,
+        FORMAT_BYTES
+    };
+    static const uint32_t FE25519_BYTES = 32;
+    static const uint32_t FE25519_WIDTH = 10;
+    static const uint32_t DUBLE_FE25519_WIDTH = 20;
     
     struct fe25519 {
         int value [10];
@@ -38,9 +104,199 @@ public:
     struct duble_fe25519 {
         fe25519 value [2];
     };
+    
+    /*
+     One signature for verify(), laid out like the struct in ed25519_verify.comp.
+     Each field is 32 bytes as they appear in the key and the signature. h is
+     SHA-512(R || publicKey || message) reduced modulo the group order, see ed25519_ref_prepare().
+     */
+    struct ed25519_verify_input {
+        uint8_t publicKey[32];
+        uint8_t R[32];
+        uint8_t S[32];
+        uint8_t h[32];
+    };
 
-    uint32_t inBufferSize; // size of `buffer` in bytes.
-    uint32_t outBufferSize; // size of `buffer` in bytes.
+    /*
+     Largest batch a single submit() accepts. The buffers of every slot are sized for it once in init().
+     */
+    uint32_t maxElementCount = 0;
+    /*
+     Number of batches that can be in flight at once. With three slots batch k+1 is uploaded
+     while batch k computes and batch k-1 is read back.
+     */
+    uint32_t slotCount = 3;
+    /*
+     Invocations per workgroup of every kernel. The shaders take it as specialization constant 2
+     (local_size_x_id), so any size works without recompiling them. init() clamps it to the limits
+     of the device. Sixteen lanes would leave most of a 32- or 64-wide SIMD unit idle.
+     Kernels with an entry in tuningFile use the size found by autotune() instead.
+     */
+    uint32_t workgroupSize = 64;
+    // Where autotune() keeps its results, one line per device, driver version and kernel.
+    std::string tuningFile = "workgroup_sizes.txt";
+    // Where the compiled pipelines are kept between runs, see PipelineCache.
+    std::string pipelineCacheFile = "compute_pipeline_cache.bin";
+    /*
+     Which device init() runs on, as an index into listDevices(). -1 picks the best suitable
+     device, one with shaderInt64 if there is any. CPU_DEVICE leaves Vulkan alone and has the
+     CpuEngine serve every batch, as on a machine without a device.
+     */
+    int deviceIndex = -1;
+    static const int CPU_DEVICE = -2;
+    /*
+     Writes GPU timestamps around the upload, the dispatches and the readback of every batch,
+     see lastTimings(). Set before init(). logTimings prints them for every batch as it is retired.
+     */
+    bool timestampsEnabled = true;
+    bool logTimings = false;
+    /*
+     Counts the compute shader invocations of every batch with a pipeline statistics query, to see
+     how many of them only pad the last workgroup, see lastStatistics(). Needs the
+     pipelineStatisticsQuery feature and stays off without it. Set before init().
+     */
+    bool pipelineStatisticsEnabled = false;
+    /*
+     When init() finds no Vulkan driver, no suitable device, or one that fails to come up, or the
+     device is lost later on, the batches go to a CpuEngine on cpuThreadCount threads instead, 0 for
+     one per hardware thread. A device asked for with deviceIndex never falls back at init(). Without
+     cpuFallbackEnabled both are fatal, as they used to be. Any other error of init() always is.
+     */
+    bool cpuFallbackEnabled = true;
+    uint32_t cpuThreadCount = 0;
+    /*
+     The CpuEngine those batches and the CPU share of splitBatches run on, for engines that divide
+     the machine's threads between them, as the ones of a MultiDeviceEngine do. Without it the
+     engine starts one of its own, on cpuThreadCount threads. Set before init().
+     */
+    std::shared_ptr<CpuEngine> sharedCpuEngine;
+    // What init() throws when there is no device to run on, the cases cpuFallbackEnabled covers.
+    class NoDeviceError : public std::runtime_error {
+    public:
+        explicit NoDeviceError(const std::string& what) : std::runtime_error(what) {}
+    };
+    /*
+     Runs part of every batch on a CpuEngine next to the GPU, so both work on it at once. The share
+     of each comes from their measured throughput, see throughputOf(), and a batch too small to
+     be worth the round trip to the GPU stays on the CPU. Only kernels whose elements are
+     independent of each other are split; LAYOUT_SOA, the transpose and FE_BATCH_INVERT always
+     run whole on the GPU. Set before init().
+     */
+    bool splitBatches = false;
+    VkDeviceSize inBufferSize; // size of `buffer` in bytes.
+    VkDeviceSize outBufferSize; // size of `buffer` in bytes.
+    VkDeviceSize scratchBufferSize; // size of `scratchBuffer` in bytes.
+    
+    /*
+     Push constants consumed by the compute shader. Must match the
+     layout(push_constant) block in ed25519_ref10_fe_25_5.comp.
+     */
+    struct PushConstants {
+        uint32_t elementCount;
+        uint32_t op;
+        uint32_t selector;
+    };
+    
+    /*
+     Field operation applied to every element of a batch, see shaders/fe25519.glsl.
+     Two-operand operations take both values of the duble_fe25519, the others only the first.
+     FE_CMOV returns the second value when the selector is 1. For FE_FROMBYTES and FE_TOBYTES
+     a 32 byte string is stored in the first 8 words of a fe25519, lowest byte first.
+     FE_BATCH_INVERT gives the same values as FE_INVERT for about ten multiplications per element
+     instead of an inversion each, see fe25519_batch_invert.comp. Its limbs differ from those of
+     FE_INVERT, both are valid representations of the inverse.
+     Must match the FE_ defines in ed25519_ref10_fe_25_5.comp.
+     */
+    enum FieldOp {
+        FE_ADD = 0,
+        FE_SUB,
+        FE_NEG,
+        FE_MUL,
+        FE_SQ,
+        FE_SQ2,
+        FE_CARRY,
+        FE_INVERT,
+        FE_POW22523,
+        FE_CMOV,
+        FE_FROMBYTES,
+        FE_TOBYTES,
+        FE_BATCH_INVERT,
+        FE_OP_COUNT
+    };
+    static const char* fieldOpName(FieldOp op);
+    
+    /*
+     Host-side conversion between the layouts, `rows` holds count * FE25519_WIDTH or
+     count * DUBLE_FE25519_WIDTH ints.
+     */
+    static void packSoA(const fe25519* elements, int* rows, uint32_t count);
+    static void packSoA(const duble_fe25519* elements, int* rows, uint32_t count);
+    static void unpackSoA(const int* rows, fe25519* elements, uint32_t count);
+    static void unpackSoA(const int* rows, duble_fe25519* elements, uint32_t count);
+    
+    /*
+     GPU time of each stage of a batch in seconds, between the timestamps written before and after
+     its commands. A stage whose queue family has no timestamps stays 0, and so does the upload on a
+     transfer-only family without VK_EXT_host_query_reset. Whatever the host spends
+     on a batch beyond their sum went to submission, semaphore waits and the queues.
+     On the CPU engine a batch has no transfers, compute is the wall time of its work.
+     */
+    struct BatchTimings {
+        double upload = 0;
+        double compute = 0;
+        double readback = 0;
+    };
+    
+    /*
+     What the dispatches of a batch executed: `invocations` compute shader invocations for `elements`
+     elements. A single-pass kernel pads at most its last workgroup, FE_BATCH_INVERT runs three
+     passes and so about twice the elements plus a workgroup.
+     */
+    struct BatchStatistics {
+        uint64_t elements = 0;
+        uint64_t invocations = 0;
+    };
+    
+    /*
+     What splitBatches plans with, per kernel: elements per second of each side, and the seconds a
+     GPU batch takes beyond its elements, for the submissions, the semaphores and the wait.
+     Moving averages of the batches retired so far, 0 until measured.
+     */
+    struct Throughput {
+        double gpuElementsPerSecond = 0;
+        double cpuElementsPerSecond = 0;
+        double gpuLatency = 0;
+    };
+    
+    /*
+     Handle to a batch started with submitAsync(). It is backed by a value of the
+     VK_KHR_timeline_semaphore of the queue it went to, so any number of batches can be tracked
+     without a thread blocked on each. Handles are cheap to copy; they stay valid for the lifetime
+     of the engine and can be waited on from any thread.
+     */
+    class BatchHandle {
+    public:
+        // Non-blocking. Returns true once the results have been copied to the batch's output.
+        bool poll() const;
+        // Waits at most timeout nanoseconds. Returns true once the results are in the output.
+        bool wait(uint64_t timeout = UINT64_MAX) const;
+        /*
+         Registers a callback run once the results are in the output. It runs from whichever engine
+         call retires the batch (poll, wait, pollCompletions, flush or a later submitAsync), or right
+         away when the batch has already completed.
+         */
+        void then(std::function<void()> callback) const;
+        
+        uint64_t timelineValue() const { return value; }
+        bool valid() const { return app != NULL; }
+        
+    private:
+        friend class BaseApp;
+        BaseApp* app = NULL;
+        uint64_t value = 0;
+        // Index into streams of the queue the batch was submitted to.
+        uint32_t stream = 0;
+    };
     
 protected:
 #ifdef NDEBUG
@@ -56,45 +312,92 @@ protected:
     static const uint32_t SET_LAYOUT_COUNT = 2;
     
     // Vulkan objects:
-    VkInstance instance;
-    VkDebugUtilsMessengerEXT debugMessenger;
+    VkInstance instance = VK_NULL_HANDLE;
+    // Vulkan version the instance was created with, 1.1 when the loader has it.
+    uint32_t instanceApiVersion = VK_API_VERSION_1_0;
+    VkDebugUtilsMessengerEXT debugMessenger = VK_NULL_HANDLE;
     VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
-    VkDevice device;
+    VkPhysicalDeviceProperties deviceProperties;
+    // See deviceElementLimit(), UINT32_MAX on the CPU engine.
+    uint32_t elementLimit = 0;
+    VkDevice device = VK_NULL_HANDLE;
     
-    /*
-     In order to execute commands on a device(GPU), the commands must be submitted
-     to a queue. The commands are stored in a command buffer, and this command buffer
-     is given to the queue.
-     There will be different kinds of queues on the device. Not all queues support
-     graphics operations, for instance. For this application, we at least want a queue
-     that supports compute operations.
-     */
-    VkQueue queue; // a queue supporting compute operations.
     /*
      Groups of queues that have the same capabilities(for instance, they all supports graphics and computer operations),
      are grouped into queue families.
      
      When submitting a command buffer, you must specify to which queue in the family you are submitting to.
-     This variable keeps track of the index of that queue in its family.
+     This variable keeps track of the family, and queueCount of how many of its queues we asked for.
      */
     uint32_t queueFamilyIndex;
+    uint32_t queueCount = 1;
+    
+    /*
+     Uploads and readbacks are submitted to a transfer-only queue family when the device has one,
+     so the copies run on the DMA engines next to the compute work. Otherwise these alias
+     queueFamilyIndex and the compute queues. A family with fewer queues than the compute family
+     shares them between streams, and a queue may only be submitted to by one thread at a time:
+     transferQueueMutexes has one mutex per transfer queue.
+     */
+    uint32_t transferQueueFamilyIndex;
+    uint32_t transferQueueCount = 1;
+    std::vector<std::unique_ptr<std::mutex>> transferQueueMutexes;
+    
+    /*
+     The bits of a timestamp that are valid on each queue, 0 when the family has no timestamps
+     or timestampsEnabled is off.
+     */
+    uint64_t computeTimestampMask = 0;
+    uint64_t transferTimestampMask = 0;
+    /*
+     transferTimestampMask, or 0 when the upload's queries cannot be reset: a transfer-only family
+     cannot record vkCmdResetQueryPool, and resetting them from the host takes VK_EXT_host_query_reset.
+     */
+    uint64_t uploadTimestampMask = 0;
+    bool hostQueryResetSupported = false;
+    PFN_vkResetQueryPoolEXT pfnResetQueryPool = NULL;
+    // Queries of the per-slot timestamp pool, a begin and an end for each stage.
+    enum TimestampQuery {
+        QUERY_UPLOAD_BEGIN = 0,
+        QUERY_UPLOAD_END,
+        QUERY_COMPUTE_BEGIN,
+        QUERY_COMPUTE_END,
+        QUERY_READBACK_BEGIN,
+        QUERY_READBACK_END,
+        QUERY_COUNT
+    };
+    // pipelineStatisticsEnabled and the device has pipelineStatisticsQuery.
+    bool pipelineStatisticsSupported = false;
 
     
     /*
      The pipeline specifies the pipeline that all graphics and compute commands pass though in Vulkan.
      We will be creating a simple compute pipeline in this application.
      */
-    VkPipeline pipeline;
-    VkPipelineLayout pipelineLayout;
-    VkShaderModule computeShaderModule;
+    VkPipeline pipelines[KERNEL_COUNT] = {};
+    /*
+     getPipeline() creates the pipelines on first use, from whichever thread gets there first.
+     pipelineReady is set once pipelines[kernel] can be read without pipelineMutex.
+     */
+    std::atomic<bool> pipelineReady[KERNEL_COUNT] = {};
+    std::mutex pipelineMutex;
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    VkShaderModule computeShaderModules[KERNEL_COUNT] = {};
+    PipelineCache pipelineCache;
     
     /*
-     The command buffer is used to record commands, that will be submitted to a queue.
-     To allocate such command buffers, we use a command pool.
+     What each pipeline was created with: the workgroup size, and the subgroup size it requires,
+     0 for the driver's choice. kernelHashes identifies the SPIR-V a tuned entry was measured with.
      */
-    VkCommandPool commandPool;
-    VkCommandBuffer commandBuffer;
-
+    uint32_t workgroupSizes[KERNEL_COUNT];
+    uint32_t subgroupSizes[KERNEL_COUNT];
+    uint64_t kernelHashes[KERNEL_COUNT];
+    // Largest workgroup every kernel can be created with on this device.
+    uint32_t maxWorkgroupSize = 0;
+    // Smallest workgroup size autotune() tries, the scratch buffers are sized for it.
+    static const uint32_t MIN_TUNED_WORKGROUP_SIZE = 8;
+    bool subgroupSizeControlSupported = false;
+    VkPhysicalDeviceSubgroupSizeControlPropertiesEXT subgroupSizeControlProperties = {};
     
     /*
      Descriptors represent resources in shaders. They allow us to use things like
@@ -104,41 +407,370 @@ protected:
      */
     
     
-    VkDescriptorPool descriptorPool;
-    VkDescriptorSet descriptorSets [SET_LAYOUT_COUNT];
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
 
-    VkDescriptorSetLayout descriptorSetLayouts[SET_LAYOUT_COUNT];
-    VkDescriptorSetLayout descriptorSetLayout;
+    VkDescriptorSetLayout descriptorSetLayouts[SET_LAYOUT_COUNT] = {};
+    
+    /*
+     Multiples of the base point for ge25519_scalarmult_base.comp, see ge25519_ref_base().
+     Built on the CPU and uploaded once in init(), then bound as set 2 of every dispatch.
+     The buffer is DEVICE_LOCAL and never written again, so one copy serves all slots.
+     */
+    VkBuffer tableBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory tableBufferMemory = VK_NULL_HANDLE;
+    VkDescriptorSetLayout tableDescriptorSetLayout = VK_NULL_HANDLE;
+    VkDescriptorSet tableDescriptorSet;
+    
+    struct Stream;
     
     /*
-     The memory that backs the buffer is bufferMemory.
+     Everything one batch needs while it is in flight. Slots are used round-robin, so while one
+     slot computes the host can fill the next one and the transfer queue can drain the previous one.
      */
-    VkBuffer inBuffer;
-    VkDeviceMemory inBufferMemory;
+    struct BatchSlot {
+        // The stream whose queues and command pools the slot belongs to.
+        Stream* stream = NULL;
+        
+        /*
+         The storage buffers the shader works on. They live in DEVICE_LOCAL memory,
+         so the kernel reads and writes VRAM instead of going across the bus.
+         */
+        VkBuffer inBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory inBufferMemory = VK_NULL_HANDLE;
+        
+        VkBuffer outBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory outBufferMemory = VK_NULL_HANDLE;
+        
+        /*
+         Intermediate results that never leave the GPU, the products of each workgroup
+         for FE_BATCH_INVERT. Bound next to outBuffer, as binding 1 of set 1.
+         */
+        VkBuffer scratchBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory scratchBufferMemory = VK_NULL_HANDLE;
+        
+        /*
+         HOST_VISIBLE staging buffers the host writes the input to and reads the results from.
+         vkCmdCopyBuffer moves the data between them and the storage buffers.
+         Both stay mapped for the lifetime of the engine.
+         */
+        VkBuffer inStagingBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory inStagingBufferMemory = VK_NULL_HANDLE;
+        
+        VkBuffer outStagingBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory outStagingBufferMemory = VK_NULL_HANDLE;
+        
+        void* inMappedMemory = NULL;
+        void* outMappedMemory = NULL;
+        
+        VkDescriptorSet descriptorSets [SET_LAYOUT_COUNT];
+        
+        /*
+         upload: staging -> inBuffer on the transfer queue.
+         commandBuffer: the dispatch on the compute queue.
+         readback: outBuffer -> staging on the transfer queue.
+         The semaphores order the three submissions, the fence is signalled by the readback.
+         */
+        VkCommandBuffer uploadCommandBuffer;
+        VkCommandBuffer commandBuffer;
+        VkCommandBuffer readbackCommandBuffer;
+        VkSemaphore uploadSemaphore = VK_NULL_HANDLE;
+        VkSemaphore computeSemaphore = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        // Timestamps of the three command buffers, see TimestampQuery. VK_NULL_HANDLE without timestamps.
+        VkQueryPool queryPool = VK_NULL_HANDLE;
+        // One pipeline statistics query around the dispatches, VK_NULL_HANDLE without them.
+        VkQueryPool statisticsQueryPool = VK_NULL_HANDLE;
+        
+        // Kernel, batch size and operation the command buffers are currently recorded for.
+        Kernel kernel = KERNEL_COUNT;
+        PushConstants pushConstants = {};
+        // Bytes the upload and the readback copy.
+        VkDeviceSize inSize = 0;
+        VkDeviceSize outSize = 0;
+        
+        // Where the results go once the fence is signalled, NULL when the slot is idle.
+        void* pendingOutput = NULL;
+        // Timeline value of the batch in flight, and what to run once it is retired.
+        uint64_t timelineValue = 0;
+        std::function<void()> callback;
+        
+        /*
+         With splitBatches, the elements after the GPU's share run as cpuJob and write straight to
+         the output. onGpu is false when the whole batch went to the CPU and the slot only tracks it.
+         */
+        std::shared_ptr<CpuJob> cpuJob;
+        bool onGpu = true;
+        uint32_t cpuElementCount = 0;
+        // Kernel of the batch in flight and when it was submitted, for measureThroughput().
+        Kernel batchKernel = KERNEL_COUNT;
+        std::chrono::steady_clock::time_point submitTime;
+    };
+    
+    struct CpuBatch {
+        std::shared_ptr<CpuJob> job;
+        uint64_t value = 0;
+        std::function<void()> callback;
+    };
     
     /*
-     The memory that backs the buffer is bufferMemory.
+     What one submitting thread needs to feed the device on its own, around one queue of the compute
+     family. Batch handles count per stream: every readback signals the next value of the stream's
+     timeline semaphore, so a batch is complete once the counter reaches its value. When the device
+     has no VK_KHR_timeline_semaphore the slot fences are used instead, and chained submissions
+     wait on the host.
      */
-    VkBuffer outBuffer;
-    VkDeviceMemory outBufferMemory;
+    struct Stream {
+        uint32_t index = 0;
+        /*
+         In order to execute commands on a device(GPU), the commands must be submitted
+         to a queue. The commands are stored in a command buffer, and this command buffer
+         is given to the queue. Queue `index` of the compute family is this stream's alone.
+         */
+        VkQueue queue = VK_NULL_HANDLE;
+        // Transfer queue transferQueueIndex, guarded by transferQueueMutexes[transferQueueIndex].
+        VkQueue transferQueue = VK_NULL_HANDLE;
+        uint32_t transferQueueIndex = 0;
+        /*
+         Held by every call that touches the stream. Only threads sharing the stream ever wait for
+         it; recursive, since a callback may submit further batches from inside a retire.
+         */
+        std::recursive_mutex mutex;
+        // The Vulkan objects are created on first use, see currentStream().
+        std::once_flag created;
+        
+        /*
+         The command buffer is used to record commands, that will be submitted to a queue.
+         To allocate such command buffers, we use a command pool.
+         The upload and readback copies are recorded into command buffers allocated from a pool
+         of the transfer queue family.
+         */
+        VkCommandPool commandPool = VK_NULL_HANDLE;
+        VkCommandPool transferCommandPool = VK_NULL_HANDLE;
+        
+        std::vector<BatchSlot> slots;
+        // Slot the next submitAsync() will use.
+        uint32_t nextSlot = 0;
+        // Most recent slot, its readback is submitted behind the next upload.
+        BatchSlot* deferredReadback = NULL;
+        VkSemaphore timelineSemaphore = VK_NULL_HANDLE;
+        uint64_t submittedValue = 0;
+        
+        /*
+         Set once the batches of this stream go to the CPU engine, see onCpu. Those in flight are
+         then kept oldest first in cpuBatches and take the timeline values from firstCpuValue on,
+         those below belong to the slots, which only hold batches that were finished on the CPU.
+         */
+        bool cpuOnly = false;
+        std::deque<CpuBatch> cpuBatches;
+        uint64_t firstCpuValue = 0;
+        
+        BatchTimings lastBatchTimings;
+        BatchTimings totalBatchTimings;
+        uint64_t timedBatchCount = 0;
+        BatchStatistics lastBatchStatistics;
+        BatchStatistics totalBatchStatistics;
+        Throughput throughput[KERNEL_COUNT];
+    };
+    /*
+     The compute queue family usually has more than one queue. init() asks for all of them, and every
+     thread that submits gets one to itself, with its own command pools, slots and timeline semaphore,
+     so request handlers on different threads feed the device side by side without a lock between them.
+     A thread keeps its queue for the lifetime of the engine; with more threads than queues they share
+     them round-robin. The slots of a queue are only created once a thread first submits to it.
+     One stream per queue of the compute family, one per CpuEngine worker without a device. Sized by
+     init() and never resized after, so threads look up their stream without a lock.
+     */
+    std::vector<std::unique_ptr<Stream>> streams;
+    // Handed out round-robin to the threads, see streamIndex().
+    mutable std::atomic<uint32_t> nextStream{0};
+    // Tells this engine apart in the threads' stream assignments, an address may be reused by a later one.
+    uint64_t engineSerial = 0;
+    // Serializes the creation of streams, whose descriptor sets come from one pool.
+    std::mutex streamMutex;
+    
+    bool shaderInt64Supported = false;
+    bool timelineSemaphoreSupported = false;
+    PFN_vkGetSemaphoreCounterValueKHR pfnGetSemaphoreCounterValue = NULL;
+    PFN_vkWaitSemaphoresKHR pfnWaitSemaphores = NULL;
+    
+    /*
+     The CPU engine, NULL unless there was no device, it was lost, or splitBatches. onCpu is set when
+     every batch goes to it, and only after cpuEngine, so a thread that sees it can use the engine.
+     When the GPU stopped answering, each stream moves to the CPU the next time it is used, see moveToCpu().
+     */
+    std::shared_ptr<CpuEngine> cpuEngine;
+    std::mutex cpuEngineMutex;
+    std::atomic<bool> onCpu{false};
     
 
     public:
-    void run() {
-        // std::cout << "INFO: Let's start: "<<enableValidationLayers<< std::endl;
-        initVulkan();
-        mainLoop();
-        cleanup();
-    }
+    /*
+     Brings up Vulkan once: instance, device, pipeline and `slotCount` batch slots with buffers
+     for maxElementCount elements each. After this, submit() and submitAsync() can be called any number of times.
+     */
+    void init(uint32_t maxElementCount, uint32_t slotCount = 3, uint32_t workgroupSize = 64);
     
-    protected:
-    void initVulkan();
-
-    void mainLoop();
+    /*
+     Runs `op` over one batch of `count` elements (count <= maxElementCount) and blocks until the
+     results are copied to `output`. `selector` is only used by FE_CMOV. Only this batch is waited
+     for, as with the blocking form of every kernel below: earlier batches and those of other threads
+     stay in flight.
+     */
+    void submit(FieldOp op, const duble_fe25519* input, fe25519* output, uint32_t count, uint32_t selector = 0);
+    
+    /*
+     Starts one batch without waiting for it. `output` must stay valid until the batch is retired:
+     see BatchHandle. When `after` is given, the dispatch waits on the GPU for that earlier batch,
+     without a round trip through the host.
+     */
+    BatchHandle submitAsync(FieldOp op, const duble_fe25519* input, fe25519* output, uint32_t count,
+                            const BatchHandle* after = NULL, uint32_t selector = 0);
+    
+    /*
+     The same as submit() and submitAsync() on LAYOUT_SOA batches: `input` is count * DUBLE_FE25519_WIDTH
+     ints and `output` count * FE25519_WIDTH ints, see packSoA(). FE_BATCH_INVERT only takes LAYOUT_AOS.
+     */
+    void submitSoA(FieldOp op, const int* input, int* output, uint32_t count, uint32_t selector = 0);
+    BatchHandle submitSoAAsync(FieldOp op, const int* input, int* output, uint32_t count,
+                               const BatchHandle* after = NULL, uint32_t selector = 0);
+    
+    /*
+     The same on FORMAT_BYTES batches: `input` holds the two 32-byte operands of each element back
+     to back, count * 2 * FE25519_BYTES bytes, and `output` count * FE25519_BYTES bytes.
+     As with fe25519_frombytes, the top bit of each operand is ignored.
+     FE_FROMBYTES, FE_TOBYTES and FE_BATCH_INVERT only take FORMAT_LIMBS.
+     */
+    void submitBytes(FieldOp op, const uint8_t* input, uint8_t* output, uint32_t count, uint32_t selector = 0);
+    BatchHandle submitBytesAsync(FieldOp op, const uint8_t* input, uint8_t* output, uint32_t count,
+                                 const BatchHandle* after = NULL, uint32_t selector = 0);
+    
+    /*
+     Converts a batch of `count` elements of `width` ints (FE25519_WIDTH or DUBLE_FE25519_WIDTH)
+     into the layout `to` on the GPU, for callers that hold LAYOUT_AOS data and want to
+     run the LAYOUT_SOA kernels, and back.
+     */
+    void transpose(Layout to, const int* input, int* output, uint32_t count, uint32_t width);
+    BatchHandle transposeAsync(Layout to, const int* input, int* output, uint32_t count, uint32_t width,
+                               const BatchHandle* after = NULL);
+    
+    /*
+     Checks `count` Ed25519 signatures, verdicts[i] is 1 when signature i is valid and 0 otherwise.
+     verifyAsync() is the non-blocking form, with the same rules as submitAsync().
+     */
+    void verify(const ed25519_verify_input* input, uint32_t* verdicts, uint32_t count);
+    BatchHandle verifyAsync(const ed25519_verify_input* input, uint32_t* verdicts, uint32_t count,
+                            const BatchHandle* after = NULL);
+    
+    /*
+     X25519 of RFC 7748 on `count` pairs: input[i].value[0] is the scalar, input[i].value[1] the
+     u-coordinate and output[i] the shared secret, each 32 bytes in the first 8 words as for FE_FROMBYTES.
+     The scalar is clamped by the kernel. An all-zero output means the peer sent a low-order point.
+     */
+    void x25519(const duble_fe25519* input, fe25519* output, uint32_t count);
+    BatchHandle x25519Async(const duble_fe25519* input, fe25519* output, uint32_t count,
+                            const BatchHandle* after = NULL);
+    
+    /*
+     points[i] = scalars[i] * B for the Ed25519 base point B, compressed. Scalars and points are
+     32 bytes in the first 8 words as for FE_FROMBYTES, the top bit of a scalar is ignored.
+     This is the step of key generation and signing that depends on the secret, it runs in constant time.
+     */
+    void scalarmultBase(const fe25519* scalars, fe25519* points, uint32_t count);
+    BatchHandle scalarmultBaseAsync(const fe25519* scalars, fe25519* points, uint32_t count,
+                                    const BatchHandle* after = NULL);
+    
+    /*
+     Times every kernel on a batch of maxElementCount elements with each workgroup size the device
+     allows, and each subgroup size where VK_EXT_subgroup_size_control is available. The fastest
+     configurations are used from then on and saved to tuningFile, where init() finds them on
+     later runs with the same device, driver and shaders. Waits for every batch in flight first.
+     Other threads may keep submitting, their batches wait until the tuned pipelines are in place.
+     */
+    void autotune();
+    
+    /*
+     Retires every batch that has already completed, without blocking. Returns how many were retired.
+     Streams another thread is submitting to at the moment are left to that thread.
+     */
+    uint32_t pollCompletions();
+    
+    // Waits for every batch in flight, on every stream, and copies out their results.
+    void flush();
 
     void cleanup ();
+    
+    /*
+     Timings of the batch the calling thread's stream retired last. A callback registered with
+     BatchHandle::then() sees those of its own batch.
+     */
+    const BatchTimings& lastTimings() const { return streams[streamIndex()]->lastBatchTimings; }
+    /*
+     Sum of the timings of every batch retired since init() or resetTimings(), over all streams, and
+     how many there were. Read them while no other thread submits.
+     */
+    BatchTimings totalTimings() const;
+    uint64_t timedBatches() const;
+    // The same for the pipeline statistics, all zero unless pipelineStatisticsEnabled.
+    const BatchStatistics& lastStatistics() const { return streams[streamIndex()]->lastBatchStatistics; }
+    BatchStatistics totalStatistics() const;
+    // Clears the sums of the timings and of the statistics.
+    void resetTimings();
+    
+    // Names of the Vulkan devices of this machine, in the order deviceIndex counts them.
+    static std::vector<std::string> listDevices();
+    // Name of the device init() picked.
+    const char* deviceName() const { return usingCpu() ? "CPU" : deviceProperties.deviceName; }
+    // True once the batches run on the CPU engine, see cpuFallbackEnabled.
+    bool usingCpu() const { return onCpu; }
+    /*
+     Largest maxElementCount the device can take. Every storage buffer is bound whole, so it has to fit
+     in maxStorageBufferRange, and in maxMemoryAllocationSize where the device reports one. Set by init().
+     */
+    uint32_t deviceElementLimit() const { return elementLimit; }
+    // Invocations per workgroup `kernel` is dispatched with, as init() and autotune() chose them.
+    uint32_t workgroupSizeOf(Kernel kernel) const { return workgroupSizes[kernel]; }
+    // What the calling thread's stream measured, each stream plans its own splits.
+    const Throughput& throughputOf(Kernel kernel) const { return streams[streamIndex()]->throughput[kernel]; }
+    // Number of compute queues the batches are spread over, one per stream.
+    uint32_t streamCount() const { return (uint32_t)streams.size(); }
+    
+    // Fills `input` with reduced pseudo-random elements and prints the first result.
+    static void setupInputBuffer(duble_fe25519* input, uint32_t count);
+    // Fills `input` with valid signatures of a few keys and messages, repeated over the batch.
+    static void setupSignatureBuffer(ed25519_verify_input* input, uint32_t count);
+    void reportResult(const fe25519* output, uint32_t count);
+    
+    protected:
+    void initVulkan();
+    // Sets elementLimit from the limits of physicalDevice and throws when maxElementCount is above it.
+    void checkBufferLimits();
+    // Hands every later batch to a new CpuEngine, `reason` says why. Only the first call does anything.
+    void startCpuEngine(const std::string& reason);
+    /*
+     True when `result` is VK_ERROR_DEVICE_LOST and cpuFallbackEnabled, after the batches the stream
+     had in flight were finished on the CPU. Any other result is left to VK_CHECK_RESULT.
+     */
+    bool checkDeviceLost(VkResult result, Stream& stream);
+    /*
+     Once onCpu, sends the later batches of the stream to the CPU engine and finishes those its slots
+     still hold there. The other streams are moved by their own threads.
+     */
+    void moveToCpu(Stream& stream);
+    // The stream of the calling thread, assigned the first time it asks.
+    uint32_t streamIndex() const;
+    // The same, with its Vulkan objects created on first use.
+    Stream& currentStream();
+    // Command pools, timeline semaphore and slots of one stream.
+    void createStream(Stream& stream);
+    void destroyStream(Stream& stream);
+    // Submits to the stream's transfer queue, which it may share with other streams.
+    VkResult submitTransfer(Stream& stream, const VkSubmitInfo& submitInfo, VkFence fence);
 
     void createInstance();
+    // Destroys the debug messenger and the instance, whichever of them exist.
+    void destroyInstance();
+    // Serves every batch on the CpuEngine, init() has no device. `reason` says why.
+    void initCpuOnly(const std::string& reason);
     bool checkValidationLayerSupport();
     std::vector<const char*> getRequiredExtensions();
     void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo);
@@ -152,22 +784,87 @@ protected:
     void pickPhysicalDevice();
     bool isDeviceSuitable(VkPhysicalDevice device);
     void createLogicalDevice();
+    bool isDeviceExtensionSupported(const char* extensionName);
+    void createTimelineSemaphore(Stream& stream);
+    void chooseWorkgroupSize();
+    
+    // Starts one batch of `kernel`, inputSize and outputSize are the bytes of a single element.
+    BatchHandle submitKernel(Kernel kernel, const PushConstants& pushConstants, const void* input, uint32_t inputSize,
+                             void* output, uint32_t outputSize, const BatchHandle* after);
+    BatchHandle submitCpu(Stream& stream, Kernel kernel, const PushConstants& pushConstants, const void* input,
+                          uint32_t inputSize, void* output, const BatchHandle* after);
+    // Index into cpuBatches of the batch with this timeline value, -1 if it was already retired.
+    int findCpuBatch(Stream& stream, uint64_t value);
+    // Waits for cpuBatches[index] and runs its callback.
+    void retireCpuBatch(Stream& stream, size_t index);
     
     
     // Returns the index of a queue family that supports compute operations.
     uint32_t getComputeQueueFamilyIndex();
-    void createBuffer();
+    // Returns a transfer-only queue family if there is one, the compute family otherwise.
+    uint32_t getTransferQueueFamilyIndex();
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
+    void createBuffers(BatchSlot& slot);
     uint32_t findMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlags properties);
     void createInDescriptorSetLayout();
     void createOutDescriptorSetLayout();
-    void createDescriptorSet();
-    uint32_t* readFile(uint32_t& length, const char* filename);
+    void createDescriptorPool();
+    void createDescriptorSet(BatchSlot& slot);
+    void createBaseTable();
     void createComputePipeline();
-    void createCommandBuffer();
-    void runCommandBuffer();
+    // Creates pipelines[kernel] with workgroupSizes[kernel] and subgroupSizes[kernel].
+    void createKernelPipeline(Kernel kernel);
+    // pipelines[kernel], created on first use.
+    VkPipeline getPipeline(Kernel kernel);
+    void loadTuning();
+    void saveTuning();
+    // The valid bits of timestamps on queues of `family`, 0 if it has none.
+    uint64_t getTimestampMask(uint32_t family);
+    // Seconds between two timestamps of the slot's pool.
+    double timestampSeconds(const uint64_t* timestamps, TimestampQuery begin, uint64_t mask);
+    // Reads the slot's queries after its batch has completed, into the stream's lastBatchTimings and lastBatchStatistics.
+    void readQueries(BatchSlot& slot);
+    // Seconds the GPU takes for one batch of `kernel` over slot 0 of the stream, see autotune().
+    double timeKernel(Stream& stream, Kernel kernel, VkQueryPool queryPool, uint64_t timestampMask);
+    VkCommandBuffer beginSingleTimeCommands(Stream& stream);
+    void endSingleTimeCommands(Stream& stream, VkCommandBuffer commandBuffer);
+    void createCommandPools(Stream& stream);
+    void createCommandBuffer(BatchSlot& slot);
+    void recordCommandBuffer(BatchSlot& slot, Kernel kernel, const PushConstants& pushConstants,
+                             VkDeviceSize inSize, VkDeviceSize outSize);
+    // The pipeline, the descriptor sets and the dispatches of one batch of `kernel`.
+    void recordDispatch(VkCommandBuffer commandBuffer, BatchSlot& slot, Kernel kernel, const PushConstants& pushConstants);
+    void recordTransferCommandBuffers(BatchSlot& slot, VkDeviceSize inSize, VkDeviceSize outSize);
+    void recordOwnershipTransfer(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize size,
+                                 VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask,
+                                 VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask,
+                                 uint32_t srcQueueFamilyIndex, uint32_t dstQueueFamilyIndex);
+    void getDispatchSize(uint32_t count, uint32_t groupSize, uint32_t& groupCountX, uint32_t& groupCountY);
+    void runCommandBuffer(BatchSlot& slot, uint64_t waitValue);
+    void submitReadback(BatchSlot& slot);
+    // Waits for the slot's batch and copies its results to pendingOutput.
+    void retireSlot(BatchSlot& slot);
+    // Waits at most `timeout` nanoseconds for the slot's batch, both shares of it. Returns false on timeout.
+    bool waitSlot(BatchSlot& slot, uint64_t timeout);
+    // The same for the GPU's share only.
+    bool waitGpu(BatchSlot& slot, uint64_t timeout);
+    // Elements of a batch of `count` that go to the GPU with splitBatches, the rest runs on the CPU.
+    uint32_t gpuShare(Stream& stream, Kernel kernel, uint32_t count);
+    static bool isSplittable(Kernel kernel);
+    /*
+     Folds the shares of a retired slot into the stream's throughput[]. gpuSeconds is the host's wait from
+     submission to completion, 0 when the GPU's share had finished before the host looked.
+     */
+    void measureThroughput(BatchSlot& slot, double gpuSeconds);
+    // The slot holding the batch with this timeline value, NULL if it was already retired.
+    BatchSlot* findPendingSlot(Stream& stream, uint64_t value);
+    bool isComplete(const BatchHandle& handle);
+    bool waitFor(const BatchHandle& handle, uint64_t timeout);
+    void setCallback(const BatchHandle& handle, std::function<void()> callback);
+    // The stream a handle of this engine was submitted to.
+    Stream& streamOf(const BatchHandle& handle);
+    void destroySlot(BatchSlot& slot);
     void createDescriptorSetLayout();
-    void reportResult();
-    void setupInputBuffer();
 };
 
 
@@ -0,0 +1,428 @@
+//
+//  Benchmark.cpp
+//  TestingVulkan
+//
+//  Throughput of every kernel on every Vulkan device, on the CPU engine and of the CPU reference, as JSON.
+//
+
+#include "BaseApp.hpp"
+#include "fe25519_ref.hpp"
+#include "ge25519_ref.hpp"
+#include "ed25519_ref.hpp"
+#include "x25519_ref.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+
+typedef BaseApp::fe25519 fe25519;
+typedef BaseApp::duble_fe25519 duble_fe25519;
+typedef BaseApp::ed25519_verify_input ed25519_verify_input;
+
+/*
+ One kernel as the engine and the CPU reference run it. `gpu` starts one batch of `count` elements
+ on a BaseApp, on a device or on its CpuEngine. `cpu` does the same work with the reference code on
+ the calling thread, it is empty for kernels that only exist to change how a batch crosses the bus.
+ */
+struct KernelBenchmark {
+    std::string name;
+    std::function<BaseApp::BatchHandle(BaseApp& app, uint32_t count)> gpu;
+    std::function<void(uint32_t count)> cpu;
+};
+
+/*
+ One measurement, a batch size of one kernel. `stages` is the GPU time of an average batch,
+ `invocationsPerElement` how many compute shader invocations ran per element, 0 when unknown.
+ */
+struct Result {
+    std::string kernel;
+    uint32_t batchSize;
+    uint32_t batches;
+    double seconds;
+    BaseApp::BatchTimings stages;
+    double invocationsPerElement;
+};
+
+// A Vulkan device, the CPU engine or the CPU reference, with everything measured on it.
+struct Target {
+    std::string name;
+    std::string type;
+    int deviceIndex;
+    std::string error;
+    std::vector<Result> results;
+};
+
+class Benchmark {
+
+public:
+    /*
+     Every kernel is measured with batches of 1, 2, 4, ... 2^maxBatchLog2 elements, each size for
+     at least minSeconds. A kernel stops growing on a target once a single batch takes longer
+     than maxBatchSeconds, which keeps the slow CPU reference of the curve operations in check,
+     and a device stops at the largest batch its buffers can be bound for, see deviceElementLimit().
+     */
+    uint32_t maxBatchLog2 = 24;
+    double minSeconds = 0.2;
+    double maxBatchSeconds = 2.0;
+    // Engines are created with room for this many elements at first and grown with the sweep.
+    static const uint32_t INITIAL_CAPACITY = 1u << 12;
+
+    void run(const std::string& outputFile) {
+        prepareSignatures();
+        createKernels();
+
+        std::vector<Target> targets;
+        // Without a Vulkan loader or driver there are no devices, the CPU targets are still measured.
+        std::vector<std::string> devices;
+        try {
+            devices = BaseApp::listDevices();
+        } catch (const std::runtime_error& e) {
+            std::cout << "INFO: " << e.what() << std::endl;
+        }
+        for (uint32_t device = 0; device < devices.size(); ++device) {
+            targets.push_back(runEngine({devices[device], "vulkan", (int)device, "", {}}));
+        }
+        // The multithreaded CPU engine is the baseline the devices have to beat.
+        targets.push_back(runEngine({"CPU engine", "cpu", BaseApp::CPU_DEVICE, "", {}}));
+        targets.push_back(runCpu());
+
+        writeJson(outputFile, targets);
+        std::cout << "INFO: results written to " << outputFile << std::endl;
+    }
+
+private:
+    // Grown with the sweep by reserve(), only as far as some target gets.
+    std::vector<duble_fe25519> input;
+    std::vector<duble_fe25519> output;
+    // A few signatures, repeated to fill a batch of any size, see signatures().
+    std::vector<ed25519_verify_input> distinctSignatures;
+    std::vector<ed25519_verify_input> signatureBatch;
+    std::vector<KernelBenchmark> kernels;
+
+    void reserve(uint32_t count) {
+        if (input.size() >= count) {
+            return;
+        }
+        input.resize(count);
+        output.resize(count);
+        BaseApp::setupInputBuffer(input.data(), count);
+    }
+
+    // Where the kernels read and write, asked for on every batch as reserve() may move them.
+    const duble_fe25519* in() const { return input.data(); }
+    fe25519* out() { return &output[0].value[0]; }
+
+    static double secondsSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void prepareSignatures() {
+        for (uint32_t i = 0; i < 64; ++i) {
+            uint8_t seed[32], publicKey[32], secretKey[64], signature[64];
+            for (int j = 0; j < 32; ++j) {
+                seed[j] = (uint8_t)(i * 31 + j);
+            }
+            ed25519_ref_keypair(publicKey, secretKey, seed);
+            std::string message = "message " + std::to_string(i);
+            ed25519_ref_sign(signature, (const uint8_t*)message.data(), message.size(), secretKey);
+
+            ed25519_verify_input prepared;
+            ed25519_ref_prepare(prepared, signature, (const uint8_t*)message.data(), message.size(), publicKey);
+            distinctSignatures.push_back(prepared);
+        }
+    }
+
+    const ed25519_verify_input* signatures(uint32_t count) {
+        while (signatureBatch.size() < count) {
+            signatureBatch.push_back(distinctSignatures[signatureBatch.size() % distinctSignatures.size()]);
+        }
+        return signatureBatch.data();
+    }
+
+    /*
+     The layout and format variants read the same pseudo-random words as ints or bytes, which
+     are valid inputs for them too. Scalars are the fe25519 halves of the input one after another.
+     */
+    void createKernels() {
+        for (int op = 0; op < BaseApp::FE_OP_COUNT; ++op) {
+            BaseApp::FieldOp fieldOp = (BaseApp::FieldOp)op;
+            kernels.push_back({
+                std::string("fe25519_") + BaseApp::fieldOpName(fieldOp),
+                [=](BaseApp& app, uint32_t count) { return app.submitAsync(fieldOp, in(), out(), count, NULL, 1); },
+                [=](uint32_t count) { fe25519_ref_run(fieldOp, 1, in(), out(), count, 64); }
+            });
+        }
+        kernels.push_back({
+            "fe25519_mul_soa",
+            [=](BaseApp& app, uint32_t count) { return app.submitSoAAsync(BaseApp::FE_MUL, (const int*)in(), (int*)out(), count); },
+            nullptr
+        });
+        kernels.push_back({
+            "fe25519_mul_bytes",
+            [=](BaseApp& app, uint32_t count) { return app.submitBytesAsync(BaseApp::FE_MUL, (const uint8_t*)in(), (uint8_t*)out(), count); },
+            nullptr
+        });
+        kernels.push_back({
+            "fe25519_transpose",
+            [=](BaseApp& app, uint32_t count) {
+                return app.transposeAsync(BaseApp::LAYOUT_SOA, (const int*)in(), (int*)out(), count, BaseApp::DUBLE_FE25519_WIDTH);
+            },
+            [=](uint32_t count) { BaseApp::packSoA(in(), (int*)out(), count); }
+        });
+        kernels.push_back({
+            "ed25519_verify",
+            [=](BaseApp& app, uint32_t count) { return app.verifyAsync(signatures(count), (uint32_t*)out(), count); },
+            [=](uint32_t count) {
+                const ed25519_verify_input* batch = signatures(count);
+                uint32_t* verdicts = (uint32_t*)out();
+                for (uint32_t i = 0; i < count; ++i) {
+                    verdicts[i] = ed25519_ref_verify(batch[i]) ? 1 : 0;
+                }
+            }
+        });
+        kernels.push_back({
+            "x25519",
+            [=](BaseApp& app, uint32_t count) { return app.x25519Async(in(), out(), count); },
+            [=](uint32_t count) { x25519_ref_run(in(), out(), count); }
+        });
+        kernels.push_back({
+            "ge25519_scalarmult_base",
+            [=](BaseApp& app, uint32_t count) { return app.scalarmultBaseAsync(&in()[0].value[0], out(), count); },
+            [=](uint32_t count) {
+                const fe25519* scalars = &in()[0].value[0];
+                fe25519* points = out();
+                for (uint32_t i = 0; i < count; ++i) {
+                    points[i] = ge25519_ref_p3_tobytes(ge25519_ref_scalarmult_base(scalars[i]));
+                }
+            }
+        });
+    }
+
+    /*
+     Streams batches through the engine's slot ring for at least minSeconds, so uploads, dispatches
+     and readbacks overlap the way they do for a real caller. The result is end to end throughput.
+     */
+    Result measureGpu(BaseApp& app, const KernelBenchmark& kernel, uint32_t count) {
+        // One batch on its own, to create the pipeline and record the command buffers.
+        auto start = std::chrono::steady_clock::now();
+        kernel.gpu(app, count).wait();
+        app.pollCompletions();
+        double first = secondsSince(start);
+
+        Result result = {kernel.name, count, 0, 0};
+        if (first > maxBatchSeconds) {
+            result.batches = 1;
+            result.seconds = first;
+            result.stages = app.lastTimings();
+            if (app.lastStatistics().elements != 0) {
+                result.invocationsPerElement = (double)app.lastStatistics().invocations / app.lastStatistics().elements;
+            }
+            return result;
+        }
+
+        app.resetTimings();
+        start = std::chrono::steady_clock::now();
+        BaseApp::BatchHandle last;
+        do {
+            last = kernel.gpu(app, count);
+            result.batches += 1;
+            app.pollCompletions();
+        } while (secondsSince(start) < minSeconds);
+        last.wait();
+        app.pollCompletions();
+        result.seconds = secondsSince(start);
+
+        uint64_t timed = std::max(app.timedBatches(), (uint64_t)1);
+        result.stages.upload = app.totalTimings().upload / timed;
+        result.stages.compute = app.totalTimings().compute / timed;
+        result.stages.readback = app.totalTimings().readback / timed;
+        if (app.totalStatistics().elements != 0) {
+            result.invocationsPerElement = (double)app.totalStatistics().invocations / app.totalStatistics().elements;
+        }
+        return result;
+    }
+
+    Result measureCpu(const KernelBenchmark& kernel, uint32_t count) {
+        Result result = {kernel.name, count, 0, 0};
+        auto start = std::chrono::steady_clock::now();
+        do {
+            kernel.cpu(count);
+            result.batches += 1;
+        } while (secondsSince(start) < minSeconds);
+        result.seconds = secondsSince(start);
+        return result;
+    }
+
+    /*
+     The engine is created again whenever the sweep outgrows it, so small batches are measured
+     without the cost of buffers sized for 2^maxBatchLog2 elements. The sweep of a device ends
+     at the largest batch it can bind; one that fails to hold a size ends there, with the reason
+     in `error`. target.deviceIndex is the device, or BaseApp::CPU_DEVICE for the CPU engine.
+     */
+    Target runEngine(Target target) {
+        std::cout << "INFO: benchmarking " << target.name << std::endl;
+
+        std::unique_ptr<BaseApp> app;
+        uint32_t capacity = 0;
+        uint32_t limit = UINT32_MAX;
+        std::vector<bool> done(kernels.size(), false);
+        try {
+            for (uint32_t log2 = 0; log2 <= maxBatchLog2; ++log2) {
+                uint32_t count = 1u << log2;
+                if (count > limit) {
+                    std::cout << "INFO: " << target.name << " binds at most " << limit
+                              << " elements per batch, its sweep ends there" << std::endl;
+                    break;
+                }
+                if (count > capacity) {
+                    if (app) {
+                        app->cleanup();
+                    }
+                    capacity = std::min(std::max(count, INITIAL_CAPACITY), limit);
+                    app.reset(new BaseApp());
+                    app->deviceIndex = target.deviceIndex;
+                    app->pipelineStatisticsEnabled = true;
+                    // A lost device is an error here, its numbers must not come from the CPU.
+                    app->cpuFallbackEnabled = false;
+                    app->init(capacity, 2);
+                    limit = app->deviceElementLimit();
+                }
+                reserve(count);
+                for (size_t k = 0; k < kernels.size(); ++k) {
+                    if (done[k]) {
+                        continue;
+                    }
+                    Result result = measureGpu(*app, kernels[k], count);
+                    done[k] = result.seconds / result.batches > maxBatchSeconds;
+                    target.results.push_back(result);
+                }
+            }
+            app->cleanup();
+        } catch (const std::exception& e) {
+            target.error = e.what();
+            std::cout << "ERROR: " << target.name << ": " << e.what() << std::endl;
+            // The engine may be half created. What it holds is released, so the next target gets the whole machine.
+            if (app) {
+                try {
+                    app->cleanup();
+                } catch (const std::exception& cleanupError) {
+                    std::cout << "ERROR: " << target.name << ": " << cleanupError.what() << std::endl;
+                }
+            }
+        }
+        return target;
+    }
+
+    Target runCpu() {
+        Target target = {"CPU reference", "reference", -1, "", {}};
+        std::cout << "INFO: benchmarking the single-threaded CPU reference" << std::endl;
+
+        for (const KernelBenchmark& kernel : kernels) {
+            if (!kernel.cpu) {
+                continue;
+            }
+            for (uint32_t log2 = 0; log2 <= maxBatchLog2; ++log2) {
+                reserve(1u << log2);
+                Result result = measureCpu(kernel, 1u << log2);
+                target.results.push_back(result);
+                if (result.seconds / result.batches > maxBatchSeconds) {
+                    break;
+                }
+            }
+        }
+        return target;
+    }
+
+    static std::string jsonString(const std::string& s) {
+        std::ostringstream out;
+        out << '"';
+        for (char c : s) {
+            if (c == '"' || c == '\\') {
+                out << '\\' << c;
+            } else if ((unsigned char)c < 0x20) {
+                out << "\\u00" << "0123456789abcdef"[(c >> 4) & 0xf] << "0123456789abcdef"[c & 0xf];
+            } else {
+                out << c;
+            }
+        }
+        out << '"';
+        return out.str();
+    }
+
+    /*
+     {"maxBatchLog2": .., "minSeconds": .., "targets": [{"name", "type" ("vulkan", "cpu" for the
+     CPU engine or "reference"), "deviceIndex", "error", "results": [{"kernel", "batchSize", "batches",
+     "seconds", "elementsPerSecond", "nsPerElement", "uploadSeconds", "computeSeconds", "readbackSeconds",
+     "invocationsPerElement"}]}]}
+     The stage times are the GPU time of an average batch. The CPU engine has only a compute time,
+     the wall time of its batch, and the reference none. The invocations are 0 on both, and on
+     devices without pipeline statistics.
+     */
+    void writeJson(const std::string& path, const std::vector<Target>& targets) {
+        std::ofstream out(path);
+        if (!out) {
+            throw std::runtime_error("failed to open the benchmark output file!");
+        }
+        out.precision(6);
+        out << "{\n  \"maxBatchLog2\": " << maxBatchLog2 << ",\n  \"minSeconds\": " << minSeconds << ",\n  \"targets\": [";
+        for (size_t t = 0; t < targets.size(); ++t) {
+            const Target& target = targets[t];
+            out << (t == 0 ? "\n" : ",\n") << "    {\n"
+                << "      \"name\": " << jsonString(target.name) << ",\n"
+                << "      \"type\": " << jsonString(target.type) << ",\n"
+                << "      \"deviceIndex\": " << target.deviceIndex << ",\n"
+                << "      \"error\": " << jsonString(target.error) << ",\n"
+                << "      \"results\": [";
+            for (size_t r = 0; r < target.results.size(); ++r) {
+                const Result& result = target.results[r];
+                double elements = (double)result.batchSize * result.batches;
+                out << (r == 0 ? "\n" : ",\n") << "        {\"kernel\": " << jsonString(result.kernel)
+                    << ", \"batchSize\": " << result.batchSize
+                    << ", \"batches\": " << result.batches
+                    << ", \"seconds\": " << result.seconds
+                    << ", \"elementsPerSecond\": " << elements / result.seconds
+                    << ", \"nsPerElement\": " << result.seconds * 1e9 / elements
+                    << ", \"uploadSeconds\": " << result.stages.upload
+                    << ", \"computeSeconds\": " << result.stages.compute
+                    << ", \"readbackSeconds\": " << result.stages.readback
+                    << ", \"invocationsPerElement\": " << result.invocationsPerElement << "}";
+            }
+            out << "\n      ]\n    }";
+        }
+        out << "\n  ]\n}\n";
+    }
+};
+
+
+int main(int argc, char* argv[]) {
+
+    Benchmark benchmark;
+
+    try {
+        /*
+         The output file, the largest batch as a power of two and the least time spent on
+         each batch size can be given on the command line.
+         */
+        std::string outputFile = "benchmark.json";
+        if (argc > 1) {
+            outputFile = argv[1];
+        }
+        if (argc > 2) {
+            benchmark.maxBatchLog2 = std::min((uint32_t)std::stoul(argv[2]), 24u);
+        }
+        if (argc > 3) {
+            benchmark.minSeconds = std::stod(argv[3]);
+        }
+        benchmark.run(outputFile);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -8,26 +8,480 @@
 
 #include "ComputeMain.hpp"
 #include "BaseApp.hpp"
+#include "fe25519_ref.hpp"
+#include "ed25519_ref.hpp"
+#include "x25519_ref.hpp"
+#include "MultiDeviceEngine.hpp"
 #include <iostream>
+#include <string>
+#include <algorithm>
+#include <thread>
+#include <atomic>
 
 class ComputeMain : public BaseApp {
 
 public:
-    void run () {
-        initVulkan();
+    /*
+     The engine is brought up once and then serves `batchCount` multiplication batches.
+     They are streamed through the slot ring, so uploads, dispatches and readbacks overlap.
+     Afterwards every field operation is checked once against the CPU reference,
+     the SoA kernel and the transpose against the AoS path, the 32-byte format against the limbs,
+     a batch of signatures goes through the verification kernel, a batch of
+     key exchanges through the X25519 kernel and a batch of public keys through
+     the fixed-base kernel.
+     */
+    void run (uint32_t elementCount, uint32_t batchCount, uint32_t workgroupSize, bool tune) {
+        pipelineStatisticsEnabled = true;
+        init(elementCount, 3, workgroupSize);
+        if (tune) {
+            autotune();
+        }
+        
+        std::vector<duble_fe25519> input(elementCount);
+        std::vector<fe25519> output(elementCount);
+        setupInputBuffer(input.data(), elementCount);
+        
+        uint32_t completed = 0;
+        BatchHandle last;
+        for (uint32_t batch = 0; batch < batchCount; ++batch) {
+            last = submitAsync(FE_MUL, input.data(), output.data(), elementCount);
+            last.then([&completed]() { completed += 1; });
+            pollCompletions();
+        }
+        // Batches complete in order, once the last one is done the rest only need retiring.
+        if (last.valid()) {
+            last.wait();
+        }
+        pollCompletions();
+        std::cout << "INFO: " << completed << " of " << batchCount << " batches completed" << std::endl;
+        if (timedBatches() != 0) {
+            std::cout << "INFO: " << (usingCpu() ? "CPU" : "GPU") << " time per batch: upload " << totalTimings().upload * 1e6 / timedBatches()
+                      << " us, compute " << totalTimings().compute * 1e6 / timedBatches()
+                      << " us, readback " << totalTimings().readback * 1e6 / timedBatches() << " us" << std::endl;
+        }
+        // The invocations beyond the elements only pad the last workgroup of each batch.
+        if (totalStatistics().elements != 0) {
+            std::cout << "INFO: " << totalStatistics().invocations << " compute shader invocations for "
+                      << totalStatistics().elements << " elements, "
+                      << 100.0 * (totalStatistics().invocations - totalStatistics().elements) / totalStatistics().elements
+                      << "% padding" << std::endl;
+        }
+        if (splitBatches) {
+            const Throughput& t = throughputOf(KERNEL_FIELD);
+            std::cout << "INFO: measured " << t.gpuElementsPerSecond << " elements/s on the GPU with "
+                      << t.gpuLatency * 1e6 << " us latency, " << t.cpuElementsPerSecond << " elements/s on the CPU" << std::endl;
+        }
+        reportResult(output.data(), elementCount);
+        
+        uint32_t mismatches = 0;
+        for (int op = 0; op < FE_OP_COUNT; ++op) {
+            mismatches += checkAgainstReference((FieldOp)op, input, output);
+        }
+        mismatches += checkLayouts(input);
+        mismatches += checkEncodings(FE_MUL, input);
+        mismatches += checkEncodings(FE_SUB, input);
+        mismatches += checkSignatures(std::min(elementCount, 64u));
+        mismatches += checkKeyExchange(input, output);
+        mismatches += checkScalarmultBase(std::min(elementCount, 64u));
+        
+        cleanup();
+        
+        if (mismatches != 0) {
+            throw std::runtime_error("GPU results differ from the CPU reference!");
+        }
     }
     
+    /*
+     Runs `op` on the GPU and on the CPU over the same batch and compares the results bit for bit.
+     The CPU side is slow for invert and pow22523, so at most 256 elements are checked.
+     */
+    uint32_t checkAgainstReference(FieldOp op, const std::vector<duble_fe25519>& input, std::vector<fe25519>& output) {
+        uint32_t count = std::min((uint32_t)input.size(), 256u);
+        uint32_t selector = 1;
+        
+        submit(op, input.data(), output.data(), count, selector);
+        std::vector<fe25519> expected(count);
+        fe25519_ref_run(op, selector, input.data(), expected.data(), count, workgroupSizes[KERNEL_BATCH_INVERT]);
+        
+        uint32_t mismatches = 0;
+        for (uint32_t i = 0; i < count; ++i) {
+            if (memcmp(&output[i], &expected[i], sizeof(fe25519)) != 0) {
+                mismatches += 1;
+            }
+        }
+        if (mismatches == 0) {
+            std::cout << "INFO: fe25519_" << fieldOpName(op) << " matches the CPU reference on " << count << " elements" << std::endl;
+        } else {
+            std::cout << "ERROR: fe25519_" << fieldOpName(op) << " differs from the CPU reference on " << mismatches << " of " << count << " elements" << std::endl;
+        }
+        return mismatches;
+    }
+    
+    /*
+     Transposes the input on the GPU and checks it against packSoA(), then runs FE_MUL on the
+     SoA batch and checks the unpacked results against the AoS kernel and the way back.
+     */
+    uint32_t checkLayouts(const std::vector<duble_fe25519>& input) {
+        uint32_t count = std::min((uint32_t)input.size(), 256u);
+        
+        std::vector<int> packed(count * DUBLE_FE25519_WIDTH);
+        std::vector<int> transposed(count * DUBLE_FE25519_WIDTH);
+        packSoA(input.data(), packed.data(), count);
+        transpose(LAYOUT_SOA, input[0].value[0].value, transposed.data(), count, DUBLE_FE25519_WIDTH);
+        uint32_t mismatches = packed == transposed ? 0 : 1;
+        
+        std::vector<fe25519> expected(count);
+        std::vector<int> soaOutput(count * FE25519_WIDTH);
+        std::vector<fe25519> output(count);
+        submit(FE_MUL, input.data(), expected.data(), count);
+        submitSoA(FE_MUL, packed.data(), soaOutput.data(), count);
+        unpackSoA(soaOutput.data(), output.data(), count);
+        for (uint32_t i = 0; i < count; ++i) {
+            if (memcmp(&output[i], &expected[i], sizeof(fe25519)) != 0) {
+                mismatches += 1;
+            }
+        }
+        
+        std::vector<fe25519> roundTrip(count);
+        transpose(LAYOUT_AOS, soaOutput.data(), roundTrip[0].value, count, FE25519_WIDTH);
+        if (memcmp(roundTrip.data(), expected.data(), count * sizeof(fe25519)) != 0) {
+            mismatches += 1;
+        }
+        if (mismatches == 0) {
+            std::cout << "INFO: the SoA layout matches the AoS layout on " << count << " elements" << std::endl;
+        } else {
+            std::cout << "ERROR: the SoA layout differs from the AoS layout on " << mismatches << " checks" << std::endl;
+        }
+        return mismatches;
+    }
+    
+    /*
+     Encodes both operands on the CPU, runs `op` on the 32-byte encodings and checks the results
+     against the CPU reference on the decoded operands, encoded again.
+     */
+    uint32_t checkEncodings(FieldOp op, const std::vector<duble_fe25519>& input) {
+        uint32_t count = std::min((uint32_t)input.size(), 256u);
+        
+        std::vector<uint8_t> packed(count * 2 * FE25519_BYTES);
+        std::vector<duble_fe25519> decoded(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            for (int k = 0; k < 2; ++k) {
+                fe25519 s = fe25519_ref_tobytes(input[i].value[k]);
+                memcpy(&packed[(2 * i + k) * FE25519_BYTES], s.value, FE25519_BYTES);
+                decoded[i].value[k] = fe25519_ref_frombytes(s);
+            }
+        }
+        std::vector<fe25519> expected(count);
+        fe25519_ref_run(op, 0, decoded.data(), expected.data(), count, workgroupSizes[KERNEL_BATCH_INVERT]);
+        
+        std::vector<uint8_t> output(count * FE25519_BYTES);
+        submitBytes(op, packed.data(), output.data(), count);
+        
+        uint32_t mismatches = 0;
+        for (uint32_t i = 0; i < count; ++i) {
+            fe25519 s = fe25519_ref_tobytes(expected[i]);
+            if (memcmp(&output[i * FE25519_BYTES], s.value, FE25519_BYTES) != 0) {
+                mismatches += 1;
+            }
+        }
+        if (mismatches == 0) {
+            std::cout << "INFO: fe25519_" << fieldOpName(op) << " on 32-byte encodings matches the CPU reference on " << count << " elements" << std::endl;
+        } else {
+            std::cout << "ERROR: fe25519_" << fieldOpName(op) << " on 32-byte encodings differs on " << mismatches << " of " << count << " elements" << std::endl;
+        }
+        return mismatches;
+    }
+    
+    /*
+     Signs `count` messages on the CPU and spoils every fourth signature in a different way:
+     the message, R, S or the public key. The verdicts of the GPU have to match both what
+     was done to the signatures and ed25519_ref_verify.
+     */
+    uint32_t checkSignatures(uint32_t count) {
+        std::vector<ed25519_verify_input> input(count);
+        std::vector<uint32_t> expected(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            uint8_t seed[32], publicKey[32], secretKey[64], signature[64];
+            for (int j = 0; j < 32; ++j) {
+                seed[j] = (uint8_t)(i * 31 + j);
+            }
+            ed25519_ref_keypair(publicKey, secretKey, seed);
+            
+            std::string message = "message " + std::to_string(i);
+            ed25519_ref_sign(signature, (const uint8_t*)message.data(), message.size(), secretKey);
+            
+            expected[i] = 1;
+            if (i % 4 == 3) {
+                expected[i] = 0;
+                switch ((i / 4) % 4) {
+                    case 0: message[0] ^= 1; break;
+                    case 1: signature[0] ^= 1; break;
+                    case 2: signature[32] ^= 1; break;
+                    case 3: publicKey[0] ^= 1; break;
+                }
+            }
+            ed25519_ref_prepare(input[i], signature, (const uint8_t*)message.data(), message.size(), publicKey);
+        }
+        
+        std::vector<uint32_t> verdicts(count);
+        verify(input.data(), verdicts.data(), count);
+        
+        uint32_t mismatches = 0;
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t reference = ed25519_ref_verify(input[i]) ? 1 : 0;
+            if (verdicts[i] != expected[i] || reference != expected[i]) {
+                mismatches += 1;
+            }
+        }
+        if (mismatches == 0) {
+            std::cout << "INFO: ed25519_verify gives the expected verdict on " << count << " signatures" << std::endl;
+        } else {
+            std::cout << "ERROR: ed25519_verify gives the wrong verdict on " << mismatches << " of " << count << " signatures" << std::endl;
+        }
+        return mismatches;
+    }
+    
+    /*
+     The pseudo-random input doubles as scalars and u-coordinates, with the first element
+     replaced by the first test vector of RFC 7748. The shared secrets have to match the CPU ladder.
+     */
+    uint32_t checkKeyExchange(std::vector<duble_fe25519>& input, std::vector<fe25519>& output) {
+        uint32_t count = std::min((uint32_t)input.size(), 64u);
+        
+        // a546e36b... and e6db6867... as little endian words.
+        static const uint32_t scalar[8] = {0x6be346a5, 0x9d7c52f0, 0x4b15163b, 0xdd5e4682,
+                                           0x0a4c1462, 0x185afcc1, 0x44226a50, 0xc49a44ba};
+        static const uint32_t u[8] = {0x6768dbe6, 0xdb303058, 0xa4c19435, 0x7c5fb124,
+                                      0xec246672, 0x3b35b326, 0xa603a910, 0x4c1cabd0};
+        duble_fe25519 saved = input[0];
+        input[0].value[0] = fe25519_ref_zero();
+        input[0].value[1] = fe25519_ref_zero();
+        memcpy(input[0].value[0].value, scalar, sizeof(scalar));
+        memcpy(input[0].value[1].value, u, sizeof(u));
+        
+        x25519(input.data(), output.data(), count);
+        std::vector<fe25519> expected(count);
+        x25519_ref_run(input.data(), expected.data(), count);
+        input[0] = saved;
+        
+        // c3da5537..., the output given in RFC 7748.
+        static const uint32_t secret[8] = {0x3755dac3, 0x90c6e99d, 0x4dea948e, 0x4f088df2,
+                                           0x03cfec32, 0xf7711c49, 0x5507b454, 0x5285a277};
+        uint32_t mismatches = memcmp(output[0].value, secret, sizeof(secret)) == 0 ? 0 : 1;
+        for (uint32_t i = 0; i < count; ++i) {
+            if (memcmp(&output[i], &expected[i], sizeof(fe25519)) != 0) {
+                mismatches += 1;
+            }
+        }
+        if (mismatches == 0) {
+            std::cout << "INFO: x25519 matches RFC 7748 and the CPU reference on " << count << " elements" << std::endl;
+        } else {
+            std::cout << "ERROR: x25519 differs from the expected result on " << mismatches << " of " << count << " elements" << std::endl;
+        }
+        return mismatches;
+    }
+    
+    /*
+     Derives public keys the way ed25519_ref_keypair does, but with the multiplication on the GPU.
+     The first seed is the one of RFC 8032 test 1, so its key is known.
+     */
+    uint32_t checkScalarmultBase(uint32_t count) {
+        std::vector<fe25519> scalars(count);
+        std::vector<fe25519> points(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            uint8_t seed[32], az[64];
+            for (int j = 0; j < 32; ++j) {
+                seed[j] = (uint8_t)(i * 31 + j);
+            }
+            if (i == 0) {
+                memcpy(seed, rfc8032Seed, 32);
+            }
+            sha512_ref(seed, 32, az);
+            az[0] &= 248;
+            az[31] &= 127;
+            az[31] |= 64;
+            scalars[i] = fe25519_ref_zero();
+            memcpy(scalars[i].value, az, 32);
+        }
+        
+        scalarmultBase(scalars.data(), points.data(), count);
+        
+        uint32_t mismatches = memcmp(points[0].value, rfc8032PublicKey, 32) == 0 ? 0 : 1;
+        for (uint32_t i = 0; i < count; ++i) {
+            fe25519 expected = ge25519_ref_p3_tobytes(ge25519_ref_scalarmult_base(scalars[i]));
+            if (memcmp(&points[i], &expected, sizeof(fe25519)) != 0) {
+                mismatches += 1;
+            }
+        }
+        if (mismatches == 0) {
+            std::cout << "INFO: ge25519_scalarmult_base matches RFC 8032 and the CPU reference on " << count << " scalars" << std::endl;
+        } else {
+            std::cout << "ERROR: ge25519_scalarmult_base differs from the expected key on " << mismatches << " of " << count << " scalars" << std::endl;
+        }
+        return mismatches;
+    }
+    
+    // RFC 8032, section 7.1, test 1.
+    const uint8_t rfc8032Seed[32] = {
+        0x9d, 0x61, 0xb1, 0x9d, 0xef, 0xfd, 0x5a, 0x60, 0xba, 0x84, 0x4a, 0xf4, 0x92, 0xec, 0x2c, 0xc4,
+        0x44, 0x49, 0xc5, 0x69, 0x7b, 0x32, 0x69, 0x19, 0x70, 0x3b, 0xac, 0x03, 0x1c, 0xae, 0x7f, 0x60
+    };
+    const uint8_t rfc8032PublicKey[32] = {
+        0xd7, 0x5a, 0x98, 0x01, 0x82, 0xb1, 0x0a, 0xb7, 0xd5, 0x4b, 0xfe, 0xd3, 0xc9, 0x64, 0x07, 0x3a,
+        0x0e, 0xe1, 0x72, 0xf3, 0xda, 0xa6, 0x23, 0x25, 0xaf, 0x02, 0x1a, 0x68, 0xf7, 0x07, 0x51, 0x1a
+    };
+    
 };
 
 
-int main() {
+/*
+ With --all-devices, every field operation and X25519 are run sharded over all devices by
+ MultiDeviceEngine and checked against the CPU reference, so the shards have to come back in
+ input order. FE_BATCH_INVERT is left out, it is not sharded and its limbs depend on the workgroup size.
+ */
+static void checkAllDevices(uint32_t elementCount, uint32_t workgroupSize) {
+    typedef BaseApp::fe25519 fe25519;
+    typedef BaseApp::duble_fe25519 duble_fe25519;
+    
+    MultiDeviceEngine engine;
+    engine.init(elementCount, 3, workgroupSize);
+    
+    uint32_t count = std::min(elementCount, 4096u);
+    std::vector<duble_fe25519> input(count);
+    std::vector<fe25519> output(count);
+    std::vector<fe25519> expected(count);
+    BaseApp::setupInputBuffer(input.data(), count);
+    
+    uint32_t devices = engine.deviceCount();
+    uint32_t mismatches = 0;
+    for (int op = 0; op < BaseApp::FE_BATCH_INVERT; ++op) {
+        engine.submit((BaseApp::FieldOp)op, input.data(), output.data(), count, 1);
+        fe25519_ref_run((BaseApp::FieldOp)op, 1, input.data(), expected.data(), count, workgroupSize);
+        if (memcmp(output.data(), expected.data(), count * sizeof(fe25519)) != 0) {
+            std::cout << "ERROR: fe25519_" << BaseApp::fieldOpName((BaseApp::FieldOp)op) << " differs when sharded over "
+                      << devices << " devices" << std::endl;
+            mismatches += 1;
+        }
+    }
+    engine.x25519(input.data(), output.data(), count);
+    x25519_ref_run(input.data(), expected.data(), count);
+    if (memcmp(output.data(), expected.data(), count * sizeof(fe25519)) != 0) {
+        std::cout << "ERROR: x25519 differs when sharded over " << devices << " devices" << std::endl;
+        mismatches += 1;
+    }
+    engine.cleanup();
+    
+    if (mismatches != 0) {
+        throw std::runtime_error("sharded results differ from the CPU reference!");
+    }
+    std::cout << "INFO: every operation matches the CPU reference on " << count << " elements sharded over "
+              << devices << " devices" << std::endl;
+}
+
+/*
+ With --threads, one thread per compute queue, and at least two, runs `batchCount` batches of a field
+ operation of its own through a single engine and checks every one against the CPU reference,
+ so each thread must get back its own results while the others submit.
+ */
+static void checkThreads(uint32_t elementCount, uint32_t batchCount, uint32_t workgroupSize) {
+    typedef BaseApp::fe25519 fe25519;
+    typedef BaseApp::duble_fe25519 duble_fe25519;
+    
+    BaseApp app;
+    app.init(elementCount, 3, workgroupSize);
+    
+    std::vector<duble_fe25519> input(elementCount);
+    BaseApp::setupInputBuffer(input.data(), elementCount);
+    
+    uint32_t threadCount = std::max(2u, app.streamCount());
+    std::atomic<uint32_t> mismatches{0};
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&, t]() {
+            BaseApp::FieldOp op = (BaseApp::FieldOp)(t % BaseApp::FE_BATCH_INVERT);
+            std::vector<fe25519> output(elementCount);
+            std::vector<fe25519> expected(elementCount);
+            fe25519_ref_run(op, 1, input.data(), expected.data(), elementCount, workgroupSize);
+            try {
+                for (uint32_t batch = 0; batch < batchCount; ++batch) {
+                    memset(output.data(), 0, elementCount * sizeof(fe25519));
+                    app.submit(op, input.data(), output.data(), elementCount, 1);
+                    if (memcmp(output.data(), expected.data(), elementCount * sizeof(fe25519)) != 0) {
+                        std::cout << "ERROR: fe25519_" << BaseApp::fieldOpName(op) << " of thread " << t
+                                  << " differs in batch " << batch << std::endl;
+                        mismatches += 1;
+                        return;
+                    }
+                }
+            } catch (const std::exception& e) {
+                std::cout << "ERROR: thread " << t << ": " << e.what() << std::endl;
+                mismatches += 1;
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    uint32_t streams = app.streamCount();
+    app.cleanup();
+    
+    if (mismatches != 0) {
+        throw std::runtime_error("results differ when submitted from several threads!");
+    }
+    std::cout << "INFO: " << threadCount << " threads each got " << batchCount << " correct batches over "
+              << streams << " streams" << std::endl;
+}
+
+
+int main(int argc, char* argv[]) {
     
     ComputeMain app;
     
     try {
-        app.inBufferSize = sizeof(BaseApp::duble_fe25519) * WORK_TOTAL_SIZE;
-        app.outBufferSize = sizeof(BaseApp::fe25519) * WORK_TOTAL_SIZE;
-        app.run();
+        /*
+         The batch size, number of batches and workgroup size can be given on the command line.
+         With --autotune at the end, the workgroup sizes are tuned for this device first.
+         With --split, every batch is shared between the GPU and the CPU, see BaseApp::splitBatches.
+         With --all-devices, the batches are sharded over every device instead, see checkAllDevices().
+         With --threads, several threads submit to one engine at once, see checkThreads().
+         */
+        bool tune = false;
+        bool allDevices = false;
+        bool threads = false;
+        while (argc > 1) {
+            std::string flag = argv[argc - 1];
+            if (flag == "--autotune") {
+                tune = true;
+            } else if (flag == "--split") {
+                app.splitBatches = true;
+            } else if (flag == "--all-devices") {
+                allDevices = true;
+            } else if (flag == "--threads") {
+                threads = true;
+            } else {
+                break;
+            }
+            argc -= 1;
+        }
+        uint32_t elementCount = 256;
+        uint32_t batchCount = 1;
+        uint32_t workgroupSize = 64;
+        if (argc > 1) {
+            elementCount = (uint32_t)std::stoul(argv[1]);
+        }
+        if (argc > 2) {
+            batchCount = (uint32_t)std::stoul(argv[2]);
+        }
+        if (argc > 3) {
+            workgroupSize = (uint32_t)std::stoul(argv[3]);
+        }
+        if (allDevices) {
+            checkAllDevices(elementCount, workgroupSize);
+        } else if (threads) {
+            checkThreads(elementCount, batchCount, workgroupSize);
+        } else {
+            app.run(elementCount, batchCount, workgroupSize, tune);
+        }
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
         return EXIT_FAILURE;
@@ -0,0 +1,199 @@
+//
+//  CpuEngine.cpp
+//  TestingVulkan
+//
+
+#include "CpuEngine.hpp"
+#include "fe25519_ref.hpp"
+#include "ed25519_ref.hpp"
+#include "x25519_ref.hpp"
+#include "ge25519_ref.hpp"
+#include <algorithm>
+#include <cstring>
+
+bool CpuJob::done() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return complete;
+}
+
+bool CpuJob::wait(uint64_t timeout) const {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (timeout == UINT64_MAX) {
+        finished.wait(lock, [this]() { return complete; });
+        return true;
+    }
+    return finished.wait_for(lock, std::chrono::nanoseconds(timeout), [this]() { return complete; });
+}
+
+double CpuJob::seconds() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return std::chrono::duration<double>(endTime - startTime).count();
+}
+
+std::exception_ptr CpuJob::error() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return firstError;
+}
+
+void CpuJob::finishRange(std::exception_ptr rangeError) {
+    if (rangeError) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!firstError) {
+            firstError = rangeError;
+        }
+    }
+    if (--remainingRanges != 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        endTime = std::chrono::steady_clock::now();
+        complete = true;
+    }
+    finished.notify_all();
+}
+
+CpuEngine::CpuEngine(uint32_t threadCount) : pool(threadCount) {
+}
+
+uint32_t CpuEngine::rangeSize(BaseApp::Kernel kernel, uint32_t count) const {
+    if (kernel == BaseApp::KERNEL_BATCH_INVERT) {
+        return count;
+    }
+    uint32_t ranges = 4 * threadCount();
+    return std::max(64u, (count + ranges - 1) / ranges);
+}
+
+std::shared_ptr<CpuJob> CpuEngine::start(BaseApp::Kernel kernel, const BaseApp::PushConstants& pushConstants,
+                                         const void* input, uint32_t inputSize, void* output, uint32_t workgroupSize) {
+    uint32_t count = pushConstants.elementCount;
+    std::shared_ptr<CpuJob> job = std::make_shared<CpuJob>();
+    job->input.resize((size_t)inputSize * count);
+    memcpy(job->input.data(), input, job->input.size());
+    job->startTime = std::chrono::steady_clock::now();
+
+    uint32_t size = rangeSize(kernel, count);
+    job->remainingRanges = (count + size - 1) / size;
+    uint8_t* out = (uint8_t*)output;
+    for (uint32_t begin = 0; begin < count; begin += size) {
+        uint32_t end = std::min(count, begin + size);
+        /*
+         The job is held by every range, it outlives the handle if the caller drops that. What a range
+         throws is kept in the job for whoever retires the batch, on the worker it would end the process.
+         */
+        pool.submit([job, kernel, pushConstants, out, begin, end, workgroupSize]() {
+            std::exception_ptr rangeError;
+            try {
+                runRange(kernel, pushConstants, job->input.data(), out, begin, end, workgroupSize);
+            } catch (...) {
+                rangeError = std::current_exception();
+            }
+            job->finishRange(rangeError);
+        });
+    }
+    return job;
+}
+
+/*
+ Limb r of element i of a LAYOUT_SOA batch of n elements is int r * n + i, see BaseApp::Layout.
+ */
+static void runSoARange(BaseApp::FieldOp op, uint32_t selector, const int* rows, int* outRows,
+                        uint32_t n, uint32_t begin, uint32_t end) {
+    const uint32_t BLOCK = 64;
+    duble_fe25519 in[BLOCK];
+    fe25519 out[BLOCK];
+    for (uint32_t first = begin; first < end; first += BLOCK) {
+        uint32_t count = std::min(BLOCK, end - first);
+        for (uint32_t i = 0; i < count; ++i) {
+            for (uint32_t r = 0; r < BaseApp::DUBLE_FE25519_WIDTH; ++r) {
+                in[i].value[r / BaseApp::FE25519_WIDTH].value[r % BaseApp::FE25519_WIDTH] = rows[r * n + first + i];
+            }
+        }
+        fe25519_ref_run(op, selector, in, out, count, 0);
+        for (uint32_t i = 0; i < count; ++i) {
+            for (uint32_t r = 0; r < BaseApp::FE25519_WIDTH; ++r) {
+                outRows[r * n + first + i] = out[i].value[r];
+            }
+        }
+    }
+}
+
+/*
+ FORMAT_BYTES: two 32-byte operands in, one 32-byte result out, decoded and encoded the way
+ the kernel does with fe25519_frombytes and fe25519_tobytes.
+ */
+static void runBytesRange(BaseApp::FieldOp op, uint32_t selector, const uint8_t* input, uint8_t* output,
+                          uint32_t begin, uint32_t end) {
+    const uint32_t BYTES = BaseApp::FE25519_BYTES;
+    for (uint32_t i = begin; i < end; ++i) {
+        duble_fe25519 in;
+        for (int k = 0; k < 2; ++k) {
+            fe25519 s = fe25519_ref_zero();
+            memcpy(s.value, input + (2 * i + k) * BYTES, BYTES);
+            in.value[k] = fe25519_ref_frombytes(s);
+        }
+        fe25519 result;
+        fe25519_ref_run(op, selector, &in, &result, 1, 0);
+        fe25519 s = fe25519_ref_tobytes(result);
+        memcpy(output + i * BYTES, s.value, BYTES);
+    }
+}
+
+void CpuEngine::runRange(BaseApp::Kernel kernel, const BaseApp::PushConstants& pushConstants,
+                         const uint8_t* input, uint8_t* output, uint32_t begin, uint32_t end,
+                         uint32_t workgroupSize) {
+    BaseApp::FieldOp op = (BaseApp::FieldOp)pushConstants.op;
+    uint32_t selector = pushConstants.selector;
+    uint32_t n = pushConstants.elementCount;
+
+    switch (kernel) {
+        case BaseApp::KERNEL_FIELD:
+            fe25519_ref_run(op, selector, (const duble_fe25519*)input + begin, (fe25519*)output + begin, end - begin, 0);
+            break;
+        case BaseApp::KERNEL_BATCH_INVERT:
+            fe25519_ref_batch_invert((const duble_fe25519*)input, (fe25519*)output, n, workgroupSize);
+            break;
+        case BaseApp::KERNEL_FIELD_SOA:
+            runSoARange(op, selector, (const int*)input, (int*)output, n, begin, end);
+            break;
+        case BaseApp::KERNEL_FIELD_BYTES:
+            runBytesRange(op, selector, input, output, begin, end);
+            break;
+        case BaseApp::KERNEL_TRANSPOSE: {
+            // op is the layout to produce, selector the ints per element.
+            const int* in = (const int*)input;
+            int* out = (int*)output;
+            for (uint32_t i = begin; i < end; ++i) {
+                for (uint32_t r = 0; r < selector; ++r) {
+                    if (pushConstants.op == BaseApp::LAYOUT_SOA) {
+                        out[r * n + i] = in[i * selector + r];
+                    } else {
+                        out[i * selector + r] = in[r * n + i];
+                    }
+                }
+            }
+            break;
+        }
+        case BaseApp::KERNEL_ED25519_VERIFY: {
+            const BaseApp::ed25519_verify_input* in = (const BaseApp::ed25519_verify_input*)input;
+            uint32_t* verdicts = (uint32_t*)output;
+            for (uint32_t i = begin; i < end; ++i) {
+                verdicts[i] = ed25519_ref_verify(in[i]) ? 1 : 0;
+            }
+            break;
+        }
+        case BaseApp::KERNEL_X25519:
+            x25519_ref_run((const duble_fe25519*)input + begin, (fe25519*)output + begin, end - begin);
+            break;
+        case BaseApp::KERNEL_SCALARMULT_BASE: {
+            const fe25519* scalars = (const fe25519*)input;
+            fe25519* points = (fe25519*)output;
+            for (uint32_t i = begin; i < end; ++i) {
+                points[i] = ge25519_ref_p3_tobytes(ge25519_ref_scalarmult_base(scalars[i]));
+            }
+            break;
+        }
+        default:
+            throw std::runtime_error("unknown kernel!");
+    }
+}
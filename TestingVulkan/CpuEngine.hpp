@@ -0,0 +1,78 @@
+//
+//  CpuEngine.hpp
+//  TestingVulkan
+//
+//  The kernels of BaseApp on the CPU, for machines where Vulkan has no device to offer.
+//
+
+#ifndef CpuEngine_hpp
+#define CpuEngine_hpp
+
+#include "BaseApp.hpp"
+#include "ThreadPool.hpp"
+#include <chrono>
+#include <exception>
+
+/*
+ One batch handed to CpuEngine. The input is copied when the batch starts, as submitAsync()
+ copies it to the staging buffer, and the results are written straight to the output.
+ */
+class CpuJob {
+public:
+    bool done() const;
+    // Waits at most timeout nanoseconds. Returns true once every range of the batch has run.
+    bool wait(uint64_t timeout) const;
+    // Wall time from the start of the batch to the end of its last range.
+    double seconds() const;
+    // The first exception a range of the batch threw, null when they all ran through.
+    std::exception_ptr error() const;
+
+private:
+    friend class CpuEngine;
+    // Called by each range as it finishes, with what it threw if it failed. The last one marks the job done.
+    void finishRange(std::exception_ptr rangeError);
+
+    std::vector<uint8_t> input;
+    std::atomic<uint32_t> remainingRanges{0};
+    mutable std::mutex mutex;
+    mutable std::condition_variable finished;
+    bool complete = false;
+    std::exception_ptr firstError;
+    std::chrono::steady_clock::time_point startTime;
+    std::chrono::steady_clock::time_point endTime;
+};
+
+/*
+ Runs the kernels with the CPU references: every batch is cut into ranges of elements that the
+ workers of a ThreadPool run in parallel. The results are the same as those of the GPU, bit for bit,
+ so callers cannot tell which engine served them. FE_BATCH_INVERT works across its batch and
+ runs as a single range.
+ */
+class CpuEngine {
+public:
+    // threadCount 0 uses every hardware thread.
+    explicit CpuEngine(uint32_t threadCount = 0);
+
+    uint32_t threadCount() const { return pool.size(); }
+
+    /*
+     Starts a batch of `kernel`, inputSize is the bytes of a single element as for
+     BaseApp::submitKernel. workgroupSize only matters to FE_BATCH_INVERT, whose limbs
+     follow the workgroups of the GPU.
+     */
+    std::shared_ptr<CpuJob> start(BaseApp::Kernel kernel, const BaseApp::PushConstants& pushConstants,
+                                  const void* input, uint32_t inputSize, void* output, uint32_t workgroupSize);
+
+    // Elements [begin, end) of a batch, on the calling thread.
+    static void runRange(BaseApp::Kernel kernel, const BaseApp::PushConstants& pushConstants,
+                         const uint8_t* input, uint8_t* output, uint32_t begin, uint32_t end,
+                         uint32_t workgroupSize);
+
+private:
+    // Elements per range: a few ranges per worker, so that stealing can even out the load.
+    uint32_t rangeSize(BaseApp::Kernel kernel, uint32_t count) const;
+
+    ThreadPool pool;
+};
+
+#endif /* CpuEngine_hpp */
@@ -0,0 +1,240 @@
+//
+//  MultiDeviceEngine.cpp
+//  TestingVulkan
+//
+
+#include "MultiDeviceEngine.hpp"
+#include "CpuEngine.hpp"
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+
+bool MultiDeviceEngine::BatchHandle::poll() const {
+    bool complete = true;
+    for (const BaseApp::BatchHandle& shard : shards) {
+        // Every shard is polled, so the finished ones are retired even when another is not done yet.
+        if (shard.valid() && !shard.poll()) {
+            complete = false;
+        }
+    }
+    return complete;
+}
+
+bool MultiDeviceEngine::BatchHandle::wait(uint64_t timeout) const {
+    for (const BaseApp::BatchHandle& shard : shards) {
+        if (shard.valid() && !shard.wait(timeout)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void MultiDeviceEngine::BatchHandle::then(std::function<void()> callback) const {
+    // The shards may be retired by different threads, whichever brings the count to zero runs the callback.
+    std::shared_ptr<std::atomic<uint32_t>> remaining = std::make_shared<std::atomic<uint32_t>>(0);
+    for (const BaseApp::BatchHandle& shard : shards) {
+        if (shard.valid()) {
+            *remaining += 1;
+        }
+    }
+    for (const BaseApp::BatchHandle& shard : shards) {
+        if (shard.valid()) {
+            shard.then([remaining, callback]() {
+                if (--*remaining == 0) {
+                    callback();
+                }
+            });
+        }
+    }
+}
+
+void MultiDeviceEngine::init(uint32_t maxElementCount, uint32_t slotCount, uint32_t workgroupSize) {
+    this->maxElementCount = maxElementCount;
+    cpuEngine = std::make_shared<CpuEngine>();
+
+    std::vector<std::string> names;
+    try {
+        names = BaseApp::listDevices();
+    } catch (const std::runtime_error& e) {
+        std::cout << "INFO: " << e.what() << std::endl;
+    }
+    for (uint32_t index = 0; index < names.size(); ++index) {
+        std::unique_ptr<BaseApp> app(new BaseApp());
+        app->deviceIndex = (int)index;
+        app->sharedCpuEngine = cpuEngine;
+        // Every device keeps its own cache, the file only holds the pipelines of one.
+        app->pipelineCacheFile = "compute_pipeline_cache_" + std::to_string(index) + ".bin";
+        try {
+            app->init(maxElementCount, slotCount, workgroupSize);
+        } catch (const std::runtime_error& e) {
+            std::cout << "ERROR: skipping device " << index << " (" << names[index] << "): " << e.what() << std::endl;
+            // BaseApp has no destructor, whatever init() created before it failed is released here.
+            try {
+                app->cleanup();
+            } catch (const std::exception& cleanupError) {
+                std::cout << "ERROR: device " << index << ": " << cleanupError.what() << std::endl;
+            }
+            continue;
+        }
+        engines.push_back(std::move(app));
+    }
+
+    if (engines.empty()) {
+        // Picks no device of its own, so it can fall back to the CPU.
+        std::unique_ptr<BaseApp> app(new BaseApp());
+        app->sharedCpuEngine = cpuEngine;
+        app->init(maxElementCount, slotCount, workgroupSize);
+        engines.push_back(std::move(app));
+    }
+
+    std::vector<double> rates;
+    double total = 0;
+    for (std::unique_ptr<BaseApp>& app : engines) {
+        rates.push_back(measure(*app));
+        total += rates.back();
+    }
+    shares.clear();
+    for (uint32_t i = 0; i < engines.size(); ++i) {
+        shares.push_back(total > 0 ? rates[i] / total : 1.0 / engines.size());
+        std::cout << "INFO: " << engines[i]->deviceName() << " does " << rates[i] << " multiplications/s, "
+                  << shares[i] * 100 << "% of every batch" << std::endl;
+    }
+}
+
+double MultiDeviceEngine::measure(BaseApp& app) {
+    uint32_t count = std::min(maxElementCount, 16384u);
+    std::vector<duble_fe25519> input(count);
+    std::vector<fe25519> output(count);
+    BaseApp::setupInputBuffer(input.data(), count);
+
+    // The pipeline is created on first use, a batch of one keeps that out of the measurement.
+    app.submit(BaseApp::FE_MUL, input.data(), output.data(), 1);
+    auto start = std::chrono::steady_clock::now();
+    app.submit(BaseApp::FE_MUL, input.data(), output.data(), count);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return seconds > 0 ? count / seconds : 0;
+}
+
+void MultiDeviceEngine::begin(uint32_t count, const BatchHandle* after) {
+    if (count == 0 || count > maxElementCount) {
+        throw std::runtime_error("batch size does not fit the buffers created in init()!");
+    }
+    if (after != NULL && after->valid()) {
+        after->wait();
+    }
+}
+
+MultiDeviceEngine::BatchHandle MultiDeviceEngine::shard(BaseApp::Kernel kernel, uint32_t count, const BatchHandle* after,
+                                                        const std::function<BaseApp::BatchHandle(BaseApp& app, uint32_t first, uint32_t n)>& start) {
+    begin(count, after);
+
+    /*
+     Whole workgroups for every device but the last, which takes what is left, so no dispatch pads
+     more than its last workgroup.
+     */
+    BatchHandle handle;
+    handle.shards.resize(engines.size());
+    uint32_t first = 0;
+    for (uint32_t i = 0; i < engines.size() && first < count; ++i) {
+        uint32_t n = count - first;
+        if (i + 1 < engines.size()) {
+            // Each device rounds to its own workgroups, autotune() may have picked different ones.
+            uint32_t size = engines[i]->workgroupSizeOf(kernel);
+            n = std::min(n, (uint32_t)(count * shares[i]) / size * size);
+        }
+        if (n == 0) {
+            continue;
+        }
+        handle.shards[i] = start(*engines[i], first, n);
+        first += n;
+    }
+    return handle;
+}
+
+void MultiDeviceEngine::submit(FieldOp op, const duble_fe25519* input, fe25519* output, uint32_t count, uint32_t selector) {
+    submitAsync(op, input, output, count, NULL, selector).wait();
+}
+
+MultiDeviceEngine::BatchHandle MultiDeviceEngine::submitAsync(FieldOp op, const duble_fe25519* input, fe25519* output, uint32_t count,
+                                                              const BatchHandle* after, uint32_t selector) {
+    if (op == BaseApp::FE_BATCH_INVERT) {
+        // The products run across the whole batch, so it goes to the device with the largest share.
+        begin(count, after);
+        uint32_t best = (uint32_t)(std::max_element(shares.begin(), shares.end()) - shares.begin());
+        BatchHandle handle;
+        handle.shards.resize(engines.size());
+        handle.shards[best] = engines[best]->submitAsync(op, input, output, count, NULL, selector);
+        return handle;
+    }
+    return shard(BaseApp::KERNEL_FIELD, count, after, [&](BaseApp& app, uint32_t first, uint32_t n) {
+        return app.submitAsync(op, input + first, output + first, n, NULL, selector);
+    });
+}
+
+void MultiDeviceEngine::submitBytes(FieldOp op, const uint8_t* input, uint8_t* output, uint32_t count, uint32_t selector) {
+    submitBytesAsync(op, input, output, count, NULL, selector).wait();
+}
+
+MultiDeviceEngine::BatchHandle MultiDeviceEngine::submitBytesAsync(FieldOp op, const uint8_t* input, uint8_t* output, uint32_t count,
+                                                                   const BatchHandle* after, uint32_t selector) {
+    return shard(BaseApp::KERNEL_FIELD_BYTES, count, after, [&](BaseApp& app, uint32_t first, uint32_t n) {
+        return app.submitBytesAsync(op, input + (size_t)first * 2 * BaseApp::FE25519_BYTES,
+                                    output + (size_t)first * BaseApp::FE25519_BYTES, n, NULL, selector);
+    });
+}
+
+void MultiDeviceEngine::verify(const ed25519_verify_input* input, uint32_t* verdicts, uint32_t count) {
+    verifyAsync(input, verdicts, count).wait();
+}
+
+MultiDeviceEngine::BatchHandle MultiDeviceEngine::verifyAsync(const ed25519_verify_input* input, uint32_t* verdicts, uint32_t count,
+                                                              const BatchHandle* after) {
+    return shard(BaseApp::KERNEL_ED25519_VERIFY, count, after, [&](BaseApp& app, uint32_t first, uint32_t n) {
+        return app.verifyAsync(input + first, verdicts + first, n);
+    });
+}
+
+void MultiDeviceEngine::x25519(const duble_fe25519* input, fe25519* output, uint32_t count) {
+    x25519Async(input, output, count).wait();
+}
+
+MultiDeviceEngine::BatchHandle MultiDeviceEngine::x25519Async(const duble_fe25519* input, fe25519* output, uint32_t count,
+                                                              const BatchHandle* after) {
+    return shard(BaseApp::KERNEL_X25519, count, after, [&](BaseApp& app, uint32_t first, uint32_t n) {
+        return app.x25519Async(input + first, output + first, n);
+    });
+}
+
+void MultiDeviceEngine::scalarmultBase(const fe25519* scalars, fe25519* points, uint32_t count) {
+    scalarmultBaseAsync(scalars, points, count).wait();
+}
+
+MultiDeviceEngine::BatchHandle MultiDeviceEngine::scalarmultBaseAsync(const fe25519* scalars, fe25519* points, uint32_t count,
+                                                                      const BatchHandle* after) {
+    return shard(BaseApp::KERNEL_SCALARMULT_BASE, count, after, [&](BaseApp& app, uint32_t first, uint32_t n) {
+        return app.scalarmultBaseAsync(scalars + first, points + first, n);
+    });
+}
+
+uint32_t MultiDeviceEngine::pollCompletions() {
+    uint32_t retired = 0;
+    for (std::unique_ptr<BaseApp>& app : engines) {
+        retired += app->pollCompletions();
+    }
+    return retired;
+}
+
+void MultiDeviceEngine::flush() {
+    for (std::unique_ptr<BaseApp>& app : engines) {
+        app->flush();
+    }
+}
+
+void MultiDeviceEngine::cleanup() {
+    for (std::unique_ptr<BaseApp>& app : engines) {
+        app->cleanup();
+    }
+    engines.clear();
+    shares.clear();
+    cpuEngine.reset();
+}
@@ -0,0 +1,109 @@
+//
+//  MultiDeviceEngine.hpp
+//  TestingVulkan
+//
+//  One BaseApp per Vulkan device, with every batch sharded across them.
+//
+
+#ifndef MultiDeviceEngine_hpp
+#define MultiDeviceEngine_hpp
+
+#include "BaseApp.hpp"
+#include <memory>
+#include <vector>
+
+/*
+ Brings up a BaseApp, with its own logical device, queues and pipelines, on every device of
+ BaseApp::listDevices() that can run compute work, and cuts each batch into one contiguous shard
+ per device. The shards are sized by what init() measured each device to do, and every device
+ writes its results straight to its part of the output, so they come back in input order.
+
+ Software implementations count as devices, so a machine without a GPU can exercise the sharding
+ with two of them installed side by side, e.g.
+ VK_ICD_FILENAMES=/usr/share/vulkan/icd.d/lvp_icd.x86_64.json:/usr/share/vulkan/icd.d/vk_swiftshader_icd.json
+ When no device is usable, a single BaseApp serves the batches on the CPU, see BaseApp::cpuFallbackEnabled.
+ */
+class MultiDeviceEngine {
+public:
+    typedef BaseApp::FieldOp FieldOp;
+    typedef BaseApp::fe25519 fe25519;
+    typedef BaseApp::duble_fe25519 duble_fe25519;
+    typedef BaseApp::ed25519_verify_input ed25519_verify_input;
+
+    /*
+     The shards of one batch, one BaseApp::BatchHandle per device; a device that got no shard has an
+     invalid one. Cheap to copy, valid for the lifetime of the engine.
+     */
+    class BatchHandle {
+    public:
+        // Non-blocking. Returns true once every shard is in the output.
+        bool poll() const;
+        // Waits at most timeout nanoseconds for each shard. Returns true once every shard is in the output.
+        bool wait(uint64_t timeout = UINT64_MAX) const;
+        // Runs the callback once, after the last shard has been retired.
+        void then(std::function<void()> callback) const;
+        bool valid() const { return !shards.empty(); }
+
+    private:
+        friend class MultiDeviceEngine;
+        std::vector<BaseApp::BatchHandle> shards;
+    };
+
+    /*
+     Creates the engines, each with buffers for maxElementCount elements, and measures every device on
+     a batch of FE_MUL to size its shards. Devices that fail to come up are skipped with a message.
+     */
+    void init(uint32_t maxElementCount, uint32_t slotCount = 3, uint32_t workgroupSize = 64);
+
+    /*
+     The batch API of BaseApp, with the same arguments and rules. FE_BATCH_INVERT works across its
+     batch and is not sharded, it runs whole on the fastest device. A dependency on `after` is waited
+     for on the host: the devices share no semaphores.
+     */
+    void submit(FieldOp op, const duble_fe25519* input, fe25519* output, uint32_t count, uint32_t selector = 0);
+    BatchHandle submitAsync(FieldOp op, const duble_fe25519* input, fe25519* output, uint32_t count,
+                            const BatchHandle* after = NULL, uint32_t selector = 0);
+    void submitBytes(FieldOp op, const uint8_t* input, uint8_t* output, uint32_t count, uint32_t selector = 0);
+    BatchHandle submitBytesAsync(FieldOp op, const uint8_t* input, uint8_t* output, uint32_t count,
+                                 const BatchHandle* after = NULL, uint32_t selector = 0);
+    void verify(const ed25519_verify_input* input, uint32_t* verdicts, uint32_t count);
+    BatchHandle verifyAsync(const ed25519_verify_input* input, uint32_t* verdicts, uint32_t count,
+                            const BatchHandle* after = NULL);
+    void x25519(const duble_fe25519* input, fe25519* output, uint32_t count);
+    BatchHandle x25519Async(const duble_fe25519* input, fe25519* output, uint32_t count,
+                            const BatchHandle* after = NULL);
+    void scalarmultBase(const fe25519* scalars, fe25519* points, uint32_t count);
+    BatchHandle scalarmultBaseAsync(const fe25519* scalars, fe25519* points, uint32_t count,
+                                    const BatchHandle* after = NULL);
+
+    // Retires every shard that has completed, on every device. Returns how many were retired.
+    uint32_t pollCompletions();
+    // Waits for every batch in flight on every device.
+    void flush();
+    void cleanup();
+
+    uint32_t deviceCount() const { return (uint32_t)engines.size(); }
+    BaseApp& engine(uint32_t index) { return *engines[index]; }
+    // The share of every batch device `index` gets, they add up to 1.
+    double shareOf(uint32_t index) const { return shares[index]; }
+
+private:
+    /*
+     Splits `count` elements over the devices by their shares, in whole workgroups, and calls
+     start(device, first, n) for each non-empty shard.
+     */
+    BatchHandle shard(BaseApp::Kernel kernel, uint32_t count, const BatchHandle* after,
+                      const std::function<BaseApp::BatchHandle(BaseApp& app, uint32_t first, uint32_t n)>& start);
+    // Checks the batch size and waits for `after`.
+    void begin(uint32_t count, const BatchHandle* after);
+    // Elements per second of each engine on a batch of FE_MUL.
+    double measure(BaseApp& app);
+
+    std::vector<std::unique_ptr<BaseApp>> engines;
+    // The threads every engine falls back to, one pool for the machine instead of one per device.
+    std::shared_ptr<CpuEngine> cpuEngine;
+    std::vector<double> shares;
+    uint32_t maxElementCount = 0;
+};
+
+#endif /* MultiDeviceEngine_hpp */
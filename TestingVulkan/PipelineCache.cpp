@@ -0,0 +1,101 @@
+//
+//  PipelineCache.cpp
+//  TestingVulkan
+//
+
+#include "PipelineCache.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+/*
+ The header every pipeline cache starts with, VkPipelineCacheHeaderVersionOne in the spec.
+ All fields are little endian 32-bit words.
+ */
+struct PipelineCacheHeader {
+    uint32_t headerSize;
+    uint32_t headerVersion;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+};
+
+void PipelineCache::create(VkPhysicalDevice physicalDevice, VkDevice device, const std::string& path) {
+    this->device = device;
+    this->path = path;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    
+    std::string data;
+    std::ifstream file(path, std::ios::binary);
+    if (file) {
+        std::ostringstream contents;
+        contents << file.rdbuf();
+        data = contents.str();
+        if (!isCompatible(data)) {
+            std::cout << "INFO: " << path << " was written for another device or driver, starting with an empty pipeline cache" << std::endl;
+            data.clear();
+        } else {
+            std::cout << "INFO: loaded " << data.size() << " bytes of pipeline cache from " << path << std::endl;
+        }
+    }
+    
+    VkPipelineCacheCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    createInfo.initialDataSize = data.size();
+    createInfo.pInitialData = data.empty() ? NULL : data.data();
+    if (vkCreatePipelineCache(device, &createInfo, NULL, &cache) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline cache!");
+    }
+}
+
+bool PipelineCache::isCompatible(const std::string& data) {
+    PipelineCacheHeader header;
+    if (data.size() < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    return header.headerSize >= sizeof(header)
+        && header.headerSize <= data.size()
+        && header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+        && header.vendorID == deviceProperties.vendorID
+        && header.deviceID == deviceProperties.deviceID
+        && memcmp(header.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void PipelineCache::save() {
+    if (cache == VK_NULL_HANDLE) {
+        return;
+    }
+    size_t size = 0;
+    if (vkGetPipelineCacheData(device, cache, &size, NULL) != VK_SUCCESS || size == 0) {
+        return;
+    }
+    std::vector<char> data(size);
+    if (vkGetPipelineCacheData(device, cache, &size, data.data()) != VK_SUCCESS) {
+        return;
+    }
+    
+    std::string temporaryPath = path + ".tmp";
+    std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+    file.write(data.data(), size);
+    file.close();
+    if (!file || std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        std::cout << "ERROR: could not write the pipeline cache to " << path << std::endl;
+        std::remove(temporaryPath.c_str());
+        return;
+    }
+    std::cout << "INFO: saved " << size << " bytes of pipeline cache to " << path << std::endl;
+}
+
+void PipelineCache::destroy() {
+    if (cache == VK_NULL_HANDLE) {
+        return;
+    }
+    save();
+    vkDestroyPipelineCache(device, cache, NULL);
+    cache = VK_NULL_HANDLE;
+}
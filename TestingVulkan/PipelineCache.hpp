@@ -0,0 +1,44 @@
+//
+//  PipelineCache.hpp
+//  TestingVulkan
+//
+//  A VkPipelineCache that outlives the process.
+//
+
+#ifndef PipelineCache_hpp
+#define PipelineCache_hpp
+
+#include <vulkan/vulkan.h>
+#include <string>
+
+/*
+ Keeps the driver's compiled pipelines in a file, so a restart does not compile every shader again.
+ The file is only used when its header was written by the same driver for the same device:
+ vendorID, deviceID and pipelineCacheUUID all have to match, otherwise the cache starts empty.
+ */
+class PipelineCache {
+public:
+    // Creates the cache, with the contents of `path` when they fit this device.
+    void create(VkPhysicalDevice physicalDevice, VkDevice device, const std::string& path);
+    
+    /*
+     Writes the cache back to its file. The data goes to a temporary file first, which is then
+     renamed over the old one, so a crash never leaves a half-written cache behind.
+     */
+    void save();
+    
+    // Saves and destroys the cache. Call before the device is destroyed.
+    void destroy();
+    
+    VkPipelineCache handle() const { return cache; }
+    
+private:
+    bool isCompatible(const std::string& data);
+    
+    VkPhysicalDeviceProperties deviceProperties;
+    VkDevice device = VK_NULL_HANDLE;
+    VkPipelineCache cache = VK_NULL_HANDLE;
+    std::string path;
+};
+
+#endif /* PipelineCache_hpp */
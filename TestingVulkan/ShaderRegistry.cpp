@@ -0,0 +1,70 @@
+//
+//  ShaderRegistry.cpp
+//  TestingVulkan
+//
+
+#include "ShaderRegistry.hpp"
+#include <cstring>
+
+/*
+ Every .spv.inc is the bytes of one .spv as a comma separated list, written by shaders/embed.sh.
+ vkCreateShaderModule takes the code as 32-bit words, hence the alignment.
+ */
+alignas(4) static const unsigned char ed25519_spv[] = {
+#include "shaders/ed25519.spv.inc"
+};
+alignas(4) static const unsigned char ed25519_int32_spv[] = {
+#include "shaders/ed25519_int32.spv.inc"
+};
+alignas(4) static const unsigned char ed25519_verify_spv[] = {
+#include "shaders/ed25519_verify.spv.inc"
+};
+alignas(4) static const unsigned char ed25519_verify_int32_spv[] = {
+#include "shaders/ed25519_verify_int32.spv.inc"
+};
+alignas(4) static const unsigned char x25519_spv[] = {
+#include "shaders/x25519.spv.inc"
+};
+alignas(4) static const unsigned char x25519_int32_spv[] = {
+#include "shaders/x25519_int32.spv.inc"
+};
+alignas(4) static const unsigned char ge25519_scalarmult_base_spv[] = {
+#include "shaders/ge25519_scalarmult_base.spv.inc"
+};
+alignas(4) static const unsigned char ge25519_scalarmult_base_int32_spv[] = {
+#include "shaders/ge25519_scalarmult_base_int32.spv.inc"
+};
+alignas(4) static const unsigned char fe25519_batch_invert_spv[] = {
+#include "shaders/fe25519_batch_invert.spv.inc"
+};
+alignas(4) static const unsigned char fe25519_batch_invert_int32_spv[] = {
+#include "shaders/fe25519_batch_invert_int32.spv.inc"
+};
+alignas(4) static const unsigned char fe25519_transpose_spv[] = {
+#include "shaders/fe25519_transpose.spv.inc"
+};
+
+#define EMBEDDED_SHADER(file, bytes) { file, (const uint32_t*)bytes, sizeof(bytes) }
+
+static const EmbeddedShader embeddedShaders[] = {
+    EMBEDDED_SHADER("ed25519.spv", ed25519_spv),
+    EMBEDDED_SHADER("ed25519_int32.spv", ed25519_int32_spv),
+    EMBEDDED_SHADER("ed25519_verify.spv", ed25519_verify_spv),
+    EMBEDDED_SHADER("ed25519_verify_int32.spv", ed25519_verify_int32_spv),
+    EMBEDDED_SHADER("x25519.spv", x25519_spv),
+    EMBEDDED_SHADER("x25519_int32.spv", x25519_int32_spv),
+    EMBEDDED_SHADER("ge25519_scalarmult_base.spv", ge25519_scalarmult_base_spv),
+    EMBEDDED_SHADER("ge25519_scalarmult_base_int32.spv", ge25519_scalarmult_base_int32_spv),
+    EMBEDDED_SHADER("fe25519_batch_invert.spv", fe25519_batch_invert_spv),
+    EMBEDDED_SHADER("fe25519_batch_invert_int32.spv", fe25519_batch_invert_int32_spv),
+    EMBEDDED_SHADER("fe25519_transpose.spv", fe25519_transpose_spv)
+};
+
+const EmbeddedShader* findEmbeddedShader(const char* name) {
+    for (const EmbeddedShader& shader : embeddedShaders) {
+        if (strcmp(shader.name, name) == 0) {
+            return &shader;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,27 @@
+//
+//  ShaderRegistry.hpp
+//  TestingVulkan
+//
+//  The compute kernels' SPIR-V, compiled into the binary.
+//
+
+#ifndef ShaderRegistry_hpp
+#define ShaderRegistry_hpp
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ One .spv file of shaders/, embedded by shaders/embed.sh at build time.
+ name is the file name the kernel was built to, as in BaseApp::shaderNames.
+ */
+struct EmbeddedShader {
+    const char* name;
+    const uint32_t* code;
+    size_t size;
+};
+
+// Returns the embedded SPIR-V called `name`, or NULL if the binary has none by that name.
+const EmbeddedShader* findEmbeddedShader(const char* name);
+
+#endif /* ShaderRegistry_hpp */
@@ -0,0 +1,92 @@
+//
+//  ThreadPool.cpp
+//  TestingVulkan
+//
+
+#include "ThreadPool.hpp"
+#include <algorithm>
+
+// The pool and queue of the worker running on this thread, so its own submissions stay local.
+static thread_local const ThreadPool* currentPool = NULL;
+static thread_local uint32_t currentQueue = 0;
+
+ThreadPool::ThreadPool(uint32_t threadCount) {
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (uint32_t i = 0; i < threadCount; ++i) {
+        queues.emplace_back(new Queue());
+    }
+    for (uint32_t i = 0; i < threadCount; ++i) {
+        threads.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    uint32_t index = currentPool == this ? currentQueue : nextQueue++ % size();
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        queued += 1;
+    }
+    wake.notify_one();
+}
+
+bool ThreadPool::takeTask(uint32_t index, std::function<void()>& task) {
+    // The newest task of our own queue is the one whose data is most likely still in the cache.
+    {
+        Queue& own = *queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            queued -= 1;
+            return true;
+        }
+    }
+    // Steal the oldest task of the next queue that has one.
+    for (uint32_t k = 1; k < size(); ++k) {
+        Queue& victim = *queues[(index + k) % size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            queued -= 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(uint32_t index) {
+    currentPool = this;
+    currentQueue = index;
+    std::function<void()> task;
+    for (;;) {
+        if (takeTask(index, task)) {
+            task();
+            task = nullptr;
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this]() { return stopping || queued > 0; });
+        // Whatever was queued before the destructor is still run.
+        if (stopping && queued <= 0) {
+            return;
+        }
+    }
+}
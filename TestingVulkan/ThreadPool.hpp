@@ -0,0 +1,64 @@
+//
+//  ThreadPool.hpp
+//  TestingVulkan
+//
+//  A fixed set of worker threads that steal work from each other.
+//
+
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ Every worker has a queue of its own. Tasks submitted from outside are dealt to the queues in turn,
+ tasks submitted by a worker go to its own queue. A worker takes the newest task of its queue,
+ and when that is empty the oldest task of another one, so a worker that drew the slow tasks
+ is relieved by the others instead of holding the batch back.
+ */
+class ThreadPool {
+public:
+    // threadCount 0 starts one worker per hardware thread.
+    explicit ThreadPool(uint32_t threadCount = 0);
+    // Runs the tasks still queued, then joins the workers.
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // The queues are all there before the first worker starts, the threads may still be starting.
+    uint32_t size() const { return (uint32_t)queues.size(); }
+
+    // A task must not throw, there is nobody on the worker to catch it.
+    void submit(std::function<void()> task);
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void workerLoop(uint32_t index);
+    // Takes a task from queue `index`, or steals one. Returns false when every queue is empty.
+    bool takeTask(uint32_t index, std::function<void()>& task);
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<uint32_t> nextQueue{0};
+
+    // Workers sleep here while there is nothing queued. `queued` is raised under sleepMutex.
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::atomic<int64_t> queued{0};
+    bool stopping = false;
+};
+
+#endif /* ThreadPool_hpp */
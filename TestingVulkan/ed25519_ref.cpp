@@ -0,0 +1,283 @@
+//
+//  ed25519_ref.cpp
+//  TestingVulkan
+//
+
+#include "ed25519_ref.hpp"
+#include <string.h>
+#include <vector>
+
+/*
+ SHA-512 as in FIPS 180-4.
+ */
+static const uint64_t sha512K[80] = {
+    0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+    0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+    0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+    0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+    0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+    0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+    0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+    0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+    0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+    0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+    0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+    0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+    0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+    0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+    0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+    0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+    0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+    0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+    0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+    0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+static inline uint64_t rotr64(uint64_t x, int n) {
+    return (x >> n) | (x << (64 - n));
+}
+
+static void sha512_block(uint64_t state[8], const uint8_t block[128]) {
+    uint64_t w[80];
+    for (int i = 0; i < 16; ++i) {
+        w[i] = 0;
+        for (int j = 0; j < 8; ++j) {
+            w[i] = (w[i] << 8) | block[8 * i + j];
+        }
+    }
+    for (int i = 16; i < 80; ++i) {
+        uint64_t s0 = rotr64(w[i - 15], 1) ^ rotr64(w[i - 15], 8) ^ (w[i - 15] >> 7);
+        uint64_t s1 = rotr64(w[i - 2], 19) ^ rotr64(w[i - 2], 61) ^ (w[i - 2] >> 6);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint64_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint64_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 80; ++i) {
+        uint64_t S1 = rotr64(e, 14) ^ rotr64(e, 18) ^ rotr64(e, 41);
+        uint64_t ch = (e & f) ^ (~e & g);
+        uint64_t t1 = h + S1 + ch + sha512K[i] + w[i];
+        uint64_t S0 = rotr64(a, 28) ^ rotr64(a, 34) ^ rotr64(a, 39);
+        uint64_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint64_t t2 = S0 + maj;
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void sha512_ref(const uint8_t* message, size_t length, uint8_t digest[64]) {
+    uint64_t state[8] = {
+    0x6a09e667f3bcc908ULL,
+    0xbb67ae8584caa73bULL,
+    0x3c6ef372fe94f82bULL,
+    0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL,
+    0x9b05688c2b3e6c1fULL,
+    0x1f83d9abfb41bd6bULL,
+    0x5be0cd19137e2179ULL
+    };
+
+    size_t offset = 0;
+    for (; offset + 128 <= length; offset += 128) {
+        sha512_block(state, message + offset);
+    }
+
+    // The tail, 0x80, zeros and the length in bits take one or two more blocks.
+    uint8_t last[256] = {0};
+    size_t rest = length - offset;
+    memcpy(last, message + offset, rest);
+    last[rest] = 0x80;
+    size_t lastLength = (rest + 1 + 16 <= 128) ? 128 : 256;
+    uint64_t bits = (uint64_t)length * 8;
+    for (int j = 0; j < 8; ++j) {
+        last[lastLength - 1 - j] = (uint8_t)(bits >> (8 * j));
+    }
+    sha512_block(state, last);
+    if (lastLength == 256) {
+        sha512_block(state, last + 128);
+    }
+
+    for (int i = 0; i < 8; ++i) {
+        for (int j = 0; j < 8; ++j) {
+            digest[8 * i + j] = (uint8_t)(state[i] >> (56 - 8 * j));
+        }
+    }
+}
+
+
+/*
+ Scalars modulo L = 2^252 + 27742317777372353535851937790883648493. Nothing here is on a hot
+ path, so the reduction is plain shift-and-subtract over 32-bit words.
+ */
+static const uint32_t groupOrder[8] = {0x5cf5d3ed, 0x5812631a, 0xa2f79cd6, 0x14def9de, 0, 0, 0, 0x10000000};
+
+static void sc25519_ref_reduceWords(uint8_t out[32], const uint32_t* x, int words) {
+    // acc < 2L before each subtraction, so 9 words are plenty.
+    uint32_t acc[9] = {0};
+    for (int bit = 32 * words - 1; bit >= 0; --bit) {
+        for (int i = 8; i > 0; --i) {
+            acc[i] = (acc[i] << 1) | (acc[i - 1] >> 31);
+        }
+        acc[0] = (acc[0] << 1) | ((x[bit >> 5] >> (bit & 31)) & 1);
+
+        bool geq = acc[8] != 0;
+        if (!geq) {
+            geq = true;
+            for (int i = 7; i >= 0; --i) {
+                if (acc[i] != groupOrder[i]) {
+                    geq = acc[i] > groupOrder[i];
+                    break;
+                }
+            }
+        }
+        if (geq) {
+            int64_t borrow = 0;
+            for (int i = 0; i < 9; ++i) {
+                int64_t diff = (int64_t)acc[i] - (i < 8 ? groupOrder[i] : 0) - borrow;
+                borrow = diff < 0 ? 1 : 0;
+                acc[i] = (uint32_t)diff;
+            }
+        }
+    }
+    for (int i = 0; i < 32; ++i) {
+        out[i] = (uint8_t)(acc[i >> 2] >> (8 * (i & 3)));
+    }
+}
+
+static void bytesToWords(uint32_t* words, const uint8_t* bytes, int count) {
+    for (int i = 0; i < count; ++i) {
+        words[i] = (uint32_t)bytes[4 * i] | ((uint32_t)bytes[4 * i + 1] << 8)
+                 | ((uint32_t)bytes[4 * i + 2] << 16) | ((uint32_t)bytes[4 * i + 3] << 24);
+    }
+}
+
+void sc25519_ref_reduce(uint8_t out[32], const uint8_t s[64]) {
+    uint32_t x[16];
+    bytesToWords(x, s, 16);
+    sc25519_ref_reduceWords(out, x, 16);
+}
+
+void sc25519_ref_muladd(uint8_t out[32], const uint8_t a[32], const uint8_t b[32], const uint8_t c[32]) {
+    uint32_t aw[8], bw[8], cw[8];
+    bytesToWords(aw, a, 8);
+    bytesToWords(bw, b, 8);
+    bytesToWords(cw, c, 8);
+
+    uint32_t x[17] = {0};
+    for (int i = 0; i < 8; ++i) {
+        uint64_t carry = 0;
+        for (int j = 0; j < 8; ++j) {
+            uint64_t t = (uint64_t)aw[i] * bw[j] + x[i + j] + carry;
+            x[i + j] = (uint32_t)t;
+            carry = t >> 32;
+        }
+        x[i + 8] = (uint32_t)carry;
+    }
+    uint64_t carry = 0;
+    for (int i = 0; i < 17; ++i) {
+        uint64_t t = (uint64_t)x[i] + (i < 8 ? cw[i] : 0) + carry;
+        x[i] = (uint32_t)t;
+        carry = t >> 32;
+    }
+    sc25519_ref_reduceWords(out, x, 17);
+}
+
+
+/*
+ Compressed points and scalars travel as 32 bytes, the curve code wants them in a fe25519.
+ */
+static fe25519 bytesToFe(const uint8_t bytes[32]) {
+    fe25519 s = fe25519_ref_zero();
+    bytesToWords((uint32_t*)s.value, bytes, 8);
+    return s;
+}
+
+static void feToBytes(uint8_t bytes[32], const fe25519& s) {
+    for (int i = 0; i < 32; ++i) {
+        bytes[i] = (uint8_t)((uint32_t)s.value[i >> 2] >> (8 * (i & 3)));
+    }
+}
+
+// encode(a * B), from the precomputed table like the scalarmult_base kernel.
+static void scalarmultBase(uint8_t out[32], const uint8_t a[32]) {
+    feToBytes(out, ge25519_ref_p3_tobytes(ge25519_ref_scalarmult_base(bytesToFe(a))));
+}
+
+void ed25519_ref_keypair(uint8_t publicKey[32], uint8_t secretKey[64], const uint8_t seed[32]) {
+    uint8_t az[64];
+    sha512_ref(seed, 32, az);
+    az[0] &= 248;
+    az[31] &= 127;
+    az[31] |= 64;
+
+    scalarmultBase(publicKey, az);
+    memcpy(secretKey, seed, 32);
+    memcpy(secretKey + 32, publicKey, 32);
+}
+
+void ed25519_ref_sign(uint8_t signature[64], const uint8_t* message, size_t length, const uint8_t secretKey[64]) {
+    uint8_t az[64];
+    sha512_ref(secretKey, 32, az);
+    az[0] &= 248;
+    az[31] &= 127;
+    az[31] |= 64;
+
+    // r = SHA-512(prefix || message) mod L
+    std::vector<uint8_t> buffer(az + 32, az + 64);
+    buffer.insert(buffer.end(), message, message + length);
+    uint8_t digest[64];
+    sha512_ref(buffer.data(), buffer.size(), digest);
+    uint8_t r[32];
+    sc25519_ref_reduce(r, digest);
+
+    // R = r * B, k = SHA-512(R || A || message) mod L, S = (r + k * a) mod L
+    scalarmultBase(signature, r);
+    buffer.assign(signature, signature + 32);
+    buffer.insert(buffer.end(), secretKey + 32, secretKey + 64);
+    buffer.insert(buffer.end(), message, message + length);
+    sha512_ref(buffer.data(), buffer.size(), digest);
+    uint8_t k[32];
+    sc25519_ref_reduce(k, digest);
+    sc25519_ref_muladd(signature + 32, k, az, r);
+}
+
+void ed25519_ref_prepare(BaseApp::ed25519_verify_input& input, const uint8_t signature[64],
+                         const uint8_t* message, size_t length, const uint8_t publicKey[32]) {
+    memcpy(input.publicKey, publicKey, 32);
+    memcpy(input.R, signature, 32);
+    memcpy(input.S, signature + 32, 32);
+
+    std::vector<uint8_t> buffer(signature, signature + 32);
+    buffer.insert(buffer.end(), publicKey, publicKey + 32);
+    buffer.insert(buffer.end(), message, message + length);
+    uint8_t digest[64];
+    sha512_ref(buffer.data(), buffer.size(), digest);
+    sc25519_ref_reduce(input.h, digest);
+}
+
+bool ed25519_ref_verify(const BaseApp::ed25519_verify_input& input) {
+    // S < L
+    uint32_t S[8];
+    bytesToWords(S, input.S, 8);
+    bool canonical = false;
+    for (int i = 7; i >= 0; --i) {
+        if (S[i] != groupOrder[i]) {
+            canonical = S[i] < groupOrder[i];
+            break;
+        }
+    }
+    if (!canonical) {
+        return false;
+    }
+
+    ge25519_p3 A;
+    if (!ge25519_ref_frombytes_negate_vartime(A, bytesToFe(input.publicKey))) {
+        return false;
+    }
+    ge25519_p2 R = ge25519_ref_double_scalarmult_vartime(bytesToFe(input.h), A, bytesToFe(input.S));
+    uint8_t rcheck[32];
+    feToBytes(rcheck, ge25519_ref_tobytes(R));
+    return memcmp(rcheck, input.R, 32) == 0;
+}
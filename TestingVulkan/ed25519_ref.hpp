@@ -0,0 +1,37 @@
+//
+//  ed25519_ref.hpp
+//  TestingVulkan
+//
+//  Host side of Ed25519: SHA-512, arithmetic modulo the group order L, and a CPU
+//  implementation of key generation, signing and verification on top of ge25519_ref.
+//  The GPU only does the curve part of verification, the hashing stays here.
+//
+
+#ifndef ed25519_ref_hpp
+#define ed25519_ref_hpp
+
+#include "ge25519_ref.hpp"
+#include <stddef.h>
+
+void sha512_ref(const uint8_t* message, size_t length, uint8_t digest[64]);
+
+// out = s mod L, for a 64 byte little endian s.
+void sc25519_ref_reduce(uint8_t out[32], const uint8_t s[64]);
+// out = (a * b + c) mod L.
+void sc25519_ref_muladd(uint8_t out[32], const uint8_t a[32], const uint8_t b[32], const uint8_t c[32]);
+
+/*
+ Keys as in RFC 8032. The secret key is the seed followed by the public key.
+ */
+void ed25519_ref_keypair(uint8_t publicKey[32], uint8_t secretKey[64], const uint8_t seed[32]);
+void ed25519_ref_sign(uint8_t signature[64], const uint8_t* message, size_t length, const uint8_t secretKey[64]);
+
+/*
+ Fills in one input of the ED25519_VERIFY operation, h = SHA-512(R || publicKey || message) mod L.
+ */
+void ed25519_ref_prepare(BaseApp::ed25519_verify_input& input, const uint8_t signature[64],
+                         const uint8_t* message, size_t length, const uint8_t publicKey[32]);
+// The check the verification kernel does, true for a valid signature.
+bool ed25519_ref_verify(const BaseApp::ed25519_verify_input& input);
+
+#endif /* ed25519_ref_hpp */
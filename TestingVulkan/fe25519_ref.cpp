@@ -0,0 +1,384 @@
+//
+//  fe25519_ref.cpp
+//  TestingVulkan
+//
+//  Keep in step with shaders/fe25519.glsl, see there for what each function does.
+//  Left shifts of signed values are written as multiplications, they are undefined
+//  in C++ for negative numbers but well defined in GLSL.
+//
+
+#include "fe25519_ref.hpp"
+#include <stdexcept>
+#include <vector>
+#include <algorithm>
+
+static const int limbOffset[10] = {0, 26, 51, 77, 102, 128, 153, 179, 204, 230};
+static const int limbBits[10] = {26, 25, 26, 25, 26, 25, 26, 25, 26, 25};
+
+const int32_t fe25519_ref_d[10] = {-10913610, 13857413, -15372611, 6949391, 114729, -8787816, -6275908, -3247719, -18696448, -12055116};
+const int32_t fe25519_ref_d2[10] = {-21827239, -5839606, -30745221, 13898782, 229458, 15978800, -12551817, -6495438, 29715968, 9444199};
+const int32_t fe25519_ref_sqrtm1[10] = {-32595792, -7943725, 9377950, 3500415, 12389472, -272473, -25146209, -2005654, 326686, 11406482};
+
+fe25519 fe25519_ref_zero() {
+    fe25519 h;
+    for (int i = 0; i < 10; ++i) {
+        h.value[i] = 0;
+    }
+    return h;
+}
+
+fe25519 fe25519_ref_one() {
+    fe25519 h = fe25519_ref_zero();
+    h.value[0] = 1;
+    return h;
+}
+
+fe25519 fe25519_ref_fromLimbs(const int32_t limbs[10]) {
+    fe25519 h;
+    for (int i = 0; i < 10; ++i) {
+        h.value[i] = limbs[i];
+    }
+    return h;
+}
+
+fe25519 fe25519_ref_add(const fe25519& f, const fe25519& g) {
+    fe25519 h;
+    for (int i = 0; i < 10; ++i) {
+        h.value[i] = f.value[i] + g.value[i];
+    }
+    return h;
+}
+
+fe25519 fe25519_ref_sub(const fe25519& f, const fe25519& g) {
+    fe25519 h;
+    for (int i = 0; i < 10; ++i) {
+        h.value[i] = f.value[i] - g.value[i];
+    }
+    return h;
+}
+
+fe25519 fe25519_ref_neg(const fe25519& f) {
+    fe25519 h;
+    for (int i = 0; i < 10; ++i) {
+        h.value[i] = -f.value[i];
+    }
+    return h;
+}
+
+fe25519 fe25519_ref_cmov(const fe25519& f, const fe25519& g, uint32_t b) {
+    int32_t mask = -(int32_t)b;
+    fe25519 h;
+    for (int i = 0; i < 10; ++i) {
+        h.value[i] = f.value[i] ^ ((f.value[i] ^ g.value[i]) & mask);
+    }
+    return h;
+}
+
+void fe25519_ref_cswap(fe25519& f, fe25519& g, uint32_t b) {
+    int32_t mask = -(int32_t)b;
+    for (int i = 0; i < 10; ++i) {
+        int32_t x = (f.value[i] ^ g.value[i]) & mask;
+        f.value[i] ^= x;
+        g.value[i] ^= x;
+    }
+}
+
+static fe25519 fe25519_ref_carry64(int64_t h[10]) {
+    // Order of the carries, and the number of bits each limb keeps.
+    static const int order[12] = {0, 4, 1, 5, 2, 6, 3, 7, 4, 8, 9, 0};
+    for (int k = 0; k < 12; ++k) {
+        int i = order[k];
+        int bits = limbBits[i];
+        int64_t carry = (h[i] + ((int64_t)1 << (bits - 1))) >> bits;
+        h[i] -= carry * ((int64_t)1 << bits);
+        if (i == 9) {
+            h[0] += carry * 19;
+        } else {
+            h[i + 1] += carry;
+        }
+    }
+
+    fe25519 result;
+    for (int i = 0; i < 10; ++i) {
+        result.value[i] = (int32_t)h[i];
+    }
+    return result;
+}
+
+fe25519 fe25519_ref_carry(const fe25519& f) {
+    int64_t h[10];
+    for (int i = 0; i < 10; ++i) {
+        h[i] = f.value[i];
+    }
+    return fe25519_ref_carry64(h);
+}
+
+fe25519 fe25519_ref_mul32(const fe25519& f, int32_t n) {
+    int64_t h[10];
+    for (int i = 0; i < 10; ++i) {
+        h[i] = (int64_t)f.value[i] * n;
+    }
+    return fe25519_ref_carry64(h);
+}
+
+fe25519 fe25519_ref_mul(const fe25519& f, const fe25519& g) {
+    int64_t h[10] = {0};
+    for (int i = 0; i < 10; ++i) {
+        int32_t fi = (i & 1) ? 2 * f.value[i] : f.value[i];
+        for (int j = 0; j < 10; ++j) {
+            int32_t fij = (j & 1) ? fi : f.value[i];
+            int32_t gj = (i + j >= 10) ? 19 * g.value[j] : g.value[j];
+            h[(i + j) % 10] += (int64_t)fij * (int64_t)gj;
+        }
+    }
+    return fe25519_ref_carry64(h);
+}
+
+static fe25519 fe25519_ref_sq_scaled(const fe25519& f, int scale) {
+    int64_t h[10] = {0};
+    for (int i = 0; i < 10; ++i) {
+        int32_t fi = (i & 1) ? 2 * f.value[i] : f.value[i];
+        for (int j = i; j < 10; ++j) {
+            int32_t fij = (j & 1) ? fi : f.value[i];
+            int32_t fj = (i + j >= 10) ? 19 * f.value[j] : f.value[j];
+            int64_t product = (int64_t)fij * (int64_t)fj;
+            h[(i + j) % 10] += (i == j) ? product : product + product;
+        }
+    }
+    for (int k = 0; k < 10; ++k) {
+        h[k] *= scale;
+    }
+    return fe25519_ref_carry64(h);
+}
+
+fe25519 fe25519_ref_sq(const fe25519& f) {
+    return fe25519_ref_sq_scaled(f, 1);
+}
+
+fe25519 fe25519_ref_sq2(const fe25519& f) {
+    return fe25519_ref_sq_scaled(f, 2);
+}
+
+static fe25519 fe25519_ref_sqn(fe25519 f, int n) {
+    for (int i = 0; i < n; ++i) {
+        f = fe25519_ref_sq(f);
+    }
+    return f;
+}
+
+fe25519 fe25519_ref_invert(const fe25519& z) {
+    fe25519 t0 = fe25519_ref_sq(z);
+    fe25519 t1 = fe25519_ref_sqn(t0, 2);
+    t1 = fe25519_ref_mul(z, t1);
+    t0 = fe25519_ref_mul(t0, t1);
+    fe25519 t2 = fe25519_ref_sq(t0);
+    t1 = fe25519_ref_mul(t1, t2);
+    t2 = fe25519_ref_sqn(t1, 5);
+    t1 = fe25519_ref_mul(t2, t1);
+    t2 = fe25519_ref_sqn(t1, 10);
+    t2 = fe25519_ref_mul(t2, t1);
+    fe25519 t3 = fe25519_ref_sqn(t2, 20);
+    t2 = fe25519_ref_mul(t3, t2);
+    t2 = fe25519_ref_sqn(t2, 10);
+    t1 = fe25519_ref_mul(t2, t1);
+    t2 = fe25519_ref_sqn(t1, 50);
+    t2 = fe25519_ref_mul(t2, t1);
+    t3 = fe25519_ref_sqn(t2, 100);
+    t2 = fe25519_ref_mul(t3, t2);
+    t2 = fe25519_ref_sqn(t2, 50);
+    t1 = fe25519_ref_mul(t2, t1);
+    t1 = fe25519_ref_sqn(t1, 5);
+    return fe25519_ref_mul(t1, t0);
+}
+
+fe25519 fe25519_ref_pow22523(const fe25519& z) {
+    fe25519 t0 = fe25519_ref_sq(z);
+    fe25519 t1 = fe25519_ref_sqn(t0, 2);
+    t1 = fe25519_ref_mul(z, t1);
+    t0 = fe25519_ref_mul(t0, t1);
+    t0 = fe25519_ref_sq(t0);
+    t0 = fe25519_ref_mul(t1, t0);
+    t1 = fe25519_ref_sqn(t0, 5);
+    t0 = fe25519_ref_mul(t1, t0);
+    t1 = fe25519_ref_sqn(t0, 10);
+    t1 = fe25519_ref_mul(t1, t0);
+    fe25519 t2 = fe25519_ref_sqn(t1, 20);
+    t1 = fe25519_ref_mul(t2, t1);
+    t1 = fe25519_ref_sqn(t1, 10);
+    t0 = fe25519_ref_mul(t1, t0);
+    t1 = fe25519_ref_sqn(t0, 50);
+    t1 = fe25519_ref_mul(t1, t0);
+    t2 = fe25519_ref_sqn(t1, 100);
+    t1 = fe25519_ref_mul(t2, t1);
+    t1 = fe25519_ref_sqn(t1, 50);
+    t0 = fe25519_ref_mul(t1, t0);
+    t0 = fe25519_ref_sqn(t0, 2);
+    return fe25519_ref_mul(t0, z);
+}
+
+fe25519 fe25519_ref_frombytes(const fe25519& s) {
+    fe25519 h;
+    for (int i = 0; i < 10; ++i) {
+        int word = limbOffset[i] >> 5;
+        int shift = limbOffset[i] & 31;
+        uint32_t value = (uint32_t)s.value[word] >> shift;
+        if (shift + limbBits[i] > 32) {
+            value |= (uint32_t)s.value[word + 1] << (32 - shift);
+        }
+        h.value[i] = (int32_t)(value & ((1u << limbBits[i]) - 1u));
+    }
+    return h;
+}
+
+fe25519 fe25519_ref_tobytes(const fe25519& f) {
+    int32_t h[10];
+    for (int i = 0; i < 10; ++i) {
+        h[i] = f.value[i];
+    }
+
+    int32_t q = (19 * h[9] + (1 << 24)) >> 25;
+    for (int i = 0; i < 10; ++i) {
+        q = (h[i] + q) >> limbBits[i];
+    }
+
+    h[0] += 19 * q;
+    for (int i = 0; i < 9; ++i) {
+        int32_t carry = h[i] >> limbBits[i];
+        h[i + 1] += carry;
+        h[i] -= carry * (1 << limbBits[i]);
+    }
+    h[9] &= (1 << 25) - 1;
+
+    fe25519 s = fe25519_ref_zero();
+    for (int i = 0; i < 10; ++i) {
+        int word = limbOffset[i] >> 5;
+        int shift = limbOffset[i] & 31;
+        s.value[word] |= (int32_t)((uint32_t)h[i] << shift);
+        if (shift + limbBits[i] > 32) {
+            s.value[word + 1] |= (int32_t)((uint32_t)h[i] >> (32 - shift));
+        }
+    }
+    return s;
+}
+
+int fe25519_ref_isnegative(const fe25519& f) {
+    return fe25519_ref_tobytes(f).value[0] & 1;
+}
+
+bool fe25519_ref_isnonzero(const fe25519& f) {
+    fe25519 s = fe25519_ref_tobytes(f);
+    int32_t bits = 0;
+    for (int i = 0; i < 8; ++i) {
+        bits |= s.value[i];
+    }
+    return bits != 0;
+}
+
+/*
+ The scans of fe25519_batch_invert.comp, one round at a time over a workgroup of n lanes.
+ */
+static void fe25519_ref_prefixProduct(fe25519* s, uint32_t n) {
+    for (uint32_t d = 1; d < n; d <<= 1) {
+        std::vector<fe25519> other(s, s + n);
+        for (uint32_t lid = d; lid < n; ++lid) {
+            s[lid] = fe25519_ref_mul(other[lid - d], s[lid]);
+        }
+    }
+}
+
+static void fe25519_ref_suffixProduct(fe25519* s, uint32_t n) {
+    for (uint32_t d = 1; d < n; d <<= 1) {
+        std::vector<fe25519> other(s, s + n);
+        for (uint32_t lid = 0; lid + d < n; ++lid) {
+            s[lid] = fe25519_ref_mul(s[lid], other[lid + d]);
+        }
+    }
+}
+
+void fe25519_ref_batch_invert(const duble_fe25519* input, fe25519* output, uint32_t count, uint32_t workgroupSize) {
+    const uint32_t n = workgroupSize;
+    uint32_t groupCount = (count + n - 1) / n;
+    
+    std::vector<fe25519> x(groupCount * n);
+    std::vector<uint32_t> isZero(groupCount * n);
+    for (uint32_t i = 0; i < groupCount * n; ++i) {
+        x[i] = i < count ? input[i].value[0] : fe25519_ref_one();
+        isZero[i] = fe25519_ref_isnonzero(x[i]) ? 0 : 1;
+        x[i] = fe25519_ref_cmov(x[i], fe25519_ref_one(), isZero[i]);
+    }
+    
+    // PASS_PREFIX
+    std::vector<fe25519> prefix(x);
+    std::vector<fe25519> groupProducts(2 * groupCount);
+    for (uint32_t g = 0; g < groupCount; ++g) {
+        fe25519_ref_prefixProduct(&prefix[g * n], n);
+        groupProducts[g] = prefix[g * n + n - 1];
+    }
+    
+    // PASS_GROUPS
+    uint32_t run = (groupCount + n - 1) / n;
+    for (uint32_t lid = 0; lid < n; ++lid) {
+        uint32_t begin = lid * run;
+        uint32_t end = std::min(begin + run, groupCount);
+        if (begin >= end) {
+            continue;
+        }
+        fe25519 acc = groupProducts[begin];
+        groupProducts[groupCount + begin] = acc;
+        for (uint32_t g = begin + 1; g < end; ++g) {
+            acc = fe25519_ref_mul(acc, groupProducts[g]);
+            groupProducts[groupCount + g] = acc;
+        }
+        fe25519 inv = fe25519_ref_invert(acc);
+        for (uint32_t g = end - 1; g > begin; --g) {
+            fe25519 before = groupProducts[groupCount + g - 1];
+            groupProducts[groupCount + g] = fe25519_ref_mul(inv, before);
+            inv = fe25519_ref_mul(inv, groupProducts[g]);
+        }
+        groupProducts[groupCount + begin] = inv;
+    }
+    
+    // PASS_INVERSE
+    std::vector<fe25519> suffix(x);
+    for (uint32_t g = 0; g < groupCount; ++g) {
+        fe25519_ref_suffixProduct(&suffix[g * n], n);
+        for (uint32_t lid = 0; lid < n; ++lid) {
+            uint32_t i = g * n + lid;
+            if (i >= count) {
+                break;
+            }
+            fe25519 before = lid > 0 ? prefix[i - 1] : fe25519_ref_one();
+            fe25519 after = lid + 1 < n ? suffix[i + 1] : fe25519_ref_one();
+            fe25519 inv = fe25519_ref_mul(fe25519_ref_mul(groupProducts[groupCount + g], after), before);
+            output[i] = fe25519_ref_cmov(inv, fe25519_ref_zero(), isZero[i]);
+        }
+    }
+}
+
+void fe25519_ref_run(BaseApp::FieldOp op, uint32_t selector, const duble_fe25519* input, fe25519* output, uint32_t count,
+                     uint32_t workgroupSize) {
+    if (op == BaseApp::FE_BATCH_INVERT) {
+        fe25519_ref_batch_invert(input, output, count, workgroupSize);
+        return;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        const fe25519& a = input[i].value[0];
+        const fe25519& b = input[i].value[1];
+        switch (op) {
+            case BaseApp::FE_ADD:       output[i] = fe25519_ref_add(a, b); break;
+            case BaseApp::FE_SUB:       output[i] = fe25519_ref_sub(a, b); break;
+            case BaseApp::FE_NEG:       output[i] = fe25519_ref_neg(a); break;
+            case BaseApp::FE_MUL:       output[i] = fe25519_ref_mul(a, b); break;
+            case BaseApp::FE_SQ:        output[i] = fe25519_ref_sq(a); break;
+            case BaseApp::FE_SQ2:       output[i] = fe25519_ref_sq2(a); break;
+            case BaseApp::FE_CARRY:     output[i] = fe25519_ref_carry(a); break;
+            case BaseApp::FE_INVERT:    output[i] = fe25519_ref_invert(a); break;
+            case BaseApp::FE_POW22523:  output[i] = fe25519_ref_pow22523(a); break;
+            case BaseApp::FE_CMOV:      output[i] = fe25519_ref_cmov(a, b, selector); break;
+            case BaseApp::FE_FROMBYTES: output[i] = fe25519_ref_frombytes(a); break;
+            case BaseApp::FE_TOBYTES:   output[i] = fe25519_ref_tobytes(a); break;
+            default:
+                throw std::runtime_error("unknown field operation!");
+        }
+    }
+}
@@ -0,0 +1,58 @@
+//
+//  fe25519_ref.hpp
+//  TestingVulkan
+//
+//  CPU port of shaders/fe25519.glsl. It does the same integer operations in the same order,
+//  so for inputs within the ref10 bounds its results match the GPU bit for bit.
+//
+
+#ifndef fe25519_ref_hpp
+#define fe25519_ref_hpp
+
+#include "BaseApp.hpp"
+
+typedef BaseApp::fe25519 fe25519;
+typedef BaseApp::duble_fe25519 duble_fe25519;
+
+fe25519 fe25519_ref_zero();
+fe25519 fe25519_ref_one();
+fe25519 fe25519_ref_fromLimbs(const int32_t limbs[10]);
+fe25519 fe25519_ref_add(const fe25519& f, const fe25519& g);
+fe25519 fe25519_ref_sub(const fe25519& f, const fe25519& g);
+fe25519 fe25519_ref_neg(const fe25519& f);
+fe25519 fe25519_ref_cmov(const fe25519& f, const fe25519& g, uint32_t b);
+void fe25519_ref_cswap(fe25519& f, fe25519& g, uint32_t b);
+fe25519 fe25519_ref_carry(const fe25519& f);
+fe25519 fe25519_ref_mul32(const fe25519& f, int32_t n);
+fe25519 fe25519_ref_mul(const fe25519& f, const fe25519& g);
+fe25519 fe25519_ref_sq(const fe25519& f);
+fe25519 fe25519_ref_sq2(const fe25519& f);
+fe25519 fe25519_ref_invert(const fe25519& z);
+fe25519 fe25519_ref_pow22523(const fe25519& z);
+fe25519 fe25519_ref_frombytes(const fe25519& s);
+fe25519 fe25519_ref_tobytes(const fe25519& f);
+int fe25519_ref_isnegative(const fe25519& f);
+bool fe25519_ref_isnonzero(const fe25519& f);
+
+/*
+ The constants of fe25519.glsl.
+ */
+extern const int32_t fe25519_ref_d[10];
+extern const int32_t fe25519_ref_d2[10];
+extern const int32_t fe25519_ref_sqrtm1[10];
+
+/*
+ FE_BATCH_INVERT, with the workgroups and passes of fe25519_batch_invert.comp, so the limbs
+ come out the same as on the GPU with the same workgroup size. Each result equals
+ fe25519_ref_invert modulo p.
+ */
+void fe25519_ref_batch_invert(const duble_fe25519* input, fe25519* output, uint32_t count, uint32_t workgroupSize);
+
+/*
+ Runs `op` over a batch the way the compute shader does, for checking its output.
+ Only FE_BATCH_INVERT depends on the workgroup size.
+ */
+void fe25519_ref_run(BaseApp::FieldOp op, uint32_t selector, const duble_fe25519* input, fe25519* output, uint32_t count,
+                     uint32_t workgroupSize);
+
+#endif /* fe25519_ref_hpp */
@@ -0,0 +1,396 @@
+//
+//  ge25519_ref.cpp
+//  TestingVulkan
+//
+//  Keep in step with shaders/ge25519.glsl, see there for what each function does.
+//
+
+#include "ge25519_ref.hpp"
+#include <vector>
+
+/*
+ B, 3B, 5B, ..., 15B, the same table as ge25519_Bi in ge25519.glsl.
+ */
+static const int32_t ge25519_ref_BiLimbs[8][30] = {
+    {25967493, 19198397, 29566455, 3660896, 54414519, 4014786, 27544626, 21800161, 61029707, 2047604, 54563134, 934261, 64385954, 3049989, 66381436, 9406985, 12720692, 5043384, 19500929, 18085054, 58370664, 4489569, 9688441, 18769238, 10184608, 21191052, 29287918, 11864899, 42594502, 29115885},
+    {15636272, 23865875, 24204772, 25642034, 616976, 16869170, 27787599, 18782243, 28944399, 32004408, 16568933, 4717097, 55552716, 32452109, 15682895, 21747389, 16354576, 21778470, 7689661, 11199574, 30464137, 27578307, 55329429, 17883566, 23220364, 15915852, 7512774, 10017326, 49359771, 23634074},
+    {10861363, 11473154, 27284546, 1981175, 37044515, 12577860, 32867885, 14515107, 51670560, 10819379, 4708026, 6336745, 20377586, 9066809, 55836755, 6594695, 41455196, 12483687, 54440373, 5581305, 19563141, 16186464, 37722007, 4097518, 10237984, 29206317, 28542349, 13850243, 43430843, 17738489},
+    {5153727, 9909285, 1723747, 30776558, 30523604, 5516873, 19480852, 5230134, 43156425, 18378665, 36839857, 30090922, 7665485, 10083793, 28475525, 1649722, 20654025, 16520125, 30598449, 7715701, 28881826, 14381568, 9657904, 3680757, 46927229, 7843315, 35708204, 1370707, 29794553, 32145132},
+    {44589871, 26862249, 14201701, 24808930, 43598457, 8844725, 18474211, 32192982, 54046167, 13821876, 60653668, 25714560, 3374701, 28813570, 40010246, 22982724, 31655027, 26342105, 18853321, 19333481, 4566811, 20590564, 38133974, 21313742, 59506191, 30723862, 58594505, 23123294, 2207752, 30344648},
+    {41954014, 29368610, 29681143, 7868801, 60254203, 24130566, 54671499, 32891431, 35997400, 17421995, 25576264, 30851218, 7349803, 21739588, 16472781, 9300885, 3844789, 15725684, 171356, 6466918, 23103977, 13316479, 9739013, 17404951, 817874, 18515490, 8965338, 19466374, 36393951, 16193876},
+    {33587053, 3180712, 64714734, 14003686, 50205390, 17283591, 17238397, 4729455, 49034351, 9256799, 41926547, 29380300, 32336397, 5036987, 45872047, 11360616, 22616405, 9761698, 47281666, 630304, 53388152, 2639452, 42871404, 26147950, 9494426, 27780403, 60554312, 17593437, 64659607, 19263131},
+    {63957664, 28508356, 9282713, 6866145, 35201802, 32691408, 48168288, 15033783, 25105118, 25659556, 42782475, 15950225, 35307649, 18961608, 55446126, 28463506, 1573891, 30928545, 2198789, 17749813, 64009494, 10324966, 64867251, 7453182, 61661885, 30818928, 53296841, 17317989, 34647629, 21263748},
+};
+
+ge25519_precomp ge25519_ref_Bi(int i) {
+    ge25519_precomp r;
+    r.yplusx = fe25519_ref_fromLimbs(&ge25519_ref_BiLimbs[i][0]);
+    r.yminusx = fe25519_ref_fromLimbs(&ge25519_ref_BiLimbs[i][10]);
+    r.xy2d = fe25519_ref_fromLimbs(&ge25519_ref_BiLimbs[i][20]);
+    return r;
+}
+
+ge25519_p2 ge25519_ref_p2_0() {
+    ge25519_p2 h;
+    h.X = fe25519_ref_zero();
+    h.Y = fe25519_ref_one();
+    h.Z = fe25519_ref_one();
+    return h;
+}
+
+ge25519_p3 ge25519_ref_p3_0() {
+    ge25519_p3 h;
+    h.X = fe25519_ref_zero();
+    h.Y = fe25519_ref_one();
+    h.Z = fe25519_ref_one();
+    h.T = fe25519_ref_zero();
+    return h;
+}
+
+ge25519_p2 ge25519_ref_p1p1_to_p2(const ge25519_p1p1& p) {
+    ge25519_p2 r;
+    r.X = fe25519_ref_mul(p.X, p.T);
+    r.Y = fe25519_ref_mul(p.Y, p.Z);
+    r.Z = fe25519_ref_mul(p.Z, p.T);
+    return r;
+}
+
+ge25519_p3 ge25519_ref_p1p1_to_p3(const ge25519_p1p1& p) {
+    ge25519_p3 r;
+    r.X = fe25519_ref_mul(p.X, p.T);
+    r.Y = fe25519_ref_mul(p.Y, p.Z);
+    r.Z = fe25519_ref_mul(p.Z, p.T);
+    r.T = fe25519_ref_mul(p.X, p.Y);
+    return r;
+}
+
+ge25519_p2 ge25519_ref_p3_to_p2(const ge25519_p3& p) {
+    ge25519_p2 r;
+    r.X = p.X;
+    r.Y = p.Y;
+    r.Z = p.Z;
+    return r;
+}
+
+ge25519_cached ge25519_ref_p3_to_cached(const ge25519_p3& p) {
+    ge25519_cached r;
+    r.YplusX = fe25519_ref_add(p.Y, p.X);
+    r.YminusX = fe25519_ref_sub(p.Y, p.X);
+    r.Z = p.Z;
+    r.T2d = fe25519_ref_mul(p.T, fe25519_ref_fromLimbs(fe25519_ref_d2));
+    return r;
+}
+
+ge25519_p1p1 ge25519_ref_p2_dbl(const ge25519_p2& p) {
+    ge25519_p1p1 r;
+    r.X = fe25519_ref_sq(p.X);
+    r.Z = fe25519_ref_sq(p.Y);
+    r.T = fe25519_ref_sq2(p.Z);
+    r.Y = fe25519_ref_add(p.X, p.Y);
+    fe25519 t0 = fe25519_ref_sq(r.Y);
+    r.Y = fe25519_ref_add(r.Z, r.X);
+    r.Z = fe25519_ref_sub(r.Z, r.X);
+    r.X = fe25519_ref_sub(t0, r.Y);
+    r.T = fe25519_ref_sub(r.T, r.Z);
+    return r;
+}
+
+ge25519_p1p1 ge25519_ref_p3_dbl(const ge25519_p3& p) {
+    return ge25519_ref_p2_dbl(ge25519_ref_p3_to_p2(p));
+}
+
+ge25519_p1p1 ge25519_ref_add(const ge25519_p3& p, const ge25519_cached& q) {
+    ge25519_p1p1 r;
+    r.X = fe25519_ref_add(p.Y, p.X);
+    r.Y = fe25519_ref_sub(p.Y, p.X);
+    r.Z = fe25519_ref_mul(r.X, q.YplusX);
+    r.Y = fe25519_ref_mul(r.Y, q.YminusX);
+    r.T = fe25519_ref_mul(q.T2d, p.T);
+    r.X = fe25519_ref_mul(p.Z, q.Z);
+    fe25519 t0 = fe25519_ref_add(r.X, r.X);
+    r.X = fe25519_ref_sub(r.Z, r.Y);
+    r.Y = fe25519_ref_add(r.Z, r.Y);
+    r.Z = fe25519_ref_add(t0, r.T);
+    r.T = fe25519_ref_sub(t0, r.T);
+    return r;
+}
+
+ge25519_p1p1 ge25519_ref_sub(const ge25519_p3& p, const ge25519_cached& q) {
+    ge25519_p1p1 r;
+    r.X = fe25519_ref_add(p.Y, p.X);
+    r.Y = fe25519_ref_sub(p.Y, p.X);
+    r.Z = fe25519_ref_mul(r.X, q.YminusX);
+    r.Y = fe25519_ref_mul(r.Y, q.YplusX);
+    r.T = fe25519_ref_mul(q.T2d, p.T);
+    r.X = fe25519_ref_mul(p.Z, q.Z);
+    fe25519 t0 = fe25519_ref_add(r.X, r.X);
+    r.X = fe25519_ref_sub(r.Z, r.Y);
+    r.Y = fe25519_ref_add(r.Z, r.Y);
+    r.Z = fe25519_ref_sub(t0, r.T);
+    r.T = fe25519_ref_add(t0, r.T);
+    return r;
+}
+
+ge25519_p1p1 ge25519_ref_madd(const ge25519_p3& p, const ge25519_precomp& q) {
+    ge25519_p1p1 r;
+    r.X = fe25519_ref_add(p.Y, p.X);
+    r.Y = fe25519_ref_sub(p.Y, p.X);
+    r.Z = fe25519_ref_mul(r.X, q.yplusx);
+    r.Y = fe25519_ref_mul(r.Y, q.yminusx);
+    r.T = fe25519_ref_mul(q.xy2d, p.T);
+    fe25519 t0 = fe25519_ref_add(p.Z, p.Z);
+    r.X = fe25519_ref_sub(r.Z, r.Y);
+    r.Y = fe25519_ref_add(r.Z, r.Y);
+    r.Z = fe25519_ref_add(t0, r.T);
+    r.T = fe25519_ref_sub(t0, r.T);
+    return r;
+}
+
+ge25519_p1p1 ge25519_ref_msub(const ge25519_p3& p, const ge25519_precomp& q) {
+    ge25519_p1p1 r;
+    r.X = fe25519_ref_add(p.Y, p.X);
+    r.Y = fe25519_ref_sub(p.Y, p.X);
+    r.Z = fe25519_ref_mul(r.X, q.yminusx);
+    r.Y = fe25519_ref_mul(r.Y, q.yplusx);
+    r.T = fe25519_ref_mul(q.xy2d, p.T);
+    fe25519 t0 = fe25519_ref_add(p.Z, p.Z);
+    r.X = fe25519_ref_sub(r.Z, r.Y);
+    r.Y = fe25519_ref_add(r.Z, r.Y);
+    r.Z = fe25519_ref_sub(t0, r.T);
+    r.T = fe25519_ref_add(t0, r.T);
+    return r;
+}
+
+fe25519 ge25519_ref_tobytes(const ge25519_p2& h) {
+    fe25519 recip = fe25519_ref_invert(h.Z);
+    fe25519 x = fe25519_ref_mul(h.X, recip);
+    fe25519 y = fe25519_ref_mul(h.Y, recip);
+    fe25519 s = fe25519_ref_tobytes(y);
+    s.value[7] ^= (int32_t)((uint32_t)fe25519_ref_isnegative(x) << 31);
+    return s;
+}
+
+fe25519 ge25519_ref_p3_tobytes(const ge25519_p3& h) {
+    return ge25519_ref_tobytes(ge25519_ref_p3_to_p2(h));
+}
+
+bool ge25519_ref_frombytes_negate_vartime(ge25519_p3& h, const fe25519& s) {
+    h.Y = fe25519_ref_frombytes(s);
+    h.Z = fe25519_ref_one();
+    fe25519 u = fe25519_ref_sq(h.Y);
+    fe25519 v = fe25519_ref_mul(u, fe25519_ref_fromLimbs(fe25519_ref_d));
+    u = fe25519_ref_sub(u, h.Z);        /* u = y^2-1 */
+    v = fe25519_ref_add(v, h.Z);        /* v = dy^2+1 */
+
+    fe25519 v3 = fe25519_ref_sq(v);
+    v3 = fe25519_ref_mul(v3, v);        /* v3 = v^3 */
+    h.X = fe25519_ref_sq(v3);
+    h.X = fe25519_ref_mul(h.X, v);
+    h.X = fe25519_ref_mul(h.X, u);      /* x = uv^7 */
+
+    h.X = fe25519_ref_pow22523(h.X);    /* x = (uv^7)^((q-5)/8) */
+    h.X = fe25519_ref_mul(h.X, v3);
+    h.X = fe25519_ref_mul(h.X, u);      /* x = uv^3(uv^7)^((q-5)/8) */
+
+    fe25519 vxx = fe25519_ref_sq(h.X);
+    vxx = fe25519_ref_mul(vxx, v);
+    fe25519 check = fe25519_ref_sub(vxx, u);    /* vx^2-u */
+    if (fe25519_ref_isnonzero(check)) {
+        check = fe25519_ref_add(vxx, u);        /* vx^2+u */
+        if (fe25519_ref_isnonzero(check)) {
+            h.T = fe25519_ref_zero();
+            return false;
+        }
+        h.X = fe25519_ref_mul(h.X, fe25519_ref_fromLimbs(fe25519_ref_sqrtm1));
+    }
+
+    if (fe25519_ref_isnegative(h.X) == (int)((uint32_t)s.value[7] >> 31)) {
+        h.X = fe25519_ref_neg(h.X);
+    }
+
+    h.T = fe25519_ref_mul(h.X, h.Y);
+    return true;
+}
+
+/*
+ Unlike the shader, the digits get a byte each here.
+ */
+static void ge25519_ref_slide(int8_t r[256], const fe25519& a) {
+    for (int i = 0; i < 256; ++i) {
+        r[i] = 1 & ((uint32_t)a.value[i >> 5] >> (i & 31));
+    }
+
+    for (int i = 0; i < 256; ++i) {
+        if (!r[i]) {
+            continue;
+        }
+        for (int b = 1; b <= 6 && i + b < 256; ++b) {
+            if (!r[i + b]) {
+                continue;
+            }
+            if (r[i] + (r[i + b] << b) <= 15) {
+                r[i] += r[i + b] << b;
+                r[i + b] = 0;
+            } else if (r[i] - (r[i + b] << b) >= -15) {
+                r[i] -= r[i + b] << b;
+                for (int k = i + b; k < 256; ++k) {
+                    if (!r[k]) {
+                        r[k] = 1;
+                        break;
+                    }
+                    r[k] = 0;
+                }
+            } else {
+                break;
+            }
+        }
+    }
+}
+
+ge25519_p2 ge25519_ref_double_scalarmult_vartime(const fe25519& a, const ge25519_p3& A, const fe25519& b) {
+    int8_t aslide[256];
+    int8_t bslide[256];
+    ge25519_ref_slide(aslide, a);
+    ge25519_ref_slide(bslide, b);
+
+    ge25519_cached Ai[8]; /* A,3A,5A,7A,9A,11A,13A,15A */
+    Ai[0] = ge25519_ref_p3_to_cached(A);
+    ge25519_p3 A2 = ge25519_ref_p1p1_to_p3(ge25519_ref_p3_dbl(A));
+    for (int i = 0; i < 7; ++i) {
+        ge25519_p3 u = ge25519_ref_p1p1_to_p3(ge25519_ref_add(A2, Ai[i]));
+        Ai[i + 1] = ge25519_ref_p3_to_cached(u);
+    }
+
+    ge25519_p2 r = ge25519_ref_p2_0();
+
+    int i = 255;
+    for (; i >= 0; --i) {
+        if (aslide[i] || bslide[i]) {
+            break;
+        }
+    }
+
+    for (; i >= 0; --i) {
+        ge25519_p1p1 t = ge25519_ref_p2_dbl(r);
+
+        if (aslide[i] > 0) {
+            t = ge25519_ref_add(ge25519_ref_p1p1_to_p3(t), Ai[aslide[i] / 2]);
+        } else if (aslide[i] < 0) {
+            t = ge25519_ref_sub(ge25519_ref_p1p1_to_p3(t), Ai[(-aslide[i]) / 2]);
+        }
+
+        if (bslide[i] > 0) {
+            t = ge25519_ref_madd(ge25519_ref_p1p1_to_p3(t), ge25519_ref_Bi(bslide[i] / 2));
+        } else if (bslide[i] < 0) {
+            t = ge25519_ref_msub(ge25519_ref_p1p1_to_p3(t), ge25519_ref_Bi((-bslide[i]) / 2));
+        }
+
+        r = ge25519_ref_p1p1_to_p2(t);
+    }
+    return r;
+}
+
+ge25519_precomp ge25519_ref_cmov_precomp(const ge25519_precomp& t, const ge25519_precomp& u, uint32_t b) {
+    ge25519_precomp r;
+    r.yplusx = fe25519_ref_cmov(t.yplusx, u.yplusx, b);
+    r.yminusx = fe25519_ref_cmov(t.yminusx, u.yminusx, b);
+    r.xy2d = fe25519_ref_cmov(t.xy2d, u.xy2d, b);
+    return r;
+}
+
+static ge25519_precomp ge25519_ref_toPrecomp(const ge25519_p3& p) {
+    fe25519 recip = fe25519_ref_invert(p.Z);
+    fe25519 x = fe25519_ref_mul(p.X, recip);
+    fe25519 y = fe25519_ref_mul(p.Y, recip);
+    fe25519 xy2d = fe25519_ref_mul(fe25519_ref_mul(x, y), fe25519_ref_fromLimbs(fe25519_ref_d2));
+
+    ge25519_precomp r;
+    r.yplusx = fe25519_ref_frombytes(fe25519_ref_tobytes(fe25519_ref_add(y, x)));
+    r.yminusx = fe25519_ref_frombytes(fe25519_ref_tobytes(fe25519_ref_sub(y, x)));
+    r.xy2d = fe25519_ref_frombytes(fe25519_ref_tobytes(xy2d));
+    return r;
+}
+
+static std::vector<ge25519_precomp> ge25519_ref_buildBase() {
+    // The base point is the one with y = 4/5 and x positive, so its encoding is 0x58 0x66 ... 0x66.
+    fe25519 s = fe25519_ref_zero();
+    for (int i = 0; i < 8; ++i) {
+        s.value[i] = 0x66666666;
+    }
+    s.value[0] = 0x66666658;
+    ge25519_p3 P;
+    ge25519_ref_frombytes_negate_vartime(P, s);
+    P.X = fe25519_ref_neg(P.X);
+    P.T = fe25519_ref_neg(P.T);
+
+    std::vector<ge25519_precomp> table(32 * 8);
+    for (int i = 0; i < 32; ++i) {
+        ge25519_cached step = ge25519_ref_p3_to_cached(P);
+        ge25519_p3 multiple = P;
+        for (int j = 0; j < 8; ++j) {
+            table[8 * i + j] = ge25519_ref_toPrecomp(multiple);
+            multiple = ge25519_ref_p1p1_to_p3(ge25519_ref_add(multiple, step));
+        }
+        for (int k = 0; k < 8; ++k) {
+            P = ge25519_ref_p1p1_to_p3(ge25519_ref_p3_dbl(P));
+        }
+    }
+    return table;
+}
+
+const ge25519_precomp* ge25519_ref_base() {
+    static const std::vector<ge25519_precomp> table = ge25519_ref_buildBase();
+    return table.data();
+}
+
+static ge25519_precomp ge25519_ref_selectBase(int pos, int b) {
+    int bnegative = (int)((uint32_t)b >> 31);
+    int babs = b - ((-bnegative & b) * 2);
+
+    ge25519_precomp t;
+    t.yplusx = fe25519_ref_one();
+    t.yminusx = fe25519_ref_one();
+    t.xy2d = fe25519_ref_zero();
+    const ge25519_precomp* row = ge25519_ref_base() + 8 * pos;
+    for (int j = 0; j < 8; ++j) {
+        t = ge25519_ref_cmov_precomp(t, row[j], babs == j + 1 ? 1 : 0);
+    }
+
+    ge25519_precomp minust;
+    minust.yplusx = t.yminusx;
+    minust.yminusx = t.yplusx;
+    minust.xy2d = fe25519_ref_neg(t.xy2d);
+    return ge25519_ref_cmov_precomp(t, minust, (uint32_t)bnegative);
+}
+
+ge25519_p3 ge25519_ref_scalarmult_base(const fe25519& a) {
+    int e[64];
+    for (int i = 0; i < 64; ++i) {
+        e[i] = (int)(((uint32_t)a.value[i >> 3] >> (4 * (i & 7))) & 15);
+    }
+    e[63] &= 7;
+
+    int carry = 0;
+    for (int i = 0; i < 63; ++i) {
+        e[i] += carry;
+        carry = (e[i] + 8) >> 4;
+        e[i] -= carry * 16;
+    }
+    e[63] += carry;
+
+    ge25519_p3 h = ge25519_ref_p3_0();
+    for (int i = 1; i < 64; i += 2) {
+        h = ge25519_ref_p1p1_to_p3(ge25519_ref_madd(h, ge25519_ref_selectBase(i / 2, e[i])));
+    }
+
+    ge25519_p1p1 r = ge25519_ref_p3_dbl(h);
+    for (int k = 0; k < 3; ++k) {
+        r = ge25519_ref_p2_dbl(ge25519_ref_p1p1_to_p2(r));
+    }
+    h = ge25519_ref_p1p1_to_p3(r);
+
+    for (int i = 0; i < 64; i += 2) {
+        h = ge25519_ref_p1p1_to_p3(ge25519_ref_madd(h, ge25519_ref_selectBase(i / 2, e[i])));
+    }
+    return h;
+}
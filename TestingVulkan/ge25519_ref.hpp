@@ -0,0 +1,78 @@
+//
+//  ge25519_ref.hpp
+//  TestingVulkan
+//
+//  CPU port of shaders/ge25519.glsl, the Edwards curve point arithmetic behind Ed25519.
+//  Points and scalars are compressed to 32 bytes in a fe25519, as fe25519_ref_tobytes does.
+//
+
+#ifndef ge25519_ref_hpp
+#define ge25519_ref_hpp
+
+#include "fe25519_ref.hpp"
+
+struct ge25519_p2 {
+    fe25519 X;
+    fe25519 Y;
+    fe25519 Z;
+};
+
+struct ge25519_p3 {
+    fe25519 X;
+    fe25519 Y;
+    fe25519 Z;
+    fe25519 T;
+};
+
+struct ge25519_p1p1 {
+    fe25519 X;
+    fe25519 Y;
+    fe25519 Z;
+    fe25519 T;
+};
+
+struct ge25519_precomp {
+    fe25519 yplusx;
+    fe25519 yminusx;
+    fe25519 xy2d;
+};
+
+struct ge25519_cached {
+    fe25519 YplusX;
+    fe25519 YminusX;
+    fe25519 Z;
+    fe25519 T2d;
+};
+
+ge25519_p2 ge25519_ref_p2_0();
+ge25519_p3 ge25519_ref_p3_0();
+ge25519_p2 ge25519_ref_p1p1_to_p2(const ge25519_p1p1& p);
+ge25519_p3 ge25519_ref_p1p1_to_p3(const ge25519_p1p1& p);
+ge25519_p2 ge25519_ref_p3_to_p2(const ge25519_p3& p);
+ge25519_cached ge25519_ref_p3_to_cached(const ge25519_p3& p);
+ge25519_p1p1 ge25519_ref_p2_dbl(const ge25519_p2& p);
+ge25519_p1p1 ge25519_ref_p3_dbl(const ge25519_p3& p);
+ge25519_p1p1 ge25519_ref_add(const ge25519_p3& p, const ge25519_cached& q);
+ge25519_p1p1 ge25519_ref_sub(const ge25519_p3& p, const ge25519_cached& q);
+ge25519_p1p1 ge25519_ref_madd(const ge25519_p3& p, const ge25519_precomp& q);
+ge25519_p1p1 ge25519_ref_msub(const ge25519_p3& p, const ge25519_precomp& q);
+fe25519 ge25519_ref_tobytes(const ge25519_p2& h);
+fe25519 ge25519_ref_p3_tobytes(const ge25519_p3& h);
+bool ge25519_ref_frombytes_negate_vartime(ge25519_p3& h, const fe25519& s);
+ge25519_precomp ge25519_ref_Bi(int i);
+
+ge25519_precomp ge25519_ref_cmov_precomp(const ge25519_precomp& t, const ge25519_precomp& u, uint32_t b);
+
+/*
+ (j + 1) * 256^i * B for i < 32 and j < 8, as 256 entries row by row. Built on first use,
+ with the limbs reduced to 26 and 25 unsigned bits like the Bi table.
+ */
+const ge25519_precomp* ge25519_ref_base();
+
+// h = a * B, constant time. The top bit of a is ignored.
+ge25519_p3 ge25519_ref_scalarmult_base(const fe25519& a);
+
+// r = a * A + b * B, variable time.
+ge25519_p2 ge25519_ref_double_scalarmult_vartime(const fe25519& a, const ge25519_p3& A, const fe25519& b);
+
+#endif /* ge25519_ref_hpp */
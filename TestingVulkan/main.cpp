@@ -34,6 +34,8 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 #include "BaseApp.hpp"
+#include "PipelineCache.hpp"
+#include "AssetLoader.hpp"
 
 
 class HelloTriangleApplication {
@@ -158,6 +160,14 @@ private:
     VkDescriptorSetLayout descriptorSetLayout;
     
     VkPipeline graphicsPipeline;
+    
+    /*
+     The graphics pipeline is created again with every swap chain, and on every start.
+     Both come out of this cache once the driver has compiled the shaders a first time.
+     */
+    PipelineCache pipelineCache;
+    // The shader files stay mapped for every swap chain, the texture only until it is uploaded.
+    AssetLoader assets;
 
     std::vector<VkFramebuffer> swapChainFramebuffers;
 
@@ -212,6 +222,8 @@ private:
         
         createLogicalDevice();
         
+        pipelineCache.create(physicalDevice, device, "graphics_pipeline_cache.bin");
+        
         createCommandPool();
         
         createTextureImage();
@@ -269,7 +281,9 @@ private:
     
     void createTextureImage() {
         int texWidth, texHeight, texChannels;
-        stbi_uc* pixels = stbi_load("texture.jpg", &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+        // stb_image decodes from the mapping, the file itself is never copied.
+        AssetView texture = assets.load("texture.jpg", true);
+        stbi_uc* pixels = stbi_load_from_memory(texture.data, (int)texture.size, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
         VkDeviceSize imageSize = texWidth * texHeight * 4;
         
         if (!pixels) {
@@ -286,6 +300,7 @@ private:
         vkUnmapMemory(device, stagingBufferMemory);
         
         stbi_image_free(pixels);
+        assets.release("texture.jpg");
         
         createImage(texWidth, texHeight, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
         
@@ -822,8 +837,8 @@ private:
     }
     
     void createGraphicsPipeline() {
-        auto vertShaderCode = readFile("vert.spv");
-        auto fragShaderCode = readFile("frag.spv");
+        AssetView vertShaderCode = assets.loadSpirv("vert.spv");
+        AssetView fragShaderCode = assets.loadSpirv("frag.spv");
         VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
         VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
         
@@ -973,7 +988,7 @@ private:
         pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
         pipelineInfo.basePipelineIndex = -1; // Optional
         
-        if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
+        if (vkCreateGraphicsPipelines(device, pipelineCache.handle(), 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
             throw std::runtime_error("failed to create graphics pipeline!");
         }
         
@@ -982,11 +997,11 @@ private:
     }
     
     
-    VkShaderModule createShaderModule(const std::vector<char>& code) {
+    VkShaderModule createShaderModule(const AssetView& code) {
         VkShaderModuleCreateInfo createInfo = {};
         createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-        createInfo.codeSize = code.size();
-        createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+        createInfo.codeSize = code.size;
+        createInfo.pCode = code.words();
         VkShaderModule shaderModule;
         if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
             throw std::runtime_error("failed to create shader module!");
@@ -1482,6 +1497,8 @@ private:
 
         
         vkDestroyCommandPool(device, commandPool, nullptr);
+        
+        pipelineCache.destroy();
 
         vkDestroySurfaceKHR(instance, surface, nullptr);
         vkDestroyInstance(instance, nullptr);
@@ -1490,27 +1507,6 @@ private:
         glfwTerminate();
 
     }
-    
-    static std::vector<char> readFile(const std::string& filename) {
-        
-        char *path=NULL;
-        size_t size;
-        path = getcwd(path,size);
-        std::cout << "Current Path\t" << path << std::endl;
-        
-        
-        std::ifstream file(filename, std::ios::ate | std::ios::binary);
-        
-        if (!file.is_open()) {
-            throw std::runtime_error("failed to open file!");
-        }
-        size_t fileSize = (size_t) file.tellg();
-        std::vector<char> buffer(fileSize);
-        file.seekg(0);
-        file.read(buffer.data(), fileSize);
-        file.close();
-        return buffer;
-    }
 };
 
 int main_triangle() {
@@ -6,4 +6,4 @@
 /Users/armkha01/vulkan/sdk/macOS/bin/glslc shader.frag -S -o shader.frag.spvasm
 /Users/armkha01/vulkan/sdk/macOS/bin/glslc shader.vert -S shader.vert.spvasm
 
-/Users/armkha01/vulkan/sdk/macOS/bin/glslc ed25519_ref10_fe_25_5.comp -o ed25519.spv
+# The compute kernels are built by embed.sh.
@@ -0,0 +1,25 @@
+#!/bin/sh
+# Compiles every compute kernel and turns each .spv into a .spv.inc, a list of its bytes
+# that ShaderRegistry.cpp compiles into the binary. Run by the "Embed shaders" build phase,
+# or by hand after changing a shader. Set GLSLC to use another compiler.
+set -e
+cd "$(dirname "$0")"
+GLSLC=${GLSLC:-/Users/armkha01/vulkan/sdk/macOS/bin/glslc}
+
+# kernel source, output name, extra flags
+embed() {
+    "$GLSLC" $3 "$1" -o "$2"
+    xxd -i < "$2" > "$2.inc"
+}
+
+embed ed25519_ref10_fe_25_5.comp ed25519.spv
+embed ed25519_ref10_fe_25_5.comp ed25519_int32.spv -DFE25519_INT32
+embed ed25519_verify.comp ed25519_verify.spv
+embed ed25519_verify.comp ed25519_verify_int32.spv -DFE25519_INT32
+embed x25519.comp x25519.spv
+embed x25519.comp x25519_int32.spv -DFE25519_INT32
+embed ge25519_scalarmult_base.comp ge25519_scalarmult_base.spv
+embed ge25519_scalarmult_base.comp ge25519_scalarmult_base_int32.spv -DFE25519_INT32
+embed fe25519_batch_invert.comp fe25519_batch_invert.spv
+embed fe25519_batch_invert.comp fe25519_batch_invert_int32.spv -DFE25519_INT32
+embed fe25519_transpose.comp fe25519_transpose.spv
@@ -0,0 +1,453 @@
+/*
+Field arithmetic modulo p = 2^255 - 19, after the ref10 implementation in SUPERCOP.
+
+An element is held in radix 2^25.5: h = h0 + 2^26 h1 + 2^51 h2 + 2^77 h3 + 2^102 h4 + ...
++ 2^230 h9, with limbs alternating between 26 and 25 bits. The bounds on the inputs and
+outputs of every function are the ones documented in ref10.
+
+The partial products need 64 bits. They go through the small i64 layer below: native int64_t
+when the including shader enables GL_ARB_gpu_shader_int64, and a pair of 32-bit words built on
+imulExtended/uaddCarry when it is compiled with -DFE25519_INT32 for devices without shaderInt64.
+Both give the same two's complement results, so the outputs do not depend on the variant.
+The host keeps a bit-exact C++ port of it in fe25519_ref.cpp, change both together.
+*/
+
+#ifndef FE25519_INT32
+
+#define i64 int64_t
+
+i64 i64_fromInt(int a) { return int64_t(a); }
+i64 i64_mul(int a, int b) { return int64_t(a) * int64_t(b); }
+i64 i64_add(i64 a, i64 b) { return a + b; }
+i64 i64_sub(i64 a, i64 b) { return a - b; }
+// 0 < n < 32 in both shifts, the right shift is arithmetic.
+i64 i64_shl(i64 a, int n) { return a << n; }
+i64 i64_shr(i64 a, int n) { return a >> n; }
+int i64_toInt(i64 a) { return int(a); }
+
+#else
+
+// x holds the low word, y the high word.
+#define i64 uvec2
+
+i64 i64_fromInt(int a) { return uvec2(uint(a), uint(a >> 31)); }
+
+i64 i64_mul(int a, int b)
+{
+    int msb, lsb;
+    imulExtended(a, b, msb, lsb);
+    return uvec2(uint(lsb), uint(msb));
+}
+
+i64 i64_add(i64 a, i64 b)
+{
+    uint carry;
+    uint lo = uaddCarry(a.x, b.x, carry);
+    return uvec2(lo, a.y + b.y + carry);
+}
+
+i64 i64_sub(i64 a, i64 b)
+{
+    uint borrow;
+    uint lo = usubBorrow(a.x, b.x, borrow);
+    return uvec2(lo, a.y - b.y - borrow);
+}
+
+i64 i64_shl(i64 a, int n) { return uvec2(a.x << n, (a.y << n) | (a.x >> (32 - n))); }
+i64 i64_shr(i64 a, int n) { return uvec2((a.x >> n) | (a.y << (32 - n)), uint(int(a.y) >> n)); }
+int i64_toInt(i64 a) { return int(a.x); }
+
+#endif
+
+struct fe25519 {
+    int value [10];
+};
+
+struct duble_fe25519 {
+    fe25519 value [2];
+};
+
+
+/* 37095705934669439343138083508754565189542113879843219016388785533085940283555 */
+const int[10] d = {-10913610, 13857413, -15372611, 6949391,   114729, -8787816, -6275908, -3247719, -18696448, -12055116};
+
+/* 2 * d =
+* 16295367250680780974490674513165176452449235426866156013048779062215315747161
+*/
+const int[10] d2 = {-21827239, -5839606,  -30745221, 13898782, 229458, 15978800, -12551817, -6495438, 29715968, 9444199 };
+
+/* sqrt(-1) */
+const int[10] sqrtm1 = {-32595792, -7943725,  9377950,  3500415, 12389472, -272473, -25146209, -2005654, 326686, 11406482};
+
+/* A = 486662 */
+const int[10] curve25519_A = {486662, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+
+fe25519 fe25519_zero()
+{
+    fe25519 h;
+    for (int i = 0; i < 10; ++i) {
+        h.value[i] = 0;
+    }
+    return h;
+}
+
+fe25519 fe25519_one()
+{
+    fe25519 h = fe25519_zero();
+    h.value[0] = 1;
+    return h;
+}
+
+fe25519 fe25519_add(fe25519 f, fe25519 g)
+{
+    fe25519 h;
+    for (int i = 0; i < 10; ++i) {
+        h.value[i] = f.value[i] + g.value[i];
+    }
+    return h;
+}
+
+fe25519  fe25519_sub(fe25519 f, fe25519 g)
+{
+    fe25519 h;
+    int h0 = f.value[0] - g.value[0];
+    int h1 = f.value[1] - g.value[1];
+    int h2 = f.value[2] - g.value[2];
+    int h3 = f.value[3] - g.value[3];
+    int h4 = f.value[4] - g.value[4];
+    int h5 = f.value[5] - g.value[5];
+    int h6 = f.value[6] - g.value[6];
+    int h7 = f.value[7] - g.value[7];
+    int h8 = f.value[8] - g.value[8];
+    int h9 = f.value[9] - g.value[9];
+
+    h.value[0] = h0;
+    h.value[1] = h1;
+    h.value[2] = h2;
+    h.value[3] = h3;
+    h.value[4] = h4;
+    h.value[5] = h5;
+    h.value[6] = h6;
+    h.value[7] = h7;
+    h.value[8] = h8;
+    h.value[9] = h9;
+    return h;
+}
+
+fe25519 fe25519_neg(fe25519 f)
+{
+    fe25519 h;
+    for (int i = 0; i < 10; ++i) {
+        h.value[i] = -f.value[i];
+    }
+    return h;
+}
+
+/*
+Returns g if b == 1 and f if b == 0, without branching on b.
+*/
+fe25519 fe25519_cmov(fe25519 f, fe25519 g, uint b)
+{
+    int mask = -int(b);
+    fe25519 h;
+    for (int i = 0; i < 10; ++i) {
+        h.value[i] = f.value[i] ^ ((f.value[i] ^ g.value[i]) & mask);
+    }
+    return h;
+}
+
+/*
+Swaps f and g if b == 1 and leaves them if b == 0, without branching on b.
+*/
+void fe25519_cswap(inout fe25519 f, inout fe25519 g, uint b)
+{
+    int mask = -int(b);
+    for (int i = 0; i < 10; ++i) {
+        int x = (f.value[i] ^ g.value[i]) & mask;
+        f.value[i] ^= x;
+        g.value[i] ^= x;
+    }
+}
+
+/*
+Moves everything above the low `bits` bits of limb i, rounded, into the next limb.
+Above limb 9 that is limb 0, times 19.
+*/
+void fe25519_carryLimb(inout i64 h[10], int i, int bits)
+{
+    i64 carry = i64_shr(i64_add(h[i], i64_fromInt(1 << (bits - 1))), bits);
+    h[i] = i64_sub(h[i], i64_shl(carry, bits));
+    if (i == 9) {
+        // 19 * carry = 16 * carry + 2 * carry + carry
+        h[0] = i64_add(h[0], i64_add(i64_add(i64_shl(carry, 4), i64_shl(carry, 1)), carry));
+    } else {
+        h[i + 1] = i64_add(h[i + 1], carry);
+    }
+}
+
+/*
+The carry chain that ends fe25519_mul and fe25519_sq. Limbs may be up to 2^62 in size,
+the result has |h0|, |h2|, ... <= 2^25 (and a bit) and |h1|, |h3|, ... <= 2^24 (and a bit).
+*/
+fe25519 fe25519_carry64(i64 h[10])
+{
+    fe25519_carryLimb(h, 0, 26);
+    fe25519_carryLimb(h, 4, 26);
+    fe25519_carryLimb(h, 1, 25);
+    fe25519_carryLimb(h, 5, 25);
+    fe25519_carryLimb(h, 2, 26);
+    fe25519_carryLimb(h, 6, 26);
+    fe25519_carryLimb(h, 3, 25);
+    fe25519_carryLimb(h, 7, 25);
+    fe25519_carryLimb(h, 4, 26);
+    fe25519_carryLimb(h, 8, 26);
+    fe25519_carryLimb(h, 9, 25);
+    fe25519_carryLimb(h, 0, 26);
+
+    fe25519 result;
+    for (int i = 0; i < 10; ++i) {
+        result.value[i] = i64_toInt(h[i]);
+    }
+    return result;
+}
+
+/*
+Brings the limbs of a sum or difference back into the bounds fe25519_mul expects.
+*/
+fe25519 fe25519_carry(fe25519 f)
+{
+    i64 h[10];
+    for (int i = 0; i < 10; ++i) {
+        h[i] = i64_fromInt(f.value[i]);
+    }
+    return fe25519_carry64(h);
+}
+
+/*
+h = f * n for a small constant n, such as the 121666 of the Montgomery ladder.
+*/
+fe25519 fe25519_mul32(fe25519 f, int n)
+{
+    i64 h[10];
+    for (int i = 0; i < 10; ++i) {
+        h[i] = i64_mul(f.value[i], n);
+    }
+    return fe25519_carry64(h);
+}
+
+/*
+h = f * g. Limb i has weight 2^ceil(25.5 i), so the product of two odd limbs is counted twice,
+and whatever lands above limb 9 wraps around multiplied by 19, as 2^255 = 19 mod p.
+*/
+fe25519 fe25519_mul(fe25519 f, fe25519 g)
+{
+    i64 h[10];
+    for (int k = 0; k < 10; ++k) {
+        h[k] = i64_fromInt(0);
+    }
+    for (int i = 0; i < 10; ++i) {
+        int fi = ((i & 1) == 1) ? 2 * f.value[i] : f.value[i];
+        for (int j = 0; j < 10; ++j) {
+            int fij = ((j & 1) == 1) ? fi : f.value[i];
+            int gj = (i + j >= 10) ? 19 * g.value[j] : g.value[j];
+            h[(i + j) % 10] = i64_add(h[(i + j) % 10], i64_mul(fij, gj));
+        }
+    }
+    return fe25519_carry64(h);
+}
+
+/*
+h = f * f, and 2 * f * f for fe25519_sq2. Only the products with i <= j are formed,
+the ones off the diagonal are counted twice.
+*/
+fe25519 fe25519_sq_scaled(fe25519 f, bool twice)
+{
+    i64 h[10];
+    for (int k = 0; k < 10; ++k) {
+        h[k] = i64_fromInt(0);
+    }
+    for (int i = 0; i < 10; ++i) {
+        int fi = ((i & 1) == 1) ? 2 * f.value[i] : f.value[i];
+        for (int j = i; j < 10; ++j) {
+            int fij = ((j & 1) == 1) ? fi : f.value[i];
+            int fj = (i + j >= 10) ? 19 * f.value[j] : f.value[j];
+            i64 product = i64_mul(fij, fj);
+            if (i != j) {
+                product = i64_add(product, product);
+            }
+            h[(i + j) % 10] = i64_add(h[(i + j) % 10], product);
+        }
+    }
+    if (twice) {
+        for (int k = 0; k < 10; ++k) {
+            h[k] = i64_add(h[k], h[k]);
+        }
+    }
+    return fe25519_carry64(h);
+}
+
+fe25519 fe25519_sq(fe25519 f)
+{
+    return fe25519_sq_scaled(f, false);
+}
+
+fe25519 fe25519_sq2(fe25519 f)
+{
+    return fe25519_sq_scaled(f, true);
+}
+
+fe25519 fe25519_sqn(fe25519 f, int n)
+{
+    for (int i = 0; i < n; ++i) {
+        f = fe25519_sq(f);
+    }
+    return f;
+}
+
+/*
+z^(p - 2) = z^(2^255 - 21), the same addition chain as ref10.
+*/
+fe25519 fe25519_invert(fe25519 z)
+{
+    fe25519 t0 = fe25519_sq(z);
+    fe25519 t1 = fe25519_sqn(t0, 2);
+    t1 = fe25519_mul(z, t1);
+    t0 = fe25519_mul(t0, t1);
+    fe25519 t2 = fe25519_sq(t0);
+    t1 = fe25519_mul(t1, t2);
+    t2 = fe25519_sqn(t1, 5);
+    t1 = fe25519_mul(t2, t1);
+    t2 = fe25519_sqn(t1, 10);
+    t2 = fe25519_mul(t2, t1);
+    fe25519 t3 = fe25519_sqn(t2, 20);
+    t2 = fe25519_mul(t3, t2);
+    t2 = fe25519_sqn(t2, 10);
+    t1 = fe25519_mul(t2, t1);
+    t2 = fe25519_sqn(t1, 50);
+    t2 = fe25519_mul(t2, t1);
+    t3 = fe25519_sqn(t2, 100);
+    t2 = fe25519_mul(t3, t2);
+    t2 = fe25519_sqn(t2, 50);
+    t1 = fe25519_mul(t2, t1);
+    t1 = fe25519_sqn(t1, 5);
+    return fe25519_mul(t1, t0);
+}
+
+/*
+z^((p - 5) / 8) = z^(2^252 - 3), used for square roots when decompressing points.
+*/
+fe25519 fe25519_pow22523(fe25519 z)
+{
+    fe25519 t0 = fe25519_sq(z);
+    fe25519 t1 = fe25519_sqn(t0, 2);
+    t1 = fe25519_mul(z, t1);
+    t0 = fe25519_mul(t0, t1);
+    t0 = fe25519_sq(t0);
+    t0 = fe25519_mul(t1, t0);
+    t1 = fe25519_sqn(t0, 5);
+    t0 = fe25519_mul(t1, t0);
+    t1 = fe25519_sqn(t0, 10);
+    t1 = fe25519_mul(t1, t0);
+    fe25519 t2 = fe25519_sqn(t1, 20);
+    t1 = fe25519_mul(t2, t1);
+    t1 = fe25519_sqn(t1, 10);
+    t0 = fe25519_mul(t1, t0);
+    t1 = fe25519_sqn(t0, 50);
+    t1 = fe25519_mul(t1, t0);
+    t2 = fe25519_sqn(t1, 100);
+    t1 = fe25519_mul(t2, t1);
+    t1 = fe25519_sqn(t1, 50);
+    t0 = fe25519_mul(t1, t0);
+    t0 = fe25519_sqn(t0, 2);
+    return fe25519_mul(t0, z);
+}
+
+
+/*
+Byte strings are 32 bytes little endian. In the buffers they take the place of a fe25519:
+the first 8 words hold the bytes, four to a word and the lowest byte first, the last 2 are zero.
+*/
+const int[10] fe25519_limbOffset = {0, 26, 51, 77, 102, 128, 153, 179, 204, 230};
+const int[10] fe25519_limbBits = {26, 25, 26, 25, 26, 25, 26, 25, 26, 25};
+
+/*
+Reads 26 or 25 bits starting at bit `offset` of the byte string.
+*/
+int fe25519_loadBits(fe25519 s, int offset, int bits)
+{
+    int word = offset >> 5;
+    int shift = offset & 31;
+    uint value = uint(s.value[word]) >> shift;
+    if (shift + bits > 32) {
+        value |= uint(s.value[word + 1]) << (32 - shift);
+    }
+    return int(value & ((1u << bits) - 1u));
+}
+
+/*
+Unpacks a byte string, ignoring the top bit. Limbs come out reduced, but the value
+is not reduced modulo p when the string is 2^255 - 19 or more.
+*/
+fe25519 fe25519_frombytes(fe25519 s)
+{
+    fe25519 h;
+    for (int i = 0; i < 10; ++i) {
+        h.value[i] = fe25519_loadBits(s, fe25519_limbOffset[i], fe25519_limbBits[i]);
+    }
+    return h;
+}
+
+/*
+Packs the canonical representative of h, see ref10 fe_tobytes for why the first pass works out
+the quotient q = floor(h / p) before anything is carried.
+*/
+fe25519 fe25519_tobytes(fe25519 f)
+{
+    int h[10];
+    for (int i = 0; i < 10; ++i) {
+        h[i] = f.value[i];
+    }
+
+    int q = (19 * h[9] + (1 << 24)) >> 25;
+    for (int i = 0; i < 10; ++i) {
+        q = (h[i] + q) >> fe25519_limbBits[i];
+    }
+
+    h[0] += 19 * q;
+    for (int i = 0; i < 9; ++i) {
+        int carry = h[i] >> fe25519_limbBits[i];
+        h[i + 1] += carry;
+        h[i] -= carry << fe25519_limbBits[i];
+    }
+    h[9] &= (1 << 25) - 1;
+
+    fe25519 s = fe25519_zero();
+    for (int i = 0; i < 10; ++i) {
+        int word = fe25519_limbOffset[i] >> 5;
+        int shift = fe25519_limbOffset[i] & 31;
+        s.value[word] |= int(uint(h[i]) << shift);
+        if (shift + fe25519_limbBits[i] > 32) {
+            s.value[word + 1] |= int(uint(h[i]) >> (32 - shift));
+        }
+    }
+    return s;
+}
+
+/*
+1 when the canonical representative of f is odd, the sign bit of a compressed point.
+*/
+int fe25519_isnegative(fe25519 f)
+{
+    return fe25519_tobytes(f).value[0] & 1;
+}
+
+bool fe25519_isnonzero(fe25519 f)
+{
+    fe25519 s = fe25519_tobytes(f);
+    int bits = 0;
+    for (int i = 0; i < 8; ++i) {
+        bits |= s.value[i];
+    }
+    return bits != 0;
+}
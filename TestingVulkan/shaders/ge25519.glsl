@@ -0,0 +1,404 @@
+/*
+Points of the twisted Edwards curve -x^2 + y^2 = 1 + d x^2 y^2, after ref10 ge.h in SUPERCOP.
+Needs fe25519.glsl.
+
+ge25519_p2 (projective): (X:Z, Y:Z) satisfies x = X/Z, y = Y/Z
+ge25519_p3 (extended): (X:Y:Z:T) satisfies x = X/Z, y = Y/Z, XY = ZT
+ge25519_p1p1 (completed): ((X:Z),(Y:T)) satisfies x = X/Z, y = Y/T
+ge25519_precomp (Duif): (y+x, y-x, 2dxy)
+ge25519_cached: (Y+X, Y-X, Z, 2dT)
+*/
+
+struct ge25519_p2 {
+    fe25519 X;
+    fe25519 Y;
+    fe25519 Z;
+};
+
+struct ge25519_p3 {
+    fe25519 X;
+    fe25519 Y;
+    fe25519 Z;
+    fe25519 T;
+};
+
+struct ge25519_p1p1 {
+    fe25519 X;
+    fe25519 Y;
+    fe25519 Z;
+    fe25519 T;
+};
+
+struct ge25519_precomp {
+    fe25519 yplusx;
+    fe25519 yminusx;
+    fe25519 xy2d;
+};
+
+struct ge25519_cached {
+    fe25519 YplusX;
+    fe25519 YminusX;
+    fe25519 Z;
+    fe25519 T2d;
+};
+
+
+/*
+B, 3B, 5B, ..., 15B for ge25519_double_scalarmult_vartime, as yplusx, yminusx and xy2d.
+The same table as Bi in ref10 base2.h, with the limbs reduced to 26 and 25 unsigned bits.
+*/
+const int[240] ge25519_Bi = {
+    25967493, 19198397, 29566455, 3660896, 54414519, 4014786, 27544626, 21800161, 61029707, 2047604, 54563134, 934261, 64385954, 3049989, 66381436, 9406985, 12720692, 5043384, 19500929, 18085054, 58370664, 4489569, 9688441, 18769238, 10184608, 21191052, 29287918, 11864899, 42594502, 29115885,
+    15636272, 23865875, 24204772, 25642034, 616976, 16869170, 27787599, 18782243, 28944399, 32004408, 16568933, 4717097, 55552716, 32452109, 15682895, 21747389, 16354576, 21778470, 7689661, 11199574, 30464137, 27578307, 55329429, 17883566, 23220364, 15915852, 7512774, 10017326, 49359771, 23634074,
+    10861363, 11473154, 27284546, 1981175, 37044515, 12577860, 32867885, 14515107, 51670560, 10819379, 4708026, 6336745, 20377586, 9066809, 55836755, 6594695, 41455196, 12483687, 54440373, 5581305, 19563141, 16186464, 37722007, 4097518, 10237984, 29206317, 28542349, 13850243, 43430843, 17738489,
+    5153727, 9909285, 1723747, 30776558, 30523604, 5516873, 19480852, 5230134, 43156425, 18378665, 36839857, 30090922, 7665485, 10083793, 28475525, 1649722, 20654025, 16520125, 30598449, 7715701, 28881826, 14381568, 9657904, 3680757, 46927229, 7843315, 35708204, 1370707, 29794553, 32145132,
+    44589871, 26862249, 14201701, 24808930, 43598457, 8844725, 18474211, 32192982, 54046167, 13821876, 60653668, 25714560, 3374701, 28813570, 40010246, 22982724, 31655027, 26342105, 18853321, 19333481, 4566811, 20590564, 38133974, 21313742, 59506191, 30723862, 58594505, 23123294, 2207752, 30344648,
+    41954014, 29368610, 29681143, 7868801, 60254203, 24130566, 54671499, 32891431, 35997400, 17421995, 25576264, 30851218, 7349803, 21739588, 16472781, 9300885, 3844789, 15725684, 171356, 6466918, 23103977, 13316479, 9739013, 17404951, 817874, 18515490, 8965338, 19466374, 36393951, 16193876,
+    33587053, 3180712, 64714734, 14003686, 50205390, 17283591, 17238397, 4729455, 49034351, 9256799, 41926547, 29380300, 32336397, 5036987, 45872047, 11360616, 22616405, 9761698, 47281666, 630304, 53388152, 2639452, 42871404, 26147950, 9494426, 27780403, 60554312, 17593437, 64659607, 19263131,
+    63957664, 28508356, 9282713, 6866145, 35201802, 32691408, 48168288, 15033783, 25105118, 25659556, 42782475, 15950225, 35307649, 18961608, 55446126, 28463506, 1573891, 30928545, 2198789, 17749813, 64009494, 10324966, 64867251, 7453182, 61661885, 30818928, 53296841, 17317989, 34647629, 21263748
+
+};
+
+ge25519_precomp ge25519_loadBi(int i)
+{
+    ge25519_precomp r;
+    for (int k = 0; k < 10; ++k) {
+        r.yplusx.value[k] = ge25519_Bi[30 * i + k];
+        r.yminusx.value[k] = ge25519_Bi[30 * i + 10 + k];
+        r.xy2d.value[k] = ge25519_Bi[30 * i + 20 + k];
+    }
+    return r;
+}
+
+
+ge25519_p2 ge25519_p2_0()
+{
+    ge25519_p2 h;
+    h.X = fe25519_zero();
+    h.Y = fe25519_one();
+    h.Z = fe25519_one();
+    return h;
+}
+
+ge25519_p3 ge25519_p3_0()
+{
+    ge25519_p3 h;
+    h.X = fe25519_zero();
+    h.Y = fe25519_one();
+    h.Z = fe25519_one();
+    h.T = fe25519_zero();
+    return h;
+}
+
+ge25519_p2 ge25519_p1p1_to_p2(ge25519_p1p1 p)
+{
+    ge25519_p2 r;
+    r.X = fe25519_mul(p.X, p.T);
+    r.Y = fe25519_mul(p.Y, p.Z);
+    r.Z = fe25519_mul(p.Z, p.T);
+    return r;
+}
+
+ge25519_p3 ge25519_p1p1_to_p3(ge25519_p1p1 p)
+{
+    ge25519_p3 r;
+    r.X = fe25519_mul(p.X, p.T);
+    r.Y = fe25519_mul(p.Y, p.Z);
+    r.Z = fe25519_mul(p.Z, p.T);
+    r.T = fe25519_mul(p.X, p.Y);
+    return r;
+}
+
+ge25519_p2 ge25519_p3_to_p2(ge25519_p3 p)
+{
+    ge25519_p2 r;
+    r.X = p.X;
+    r.Y = p.Y;
+    r.Z = p.Z;
+    return r;
+}
+
+ge25519_cached ge25519_p3_to_cached(ge25519_p3 p)
+{
+    ge25519_cached r;
+    r.YplusX = fe25519_add(p.Y, p.X);
+    r.YminusX = fe25519_sub(p.Y, p.X);
+    r.Z = p.Z;
+    r.T2d = fe25519_mul(p.T, fe25519(d2));
+    return r;
+}
+
+/*
+r = 2 * p
+*/
+ge25519_p1p1 ge25519_p2_dbl(ge25519_p2 p)
+{
+    ge25519_p1p1 r;
+    r.X = fe25519_sq(p.X);
+    r.Z = fe25519_sq(p.Y);
+    r.T = fe25519_sq2(p.Z);
+    r.Y = fe25519_add(p.X, p.Y);
+    fe25519 t0 = fe25519_sq(r.Y);
+    r.Y = fe25519_add(r.Z, r.X);
+    r.Z = fe25519_sub(r.Z, r.X);
+    r.X = fe25519_sub(t0, r.Y);
+    r.T = fe25519_sub(r.T, r.Z);
+    return r;
+}
+
+ge25519_p1p1 ge25519_p3_dbl(ge25519_p3 p)
+{
+    return ge25519_p2_dbl(ge25519_p3_to_p2(p));
+}
+
+/*
+r = p + q
+*/
+ge25519_p1p1 ge25519_add(ge25519_p3 p, ge25519_cached q)
+{
+    ge25519_p1p1 r;
+    r.X = fe25519_add(p.Y, p.X);
+    r.Y = fe25519_sub(p.Y, p.X);
+    r.Z = fe25519_mul(r.X, q.YplusX);
+    r.Y = fe25519_mul(r.Y, q.YminusX);
+    r.T = fe25519_mul(q.T2d, p.T);
+    r.X = fe25519_mul(p.Z, q.Z);
+    fe25519 t0 = fe25519_add(r.X, r.X);
+    r.X = fe25519_sub(r.Z, r.Y);
+    r.Y = fe25519_add(r.Z, r.Y);
+    r.Z = fe25519_add(t0, r.T);
+    r.T = fe25519_sub(t0, r.T);
+    return r;
+}
+
+/*
+r = p - q
+*/
+ge25519_p1p1 ge25519_sub(ge25519_p3 p, ge25519_cached q)
+{
+    ge25519_p1p1 r;
+    r.X = fe25519_add(p.Y, p.X);
+    r.Y = fe25519_sub(p.Y, p.X);
+    r.Z = fe25519_mul(r.X, q.YminusX);
+    r.Y = fe25519_mul(r.Y, q.YplusX);
+    r.T = fe25519_mul(q.T2d, p.T);
+    r.X = fe25519_mul(p.Z, q.Z);
+    fe25519 t0 = fe25519_add(r.X, r.X);
+    r.X = fe25519_sub(r.Z, r.Y);
+    r.Y = fe25519_add(r.Z, r.Y);
+    r.Z = fe25519_sub(t0, r.T);
+    r.T = fe25519_add(t0, r.T);
+    return r;
+}
+
+/*
+r = p + q, with q in affine form.
+*/
+ge25519_p1p1 ge25519_madd(ge25519_p3 p, ge25519_precomp q)
+{
+    ge25519_p1p1 r;
+    r.X = fe25519_add(p.Y, p.X);
+    r.Y = fe25519_sub(p.Y, p.X);
+    r.Z = fe25519_mul(r.X, q.yplusx);
+    r.Y = fe25519_mul(r.Y, q.yminusx);
+    r.T = fe25519_mul(q.xy2d, p.T);
+    fe25519 t0 = fe25519_add(p.Z, p.Z);
+    r.X = fe25519_sub(r.Z, r.Y);
+    r.Y = fe25519_add(r.Z, r.Y);
+    r.Z = fe25519_add(t0, r.T);
+    r.T = fe25519_sub(t0, r.T);
+    return r;
+}
+
+/*
+r = p - q, with q in affine form.
+*/
+ge25519_p1p1 ge25519_msub(ge25519_p3 p, ge25519_precomp q)
+{
+    ge25519_p1p1 r;
+    r.X = fe25519_add(p.Y, p.X);
+    r.Y = fe25519_sub(p.Y, p.X);
+    r.Z = fe25519_mul(r.X, q.yminusx);
+    r.Y = fe25519_mul(r.Y, q.yplusx);
+    r.T = fe25519_mul(q.xy2d, p.T);
+    fe25519 t0 = fe25519_add(p.Z, p.Z);
+    r.X = fe25519_sub(r.Z, r.Y);
+    r.Y = fe25519_add(r.Z, r.Y);
+    r.Z = fe25519_sub(t0, r.T);
+    r.T = fe25519_add(t0, r.T);
+    return r;
+}
+
+/*
+Returns u if b == 1 and t if b == 0, without branching on b.
+*/
+ge25519_precomp ge25519_cmov_precomp(ge25519_precomp t, ge25519_precomp u, uint b)
+{
+    ge25519_precomp r;
+    r.yplusx = fe25519_cmov(t.yplusx, u.yplusx, b);
+    r.yminusx = fe25519_cmov(t.yminusx, u.yminusx, b);
+    r.xy2d = fe25519_cmov(t.xy2d, u.xy2d, b);
+    return r;
+}
+
+/*
+Compresses h to 32 bytes: y, with the sign of x in the top bit. Bytes are laid out as for
+fe25519_tobytes.
+*/
+fe25519 ge25519_tobytes(ge25519_p2 h)
+{
+    fe25519 recip = fe25519_invert(h.Z);
+    fe25519 x = fe25519_mul(h.X, recip);
+    fe25519 y = fe25519_mul(h.Y, recip);
+    fe25519 s = fe25519_tobytes(y);
+    s.value[7] ^= fe25519_isnegative(x) << 31;
+    return s;
+}
+
+/*
+Decompresses s and negates the point, as verification needs -A. Returns false when s is not
+the encoding of a point on the curve.
+*/
+bool ge25519_frombytes_negate_vartime(out ge25519_p3 h, fe25519 s)
+{
+    h.Y = fe25519_frombytes(s);
+    h.Z = fe25519_one();
+    fe25519 u = fe25519_sq(h.Y);
+    fe25519 v = fe25519_mul(u, fe25519(d));
+    u = fe25519_sub(u, h.Z);        /* u = y^2-1 */
+    v = fe25519_add(v, h.Z);        /* v = dy^2+1 */
+
+    fe25519 v3 = fe25519_sq(v);
+    v3 = fe25519_mul(v3, v);        /* v3 = v^3 */
+    h.X = fe25519_sq(v3);
+    h.X = fe25519_mul(h.X, v);
+    h.X = fe25519_mul(h.X, u);      /* x = uv^7 */
+
+    h.X = fe25519_pow22523(h.X);    /* x = (uv^7)^((q-5)/8) */
+    h.X = fe25519_mul(h.X, v3);
+    h.X = fe25519_mul(h.X, u);      /* x = uv^3(uv^7)^((q-5)/8) */
+
+    fe25519 vxx = fe25519_sq(h.X);
+    vxx = fe25519_mul(vxx, v);
+    fe25519 check = fe25519_sub(vxx, u);    /* vx^2-u */
+    if (fe25519_isnonzero(check)) {
+        check = fe25519_add(vxx, u);        /* vx^2+u */
+        if (fe25519_isnonzero(check)) {
+            h.T = fe25519_zero();
+            return false;
+        }
+        h.X = fe25519_mul(h.X, fe25519(sqrtm1));
+    }
+
+    if (fe25519_isnegative(h.X) == int(uint(s.value[7]) >> 31)) {
+        h.X = fe25519_neg(h.X);
+    }
+
+    h.T = fe25519_mul(h.X, h.Y);
+    return true;
+}
+
+
+/*
+Signed sliding windows of a 256 bit scalar given as bytes: 256 digits, each zero or odd
+and in [-15, 15], with sum(r[i] * 2^i) equal to the scalar. The digits are packed four
+to an int to keep them out of scratch memory as far as possible.
+*/
+int ge25519_slideGet(int r[64], int i)
+{
+    return bitfieldExtract(r[i >> 2], 8 * (i & 3), 8);
+}
+
+void ge25519_slideSet(inout int r[64], int i, int value)
+{
+    r[i >> 2] = bitfieldInsert(r[i >> 2], value, 8 * (i & 3), 8);
+}
+
+void ge25519_slide(out int r[64], fe25519 a)
+{
+    for (int i = 0; i < 64; ++i) {
+        int w = a.value[i >> 3];
+        int k = 4 * (i & 7);
+        // One bit per byte of the packed int.
+        r[i] = ((w >> k) & 1) | (((w >> (k + 1)) & 1) << 8) | (((w >> (k + 2)) & 1) << 16) | (((w >> (k + 3)) & 1) << 24);
+    }
+
+    for (int i = 0; i < 256; ++i) {
+        int ri = ge25519_slideGet(r, i);
+        if (ri == 0) {
+            continue;
+        }
+        for (int b = 1; b <= 6 && i + b < 256; ++b) {
+            int rib = ge25519_slideGet(r, i + b);
+            if (rib == 0) {
+                continue;
+            }
+            if (ri + (rib << b) <= 15) {
+                ri += rib << b;
+                ge25519_slideSet(r, i + b, 0);
+            } else if (ri - (rib << b) >= -15) {
+                ri -= rib << b;
+                for (int k = i + b; k < 256; ++k) {
+                    if (ge25519_slideGet(r, k) == 0) {
+                        ge25519_slideSet(r, k, 1);
+                        break;
+                    }
+                    ge25519_slideSet(r, k, 0);
+                }
+            } else {
+                break;
+            }
+        }
+        ge25519_slideSet(r, i, ri);
+    }
+}
+
+/*
+r = a * A + b * B, where B is the base point and a and b are scalars as bytes.
+Variable time, only for public data such as signatures being verified.
+*/
+ge25519_p2 ge25519_double_scalarmult_vartime(fe25519 a, ge25519_p3 A, fe25519 b)
+{
+    int aslide[64];
+    int bslide[64];
+    ge25519_slide(aslide, a);
+    ge25519_slide(bslide, b);
+
+    ge25519_cached Ai[8]; /* A,3A,5A,7A,9A,11A,13A,15A */
+    Ai[0] = ge25519_p3_to_cached(A);
+    ge25519_p3 A2 = ge25519_p1p1_to_p3(ge25519_p3_dbl(A));
+    for (int i = 0; i < 7; ++i) {
+        ge25519_p3 u = ge25519_p1p1_to_p3(ge25519_add(A2, Ai[i]));
+        Ai[i + 1] = ge25519_p3_to_cached(u);
+    }
+
+    ge25519_p2 r = ge25519_p2_0();
+
+    int i = 255;
+    for (; i >= 0; --i) {
+        if (ge25519_slideGet(aslide, i) != 0 || ge25519_slideGet(bslide, i) != 0) {
+            break;
+        }
+    }
+
+    for (; i >= 0; --i) {
+        ge25519_p1p1 t = ge25519_p2_dbl(r);
+
+        int ai = ge25519_slideGet(aslide, i);
+        if (ai > 0) {
+            t = ge25519_add(ge25519_p1p1_to_p3(t), Ai[ai / 2]);
+        } else if (ai < 0) {
+            t = ge25519_sub(ge25519_p1p1_to_p3(t), Ai[(-ai) / 2]);
+        }
+
+        int bi = ge25519_slideGet(bslide, i);
+        if (bi > 0) {
+            t = ge25519_madd(ge25519_p1p1_to_p3(t), ge25519_loadBi(bi / 2));
+        } else if (bi < 0) {
+            t = ge25519_msub(ge25519_p1p1_to_p3(t), ge25519_loadBi((-bi) / 2));
+        }
+
+        r = ge25519_p1p1_to_p2(t);
+    }
+    return r;
+}
@@ -0,0 +1,62 @@
+//
+//  x25519_ref.cpp
+//  TestingVulkan
+//
+//  Keep in step with shaders/x25519.comp.
+//
+
+#include "x25519_ref.hpp"
+
+static const int32_t curve25519_a24 = 121666;
+
+fe25519 x25519_ref_scalarmult(fe25519 n, const fe25519& p) {
+    n.value[0] &= ~7;
+    n.value[7] &= 0x7fffffff;
+    n.value[7] |= 0x40000000;
+
+    fe25519 x1 = fe25519_ref_frombytes(p);
+    fe25519 x2 = fe25519_ref_one();
+    fe25519 z2 = fe25519_ref_zero();
+    fe25519 x3 = x1;
+    fe25519 z3 = fe25519_ref_one();
+    uint32_t swap = 0;
+
+    for (int pos = 254; pos >= 0; --pos) {
+        uint32_t b = ((uint32_t)n.value[pos >> 5] >> (pos & 31)) & 1u;
+        swap ^= b;
+        fe25519_ref_cswap(x2, x3, swap);
+        fe25519_ref_cswap(z2, z3, swap);
+        swap = b;
+
+        fe25519 tmp0 = fe25519_ref_sub(x3, z3);
+        fe25519 tmp1 = fe25519_ref_sub(x2, z2);
+        x2 = fe25519_ref_add(x2, z2);
+        z2 = fe25519_ref_add(x3, z3);
+        z3 = fe25519_ref_mul(tmp0, x2);
+        z2 = fe25519_ref_mul(z2, tmp1);
+        tmp0 = fe25519_ref_sq(tmp1);
+        tmp1 = fe25519_ref_sq(x2);
+        x3 = fe25519_ref_add(z3, z2);
+        z2 = fe25519_ref_sub(z3, z2);
+        x2 = fe25519_ref_mul(tmp1, tmp0);
+        tmp1 = fe25519_ref_sub(tmp1, tmp0);
+        z2 = fe25519_ref_sq(z2);
+        z3 = fe25519_ref_mul32(tmp1, curve25519_a24);
+        x3 = fe25519_ref_sq(x3);
+        tmp0 = fe25519_ref_add(tmp0, z3);
+        z3 = fe25519_ref_mul(x1, z2);
+        z2 = fe25519_ref_mul(tmp1, tmp0);
+    }
+    fe25519_ref_cswap(x2, x3, swap);
+    fe25519_ref_cswap(z2, z3, swap);
+
+    z2 = fe25519_ref_invert(z2);
+    x2 = fe25519_ref_mul(x2, z2);
+    return fe25519_ref_tobytes(x2);
+}
+
+void x25519_ref_run(const duble_fe25519* input, fe25519* output, uint32_t count) {
+    for (uint32_t i = 0; i < count; ++i) {
+        output[i] = x25519_ref_scalarmult(input[i].value[0], input[i].value[1]);
+    }
+}
@@ -0,0 +1,22 @@
+//
+//  x25519_ref.hpp
+//  TestingVulkan
+//
+//  CPU port of the Montgomery ladder in shaders/x25519.comp.
+//
+
+#ifndef x25519_ref_hpp
+#define x25519_ref_hpp
+
+#include "fe25519_ref.hpp"
+
+/*
+ X25519 of RFC 7748. The scalar, the u-coordinate and the result are 32 bytes in the first
+ 8 words of a fe25519, as for fe25519_ref_frombytes. The scalar is clamped here.
+ */
+fe25519 x25519_ref_scalarmult(fe25519 n, const fe25519& p);
+
+// Runs the ladder over a batch the way the x25519 kernel does, for checking its output.
+void x25519_ref_run(const duble_fe25519* input, fe25519* output, uint32_t count);
+
+#endif /* x25519_ref_hpp */